@@ -0,0 +1,240 @@
+#include <OpenHome/Private/Printer.h>
+#include <OpenHome/Private/Standard.h>
+
+#include <time.h>
+#include <vector>
+
+#include "AlsaCalibration.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// Candidate buffer times, smallest first, and the periods per buffer tried
+// for each.
+static const TUint kBufferMs[] = { 5, 10, 15, 20, 30, 40, 60, 80, 100 };
+static const TUint kPeriods[]  = { 4, 2 };
+
+static TUint64 MonotonicUs()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((TUint64)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+int OpenHome::Media::AlsaSetParams(snd_pcm_t* aHandle,
+                                   snd_pcm_format_t aFormat,
+                                   snd_pcm_access_t aAccess,
+                                   TUint aChannels, TUint aRate,
+                                   TUint aBufferUs, TUint aPeriodUs)
+{
+    snd_pcm_hw_params_t *hwParams;
+    snd_pcm_sw_params_t *swParams;
+    snd_pcm_uframes_t    bufferSize;
+    snd_pcm_uframes_t    periodSize;
+    unsigned int         bufferUs = aBufferUs;
+    unsigned int         periodUs = (aPeriodUs != 0) ? aPeriodUs
+                                                     : (aBufferUs / 4);
+    int                  dir      = 0;
+    int                  err;
+
+    snd_pcm_hw_params_alloca(&hwParams);
+    snd_pcm_sw_params_alloca(&swParams);
+
+    if ((err = snd_pcm_hw_params_any(aHandle, hwParams)) < 0 ||
+        (err = snd_pcm_hw_params_set_rate_resample(aHandle, hwParams, 0)) < 0 ||
+        (err = snd_pcm_hw_params_set_access(aHandle, hwParams, aAccess)) < 0 ||
+        (err = snd_pcm_hw_params_set_format(aHandle, hwParams, aFormat)) < 0 ||
+        (err = snd_pcm_hw_params_set_channels(aHandle, hwParams,
+                                              aChannels)) < 0 ||
+        (err = snd_pcm_hw_params_set_rate(aHandle, hwParams, aRate, 0)) < 0 ||
+        (err = snd_pcm_hw_params_set_buffer_time_near(aHandle, hwParams,
+                                                      &bufferUs, &dir)) < 0 ||
+        (err = snd_pcm_hw_params_set_period_time_near(aHandle, hwParams,
+                                                      &periodUs, &dir)) < 0 ||
+        (err = snd_pcm_hw_params(aHandle, hwParams)) < 0)
+    {
+        return err;
+    }
+
+    snd_pcm_hw_params_get_buffer_size(hwParams, &bufferSize);
+    snd_pcm_hw_params_get_period_size(hwParams, &periodSize, &dir);
+
+    // Start once the buffer is full and wake up a period at a time. Status
+    // timestamps use CLOCK_MONOTONIC so delays can be extrapolated.
+    if ((err = snd_pcm_sw_params_current(aHandle, swParams)) < 0 ||
+        (err = snd_pcm_sw_params_set_start_threshold(
+                   aHandle, swParams,
+                   (bufferSize / periodSize) * periodSize)) < 0 ||
+        (err = snd_pcm_sw_params_set_avail_min(aHandle, swParams,
+                                               periodSize)) < 0 ||
+        (err = snd_pcm_sw_params_set_tstamp_mode(aHandle, swParams,
+                                                 SND_PCM_TSTAMP_ENABLE)) < 0 ||
+        (err = snd_pcm_sw_params_set_tstamp_type(
+                   aHandle, swParams, SND_PCM_TSTAMP_TYPE_MONOTONIC)) < 0 ||
+        (err = snd_pcm_sw_params(aHandle, swParams)) < 0)
+    {
+        return err;
+    }
+
+    return 0;
+}
+
+AlsaCalibration::AlsaCalibration()
+: iBufferUs(0)
+, iPeriodUs(0)
+{
+}
+
+TBool AlsaCalibration::Run(snd_pcm_t* aHandle, snd_pcm_format_t aFormat,
+                           TUint aChannels, TUint aRate)
+{
+    iReport.Replace("");
+    iReport.AppendPrintf("%s, %u channels, %u Hz\n",
+                         snd_pcm_format_name(aFormat), aChannels, aRate);
+
+    for (TUint b = 0; b < sizeof(kBufferMs) / sizeof(kBufferMs[0]); b++)
+    {
+        for (TUint p = 0; p < sizeof(kPeriods) / sizeof(kPeriods[0]); p++)
+        {
+            const TUint bufferUs = kBufferMs[b] * 1000;
+            const TUint periodUs = bufferUs / kPeriods[p];
+
+            if (Trial(aHandle, aFormat, aChannels, aRate, bufferUs, periodUs,
+                      iReport))
+            {
+                iBufferUs = bufferUs * kMargin;
+                iPeriodUs = periodUs * kMargin;
+
+                iReport.AppendPrintf("Using %uus / %uus\n", iBufferUs,
+                                     iPeriodUs);
+                Log::Print("AlsaCalibration: passed at buffer %uus, period "
+                           "%uus, using %uus, %uus\n", bufferUs, periodUs,
+                           iBufferUs, iPeriodUs);
+                return true;
+            }
+        }
+    }
+
+    Log::Print("AlsaCalibration: no candidate played without underruns\n");
+    return false;
+}
+
+TUint AlsaCalibration::BufferUs() const
+{
+    return iBufferUs;
+}
+
+TUint AlsaCalibration::PeriodUs() const
+{
+    return iPeriodUs;
+}
+
+void AlsaCalibration::Write(IWriter& aWriter) const
+{
+    aWriter.Write(iReport);
+}
+
+// Play silence with the given buffer and period times, counting xruns and
+// measuring how late the thread wakes after each period.
+TBool AlsaCalibration::Trial(snd_pcm_t* aHandle, snd_pcm_format_t aFormat,
+                             TUint aChannels, TUint aRate, TUint aBufferUs,
+                             TUint aPeriodUs, Bwx& aReport)
+{
+    const TUint trialBytes = aReport.Bytes();
+
+    aReport.AppendPrintf("  %6uus / %6uus: ", aBufferUs, aPeriodUs);
+
+    auto err = AlsaSetParams(aHandle, aFormat, SND_PCM_ACCESS_RW_INTERLEAVED,
+                             aChannels, aRate, aBufferUs, aPeriodUs);
+    if (err < 0)
+    {
+        aReport.AppendPrintf("rejected (%s)\n", snd_strerror(err));
+        return false;
+    }
+
+    snd_pcm_uframes_t bufferSize;
+    snd_pcm_uframes_t periodSize;
+
+    snd_pcm_get_params(aHandle, &bufferSize, &periodSize);
+
+    const TUint   samples  = (TUint)periodSize * aChannels;
+    const TUint64 periodUs = ((TUint64)periodSize * 1000000) / aRate;
+    const TUint64 slackUs  = ((TUint64)(bufferSize - periodSize) * 1000000) /
+                             aRate;
+    std::vector<TByte> silence((snd_pcm_format_physical_width(aFormat) / 8) *
+                               samples);
+
+    snd_pcm_format_set_silence(aFormat, silence.data(), samples);
+
+    TUint   xruns     = 0;
+    TUint64 maxJitter = 0;
+    TUint64 lastWake  = 0;
+    TBool   failed    = false;
+
+    const TUint64 start = MonotonicUs();
+
+    while (MonotonicUs() - start < kTrialMs * 1000)
+    {
+        auto written = snd_pcm_writei(aHandle, silence.data(), periodSize);
+
+        if (written >= 0)
+        {
+            continue;
+        }
+
+        if (written == -EAGAIN)
+        {
+            // Errors show up on the next write.
+            snd_pcm_wait(aHandle, kTrialMs);
+
+            const TUint64 now = MonotonicUs();
+
+            if ((lastWake != 0) &&
+                (snd_pcm_state(aHandle) == SND_PCM_STATE_RUNNING))
+            {
+                const TUint64 interval = now - lastWake;
+
+                if ((interval > periodUs) && (interval - periodUs > maxJitter))
+                {
+                    maxJitter = interval - periodUs;
+                }
+            }
+
+            lastWake = now;
+        }
+        else if (snd_pcm_recover(aHandle, (int)written, 1) == 0)
+        {
+            xruns++;
+            lastWake = 0;
+        }
+        else
+        {
+            aReport.AppendPrintf("error (%s)\n", snd_strerror((int)written));
+            failed = true;
+            break;
+        }
+    }
+
+    snd_pcm_drop(aHandle);
+
+    if (failed)
+    {
+        return false;
+    }
+
+    // Late wake ups must leave at least half the slack as margin.
+    const TBool pass = (xruns == 0) && (maxJitter < slackUs / 2);
+
+    aReport.AppendPrintf("%u xruns, max jitter %uus, %s\n", xruns,
+                         (TUint)maxJitter, pass ? "pass" : "fail");
+
+    // Keep the report to the outcome if it is running out of room.
+    if (aReport.BytesRemaining() < 128)
+    {
+        aReport.SetBytes(trialBytes);
+    }
+
+    return pass;
+}
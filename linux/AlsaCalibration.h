@@ -0,0 +1,56 @@
+#pragma once
+
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Types.h>
+
+#include <alsa/asoundlib.h>
+
+namespace OpenHome {
+namespace Media {
+
+// Configure a PCM, as snd_pcm_set_params() does, but with an explicit
+// period time. A period time of 0 leaves four periods per buffer. Status
+// timestamps are enabled, from CLOCK_MONOTONIC.
+//
+// Returns 0 or a negative ALSA error code.
+int AlsaSetParams(snd_pcm_t* aHandle, snd_pcm_format_t aFormat,
+                  snd_pcm_access_t aAccess, TUint aChannels, TUint aRate,
+                  TUint aBufferUs, TUint aPeriodUs);
+
+// AlsaCalibration
+//
+// Finds the smallest buffer and period times a device plays without
+// underruns. Each candidate, smallest first, plays silence for a short
+// while. A candidate passes if there are no xruns and the thread's wake up
+// jitter stays well inside the slack the buffer provides. The times chosen
+// are those of the first passing candidate scaled by kMargin, as the
+// trials run without the load of decoding.
+//
+// The PCM must be idle. It is left configured for the last candidate
+// tried, so the caller must reconfigure it before playing audio.
+
+class AlsaCalibration
+{
+public:
+    AlsaCalibration();
+
+    TBool Run(snd_pcm_t* aHandle, snd_pcm_format_t aFormat, TUint aChannels,
+              TUint aRate);
+    TUint BufferUs() const;
+    TUint PeriodUs() const;
+    void  Write(IWriter& aWriter) const;  // Outcome of each trial.
+private:
+    TBool Trial(snd_pcm_t* aHandle, snd_pcm_format_t aFormat,
+                TUint aChannels, TUint aRate, TUint aBufferUs,
+                TUint aPeriodUs, Bwx& aReport);
+private:
+    static const TUint kTrialMs = 750;
+    static const TUint kMargin  = 2;
+private:
+    TUint      iBufferUs;
+    TUint      iPeriodUs;
+    Bws<2048>  iReport;
+};
+
+} // namespace Media
+} // namespace OpenHome
@@ -0,0 +1,245 @@
+#include <OpenHome/Private/Printer.h>
+#include <OpenHome/Private/Standard.h>
+
+#include "AlsaCapabilities.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// Every rate the pipeline delivers, and the higher multiples devices
+// offer. A rate missing here is never played natively.
+const TUint AlsaCapabilities::kRates[] =
+{
+    7350, 8000, 11025, 12000, 14700, 16000, 22050, 24000, 29400, 32000,
+    44100, 48000, 64000, 88200, 96000, 176400, 192000, 352800, 384000,
+    705600, 768000
+};
+
+const TUint AlsaCapabilities::kNumRates =
+    sizeof(kRates) / sizeof(kRates[0]);
+
+AlsaCapabilities::AlsaCapabilities()
+: iFormats(0)
+, iRates(0)
+, iRateMin(0)
+, iRateMax(0)
+, iChannelsMin(0)
+, iChannelsMax(0)
+, iBufferMin(0)
+, iBufferMax(0)
+, iPeriodMin(0)
+, iPeriodMax(0)
+, iMaxBitDepth(0)
+{
+}
+
+TBool AlsaCapabilities::Probe(snd_pcm_t* aHandle)
+{
+    static_assert(SND_PCM_FORMAT_LAST < 64, "Format mask too small");
+    static_assert(kNumRates <= 32, "Rate mask too small");
+
+    snd_pcm_hw_params_t *hwParams;
+
+    snd_pcm_hw_params_alloca(&hwParams);
+
+    auto err = snd_pcm_hw_params_any(aHandle, hwParams);
+    if (err < 0)
+    {
+        Log::Print("AlsaCapabilities: Cannot get hardware parameters: %s\n",
+                   snd_strerror(err));
+        return false;
+    }
+
+    for (TInt format = 0; format <= SND_PCM_FORMAT_LAST; format++)
+    {
+        if (snd_pcm_hw_params_test_format(aHandle, hwParams,
+                                          (snd_pcm_format_t)format) == 0)
+        {
+            iFormats |= (TUint64)1 << format;
+        }
+    }
+
+    for (TUint i = 0; i < kNumRates; i++)
+    {
+        if (snd_pcm_hw_params_test_rate(aHandle, hwParams, kRates[i], 0) == 0)
+        {
+            iRates |= 1 << i;
+        }
+    }
+
+    unsigned int value;
+    int          dir = 0;
+
+    if (snd_pcm_hw_params_get_rate_min(hwParams, &value, &dir) == 0)
+    {
+        iRateMin = value;
+    }
+
+    if (snd_pcm_hw_params_get_rate_max(hwParams, &value, &dir) == 0)
+    {
+        iRateMax = value;
+    }
+
+    if (snd_pcm_hw_params_get_channels_min(hwParams, &value) == 0)
+    {
+        iChannelsMin = value;
+    }
+
+    if (snd_pcm_hw_params_get_channels_max(hwParams, &value) == 0)
+    {
+        iChannelsMax = value;
+    }
+
+    snd_pcm_hw_params_get_buffer_size_min(hwParams, &iBufferMin);
+    snd_pcm_hw_params_get_buffer_size_max(hwParams, &iBufferMax);
+    snd_pcm_hw_params_get_period_size_min(hwParams, &iPeriodMin, &dir);
+    snd_pcm_hw_params_get_period_size_max(hwParams, &iPeriodMax, &dir);
+
+    // Deepest linear PCM format. The pipeline carries at most 24 bits.
+    iMaxBitDepth = 0;
+
+    if (SupportsFormat(SND_PCM_FORMAT_S32_LE)  ||
+        SupportsFormat(SND_PCM_FORMAT_S24_LE)  ||
+        SupportsFormat(SND_PCM_FORMAT_S24_3LE))
+    {
+        iMaxBitDepth = 24;
+    }
+    else if (SupportsFormat(SND_PCM_FORMAT_S16_LE))
+    {
+        iMaxBitDepth = 16;
+    }
+    else if (SupportsFormat(SND_PCM_FORMAT_U8))
+    {
+        iMaxBitDepth = 8;
+    }
+
+    return true;
+}
+
+TBool AlsaCapabilities::SupportsFormat(snd_pcm_format_t aFormat) const
+{
+    if ((aFormat < 0) || (aFormat > SND_PCM_FORMAT_LAST))
+    {
+        return false;
+    }
+
+    return (iFormats & ((TUint64)1 << aFormat)) != 0;
+}
+
+TBool AlsaCapabilities::SupportsRate(TUint aSampleRate) const
+{
+    for (TUint i = 0; i < kNumRates; i++)
+    {
+        if (kRates[i] == aSampleRate)
+        {
+            return (iRates & (1 << i)) != 0;
+        }
+    }
+
+    return false;
+}
+
+TUint AlsaCapabilities::ResampleRate(TUint aSampleRate) const
+{
+    TUint above = 0;
+    TUint below = 0;
+
+    if (aSampleRate == 0)
+    {
+        return 0;
+    }
+
+    for (TUint i = 0; i < kNumRates; i++)
+    {
+        if ((iRates & (1 << i)) == 0)
+        {
+            continue;
+        }
+
+        // Whole multiples keep the filter bank small.
+        if ((kRates[i] > aSampleRate) && ((kRates[i] % aSampleRate) == 0))
+        {
+            return kRates[i];
+        }
+
+        if ((kRates[i] > aSampleRate) && (above == 0))
+        {
+            above = kRates[i];
+        }
+        else if (kRates[i] < aSampleRate)
+        {
+            below = kRates[i];
+        }
+    }
+
+    return (above != 0) ? above : below;
+}
+
+TBool AlsaCapabilities::SupportsChannels(TUint aNumChannels) const
+{
+    return (aNumChannels >= iChannelsMin) && (aNumChannels <= iChannelsMax);
+}
+
+TUint AlsaCapabilities::ChannelsFor(TUint aNumChannels,
+                                    TUint aMaxChannels) const
+{
+    const TUint lo = (iChannelsMin > 1) ? iChannelsMin : 1;
+    const TUint hi = (iChannelsMax < aMaxChannels) ? iChannelsMax
+                                                   : aMaxChannels;
+
+    if (lo > hi)
+    {
+        return 0;
+    }
+
+    if (aNumChannels < lo)
+    {
+        return lo;
+    }
+
+    return (aNumChannels > hi) ? hi : aNumChannels;
+}
+
+TUint AlsaCapabilities::MaxBitDepth() const
+{
+    return iMaxBitDepth;
+}
+
+void AlsaCapabilities::Write(IWriter& aWriter) const
+{
+    Bws<256> line;
+
+    aWriter.Write(Brn("Formats:"));
+
+    for (TInt format = 0; format <= SND_PCM_FORMAT_LAST; format++)
+    {
+        if (SupportsFormat((snd_pcm_format_t)format))
+        {
+            line.Replace(" ");
+            line.Append(snd_pcm_format_name((snd_pcm_format_t)format));
+            aWriter.Write(line);
+        }
+    }
+
+    aWriter.Write(Brn("\nRates:  "));
+
+    for (TUint i = 0; i < kNumRates; i++)
+    {
+        if ((iRates & (1 << i)) != 0)
+        {
+            line.Replace("");
+            line.AppendPrintf(" %u", kRates[i]);
+            aWriter.Write(line);
+        }
+    }
+
+    line.Replace("");
+    line.AppendPrintf(" (range %u - %u)\n", iRateMin, iRateMax);
+    line.AppendPrintf("Channels: %u - %u\n", iChannelsMin, iChannelsMax);
+    line.AppendPrintf("Buffer:   %lu - %lu frames\n",
+                      (unsigned long)iBufferMin, (unsigned long)iBufferMax);
+    line.AppendPrintf("Period:   %lu - %lu frames\n",
+                      (unsigned long)iPeriodMin, (unsigned long)iPeriodMax);
+    line.AppendPrintf("Max bit depth: %u\n", iMaxBitDepth);
+    aWriter.Write(line);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Types.h>
+
+#include <alsa/asoundlib.h>
+
+// Capabilities of an ALSA playback device.
+//
+// The hardware parameter space of the device is probed once, when it is
+// opened, and kept as a handful of bitmasks and ranges. Format selection
+// and pipeline queries then answer from the table without going back to
+// ALSA.
+
+namespace OpenHome {
+namespace Media {
+
+class AlsaCapabilities
+{
+public:
+    // Standard rates checked individually. Other rates are reported as
+    // unsupported.
+    static const TUint kRates[];
+    static const TUint kNumRates;
+public:
+    AlsaCapabilities();
+
+    // Probe an open, unconfigured, PCM. Returns false if ALSA could not
+    // describe the device, leaving the table empty.
+    TBool Probe(snd_pcm_t* aHandle);
+
+    TBool SupportsFormat(snd_pcm_format_t aFormat) const;
+    TBool SupportsRate(TUint aSampleRate) const;
+    // The supported rate to resample aSampleRate to: the lowest whole
+    // multiple of it, else the lowest rate above it, else the highest
+    // below. 0 if no standard rate is supported.
+    TUint ResampleRate(TUint aSampleRate) const;
+    TBool SupportsChannels(TUint aNumChannels) const;
+    // The channel count, at most aMaxChannels, to play aNumChannels at:
+    // aNumChannels itself, else the fewest above it, else the most below.
+    // 0 if no count in range is supported.
+    TUint ChannelsFor(TUint aNumChannels, TUint aMaxChannels) const;
+    TUint MaxBitDepth() const;  // Deepest PCM format, capped at 24 bits.
+
+    void  Write(IWriter& aWriter) const;
+private:
+    TUint64           iFormats;  // Bit per snd_pcm_format_t.
+    TUint             iRates;    // Bit per entry of kRates.
+    TUint             iRateMin;
+    TUint             iRateMax;
+    TUint             iChannelsMin;
+    TUint             iChannelsMax;
+    snd_pcm_uframes_t iBufferMin;
+    snd_pcm_uframes_t iBufferMax;
+    snd_pcm_uframes_t iPeriodMin;
+    snd_pcm_uframes_t iPeriodMax;
+    TUint             iMaxBitDepth;
+};
+
+} // namespace Media
+} // namespace OpenHome
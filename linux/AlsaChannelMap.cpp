@@ -0,0 +1,386 @@
+#include <OpenHome/Private/Printer.h>
+#include <OpenHome/Private/Standard.h>
+
+#include <stdlib.h>
+
+#include "AlsaChannelMap.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// Layouts by channel count, unused positions are SND_CHMAP_UNKNOWN.
+static const TUint kStreamLayouts[AlsaChannelMap::kMaxChannels]
+                                 [AlsaChannelMap::kMaxChannels] =
+{
+    { SND_CHMAP_MONO },
+    { SND_CHMAP_FL, SND_CHMAP_FR },
+    { SND_CHMAP_FL, SND_CHMAP_FR, SND_CHMAP_FC },
+    { SND_CHMAP_FL, SND_CHMAP_FR, SND_CHMAP_RL, SND_CHMAP_RR },
+    { SND_CHMAP_FL, SND_CHMAP_FR, SND_CHMAP_FC, SND_CHMAP_RL, SND_CHMAP_RR },
+    { SND_CHMAP_FL, SND_CHMAP_FR, SND_CHMAP_FC, SND_CHMAP_LFE,
+      SND_CHMAP_RL, SND_CHMAP_RR },
+    { SND_CHMAP_FL, SND_CHMAP_FR, SND_CHMAP_FC, SND_CHMAP_LFE,
+      SND_CHMAP_RC, SND_CHMAP_SL, SND_CHMAP_SR },
+    { SND_CHMAP_FL, SND_CHMAP_FR, SND_CHMAP_FC, SND_CHMAP_LFE,
+      SND_CHMAP_RL, SND_CHMAP_RR, SND_CHMAP_SL, SND_CHMAP_SR },
+};
+
+// The order of ALSA's surround devices, assumed for devices without maps.
+static const TUint kDeviceLayouts[AlsaChannelMap::kMaxChannels]
+                                 [AlsaChannelMap::kMaxChannels] =
+{
+    { SND_CHMAP_MONO },
+    { SND_CHMAP_FL, SND_CHMAP_FR },
+    { SND_CHMAP_FL, SND_CHMAP_FR, SND_CHMAP_FC },
+    { SND_CHMAP_FL, SND_CHMAP_FR, SND_CHMAP_RL, SND_CHMAP_RR },
+    { SND_CHMAP_FL, SND_CHMAP_FR, SND_CHMAP_RL, SND_CHMAP_RR, SND_CHMAP_FC },
+    { SND_CHMAP_FL, SND_CHMAP_FR, SND_CHMAP_RL, SND_CHMAP_RR,
+      SND_CHMAP_FC, SND_CHMAP_LFE },
+    { SND_CHMAP_FL, SND_CHMAP_FR, SND_CHMAP_RL, SND_CHMAP_RR,
+      SND_CHMAP_FC, SND_CHMAP_LFE, SND_CHMAP_RC },
+    { SND_CHMAP_FL, SND_CHMAP_FR, SND_CHMAP_RL, SND_CHMAP_RR,
+      SND_CHMAP_FC, SND_CHMAP_LFE, SND_CHMAP_SL, SND_CHMAP_SR },
+};
+
+// Where a channel goes when the device lacks its speaker. The first fold
+// whose speakers the device has is used. LFE is never folded, as full
+// range speakers can't be assumed to handle it.
+struct ChannelFold
+{
+    TUint  iFrom;
+    TUint  iTo[2];  // Second is SND_CHMAP_UNKNOWN for a single speaker.
+    TFloat iGain;
+};
+
+static const TFloat kMinus3dB = 0.7071068f;
+
+static const ChannelFold kFolds[] =
+{
+    { SND_CHMAP_MONO, { SND_CHMAP_FL,   SND_CHMAP_FR },      1.0f },
+    { SND_CHMAP_MONO, { SND_CHMAP_FC,   SND_CHMAP_UNKNOWN }, 1.0f },
+    { SND_CHMAP_FL,   { SND_CHMAP_MONO, SND_CHMAP_UNKNOWN }, kMinus3dB },
+    { SND_CHMAP_FL,   { SND_CHMAP_FC,   SND_CHMAP_UNKNOWN }, kMinus3dB },
+    { SND_CHMAP_FR,   { SND_CHMAP_MONO, SND_CHMAP_UNKNOWN }, kMinus3dB },
+    { SND_CHMAP_FR,   { SND_CHMAP_FC,   SND_CHMAP_UNKNOWN }, kMinus3dB },
+    { SND_CHMAP_FC,   { SND_CHMAP_FL,   SND_CHMAP_FR },      kMinus3dB },
+    { SND_CHMAP_FC,   { SND_CHMAP_MONO, SND_CHMAP_UNKNOWN }, 1.0f },
+    { SND_CHMAP_RL,   { SND_CHMAP_SL,   SND_CHMAP_UNKNOWN }, 1.0f },
+    { SND_CHMAP_RL,   { SND_CHMAP_FL,   SND_CHMAP_UNKNOWN }, kMinus3dB },
+    { SND_CHMAP_RL,   { SND_CHMAP_MONO, SND_CHMAP_UNKNOWN }, kMinus3dB },
+    { SND_CHMAP_RR,   { SND_CHMAP_SR,   SND_CHMAP_UNKNOWN }, 1.0f },
+    { SND_CHMAP_RR,   { SND_CHMAP_FR,   SND_CHMAP_UNKNOWN }, kMinus3dB },
+    { SND_CHMAP_RR,   { SND_CHMAP_MONO, SND_CHMAP_UNKNOWN }, kMinus3dB },
+    { SND_CHMAP_SL,   { SND_CHMAP_RL,   SND_CHMAP_UNKNOWN }, 1.0f },
+    { SND_CHMAP_SL,   { SND_CHMAP_FL,   SND_CHMAP_UNKNOWN }, kMinus3dB },
+    { SND_CHMAP_SL,   { SND_CHMAP_MONO, SND_CHMAP_UNKNOWN }, kMinus3dB },
+    { SND_CHMAP_SR,   { SND_CHMAP_RR,   SND_CHMAP_UNKNOWN }, 1.0f },
+    { SND_CHMAP_SR,   { SND_CHMAP_FR,   SND_CHMAP_UNKNOWN }, kMinus3dB },
+    { SND_CHMAP_SR,   { SND_CHMAP_MONO, SND_CHMAP_UNKNOWN }, kMinus3dB },
+    { SND_CHMAP_RC,   { SND_CHMAP_RL,   SND_CHMAP_RR },      kMinus3dB },
+    { SND_CHMAP_RC,   { SND_CHMAP_SL,   SND_CHMAP_SR },      kMinus3dB },
+    { SND_CHMAP_RC,   { SND_CHMAP_FL,   SND_CHMAP_FR },      kMinus3dB },
+    { SND_CHMAP_RC,   { SND_CHMAP_MONO, SND_CHMAP_UNKNOWN }, kMinus3dB },
+};
+
+// Where speakers sit, for balance and fade. Positions not listed, such as
+// centre, LFE and side speakers, are left alone by one or both.
+struct SpeakerPlace
+{
+    TUint iPosition;
+    TInt  iSide;   // -1 left, 1 right, 0 centre.
+    TInt  iDepth;  // -1 front, 1 rear, 0 neither.
+};
+
+static const SpeakerPlace kPlaces[] =
+{
+    { SND_CHMAP_FL,  -1, -1 },
+    { SND_CHMAP_FR,   1, -1 },
+    { SND_CHMAP_FC,   0, -1 },
+    { SND_CHMAP_FLC, -1, -1 },
+    { SND_CHMAP_FRC,  1, -1 },
+    { SND_CHMAP_FLW, -1, -1 },
+    { SND_CHMAP_FRW,  1, -1 },
+    { SND_CHMAP_FLH, -1, -1 },
+    { SND_CHMAP_FCH,  0, -1 },
+    { SND_CHMAP_FRH,  1, -1 },
+    { SND_CHMAP_SL,  -1,  0 },
+    { SND_CHMAP_SR,   1,  0 },
+    { SND_CHMAP_RL,  -1,  1 },
+    { SND_CHMAP_RR,   1,  1 },
+    { SND_CHMAP_RC,   0,  1 },
+    { SND_CHMAP_RLC, -1,  1 },
+    { SND_CHMAP_RRC,  1,  1 },
+};
+
+// Linear law: the side (or depth) moved away from fades out, the other
+// stays at full gain.
+static TFloat PanGain(TInt aPlace, TFloat aPan)
+{
+    const TFloat gain = 1 + (aPlace * aPan);
+
+    return (gain > 1) ? 1 : ((gain < 0) ? 0 : gain);
+}
+
+AlsaChannelMap::AlsaChannelMap()
+: iDeviceChannels(2)
+, iReported(false)
+{
+    for (TUint i = 0; i < kMaxChannels; i++)
+    {
+        iDevice[i] = kDeviceLayouts[1][i];
+    }
+}
+
+void AlsaChannelMap::Query(snd_pcm_t* aHandle)
+{
+    iMaps.clear();
+
+    snd_pcm_chmap_query_t **maps = snd_pcm_query_chmaps(aHandle);
+
+    if (maps == nullptr)
+    {
+        return;
+    }
+
+    for (TUint i = 0; maps[i] != nullptr; i++)
+    {
+        const snd_pcm_chmap_t& chmap = maps[i]->map;
+
+        if ((chmap.channels == 0) || (chmap.channels > kMaxChannels))
+        {
+            continue;
+        }
+
+        Map map;
+
+        map.iType     = (TUint)maps[i]->type;
+        map.iChannels = chmap.channels;
+
+        for (TUint c = 0; c < chmap.channels; c++)
+        {
+            map.iPositions[c] = chmap.pos[c] & SND_CHMAP_POSITION_MASK;
+        }
+
+        iMaps.push_back(map);
+    }
+
+    snd_pcm_free_chmaps(maps);
+}
+
+void AlsaChannelMap::Negotiate(snd_pcm_t* aHandle, TUint aStreamChannels,
+                               TUint aDeviceChannels)
+{
+    ASSERT((aStreamChannels >= 1) && (aStreamChannels <= kMaxChannels));
+    ASSERT((aDeviceChannels >= 1) && (aDeviceChannels <= kMaxChannels));
+
+    iDeviceChannels = aDeviceChannels;
+
+    if ((aStreamChannels == aDeviceChannels) &&
+        HasVariableMap(aDeviceChannels))
+    {
+        // snd_pcm_chmap_t ends in a flexible array of positions.
+        unsigned int buffer[1 + kMaxChannels];
+        auto         request = (snd_pcm_chmap_t*)buffer;
+
+        request->channels = aDeviceChannels;
+
+        for (TUint c = 0; c < aDeviceChannels; c++)
+        {
+            request->pos[c] = kStreamLayouts[aStreamChannels - 1][c];
+        }
+
+        auto err = snd_pcm_set_chmap(aHandle, request);
+
+        if (err < 0)
+        {
+            Log::Print("AlsaChannelMap: snd_pcm_set_chmap() error : %s\n",
+                       snd_strerror(err));
+        }
+    }
+
+    iReported = false;
+
+    snd_pcm_chmap_t *current = snd_pcm_get_chmap(aHandle);
+
+    if ((current != nullptr) && (current->channels == aDeviceChannels))
+    {
+        for (TUint c = 0; c < aDeviceChannels; c++)
+        {
+            iDevice[c] = current->pos[c] & SND_CHMAP_POSITION_MASK;
+
+            if (iDevice[c] > SND_CHMAP_NA)
+            {
+                iReported = true;
+            }
+        }
+    }
+
+    free(current);
+
+    // A map of unknown speakers is no map.
+    if (! iReported)
+    {
+        for (TUint c = 0; c < kMaxChannels; c++)
+        {
+            iDevice[c] = kDeviceLayouts[aDeviceChannels - 1][c];
+        }
+    }
+}
+
+void AlsaChannelMap::Matrix(TUint aStreamChannels,
+                            ChannelMatrix& aMatrix) const
+{
+    ASSERT((aStreamChannels >= 1) && (aStreamChannels <= kMaxChannels));
+
+    const TUint* stream = kStreamLayouts[aStreamChannels - 1];
+    TBool        placed = false;
+
+    aMatrix.SetSilent(aStreamChannels, iDeviceChannels);
+
+    for (TUint c = 0; c < aStreamChannels; c++)
+    {
+        const TInt out = Find(stream[c]);
+
+        if (out >= 0)
+        {
+            aMatrix.SetGain((TUint)out, c, 1);
+            placed = true;
+            continue;
+        }
+
+        for (auto& fold : kFolds)
+        {
+            if (fold.iFrom != stream[c])
+            {
+                continue;
+            }
+
+            const TInt first  = Find(fold.iTo[0]);
+            const TInt second = (fold.iTo[1] == SND_CHMAP_UNKNOWN) ?
+                                first : Find(fold.iTo[1]);
+
+            if ((first < 0) || (second < 0))
+            {
+                continue;
+            }
+
+            aMatrix.SetGain((TUint)first, c, fold.iGain);
+            aMatrix.SetGain((TUint)second, c, fold.iGain);
+            placed = true;
+            break;
+        }
+    }
+
+    // Nothing in common, e.g. a device of numbered channels. Play the
+    // stream channel for channel.
+    if (! placed)
+    {
+        aMatrix.SetSilent(aStreamChannels, iDeviceChannels);
+
+        for (TUint c = 0; (c < aStreamChannels) && (c < iDeviceChannels); c++)
+        {
+            aMatrix.SetGain(c, c, 1);
+        }
+    }
+
+    aMatrix.Normalise();
+}
+
+void AlsaChannelMap::Gains(TFloat aVolume, TFloat aBalance, TFloat aFade,
+                           TFloat* aGains) const
+{
+    for (TUint c = 0; c < iDeviceChannels; c++)
+    {
+        aGains[c] = aVolume;
+
+        for (auto& place : kPlaces)
+        {
+            if (place.iPosition == iDevice[c])
+            {
+                aGains[c] *= PanGain(place.iSide, aBalance) *
+                             PanGain(place.iDepth, aFade);
+                break;
+            }
+        }
+    }
+}
+
+TUint AlsaChannelMap::Channels() const
+{
+    return iDeviceChannels;
+}
+
+void AlsaChannelMap::AppendLayout(Bwx& aBuf) const
+{
+    for (TUint c = 0; c < iDeviceChannels; c++)
+    {
+        const TChar* name =
+            snd_pcm_chmap_name((enum snd_pcm_chmap_position)iDevice[c]);
+
+        aBuf.AppendPrintf("%s%s", (c == 0) ? "" : " ",
+                          (name != nullptr) ? name : "?");
+    }
+
+    if (! iReported)
+    {
+        aBuf.Append(" (assumed)");
+    }
+}
+
+void AlsaChannelMap::Write(IWriter& aWriter) const
+{
+    if (iMaps.empty())
+    {
+        aWriter.Write(Brn("Channel maps: none reported\n"));
+        return;
+    }
+
+    aWriter.Write(Brn("Channel maps:\n"));
+
+    for (auto& map : iMaps)
+    {
+        Bws<128> line;
+
+        line.AppendPrintf("  %-6s",
+            snd_pcm_chmap_type_name((enum snd_pcm_chmap_type)map.iType));
+
+        for (TUint c = 0; c < map.iChannels; c++)
+        {
+            const TChar* name = snd_pcm_chmap_name(
+                (enum snd_pcm_chmap_position)map.iPositions[c]);
+
+            line.AppendPrintf(" %s", (name != nullptr) ? name : "?");
+        }
+
+        line.Append("\n");
+        aWriter.Write(line);
+    }
+}
+
+TBool AlsaChannelMap::HasVariableMap(TUint aChannels) const
+{
+    for (auto& map : iMaps)
+    {
+        if ((map.iChannels == aChannels) &&
+            ((map.iType == SND_CHMAP_TYPE_VAR) ||
+             (map.iType == SND_CHMAP_TYPE_PAIRED)))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+TInt AlsaChannelMap::Find(TUint aPosition) const
+{
+    for (TUint c = 0; c < iDeviceChannels; c++)
+    {
+        if (iDevice[c] == aPosition)
+        {
+            return (TInt)c;
+        }
+    }
+
+    return -1;
+}
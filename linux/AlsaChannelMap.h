@@ -0,0 +1,73 @@
+#pragma once
+
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Types.h>
+
+#include <alsa/asoundlib.h>
+
+#include <vector>
+
+#include "SampleConvert.h"
+
+// Channel layouts for the ALSA driver.
+//
+// Pipeline streams carry no channel mask, so a stream's layout follows
+// from its channel count, in the order FLAC and WAVE files use. A device's
+// layout is the channel map ALSA reports for it, or ALSA's usual order for
+// devices that report none.
+//
+// Devices with a variable channel map are asked to take the stream's
+// layout. Otherwise the stream is rearranged into the device's layout:
+// channels are moved to the matching speakers, speakers the stream lacks
+// are left silent and channels the device lacks are folded into the
+// nearest speakers it has.
+
+namespace OpenHome {
+namespace Media {
+
+class AlsaChannelMap
+{
+public:
+    static const TUint kMaxChannels = ChannelMatrix::kMaxChannels;
+public:
+    AlsaChannelMap();
+
+    // Read the channel maps an open PCM offers.
+    void Query(snd_pcm_t* aHandle);
+    // With the PCM configured for aDeviceChannels, offer the device the
+    // layout of a stream of aStreamChannels, then read back the layout in
+    // use.
+    void Negotiate(snd_pcm_t* aHandle, TUint aStreamChannels,
+                   TUint aDeviceChannels);
+    // The matrix taking a stream of aStreamChannels to the negotiated
+    // layout.
+    void Matrix(TUint aStreamChannels, ChannelMatrix& aMatrix) const;
+    // The gain for each speaker of the negotiated layout, for digital
+    // volume. Every speaker takes aVolume. aBalance (-1 left only, 1 right
+    // only) scales speakers on either side and aFade (-1 front only, 1 rear
+    // only) those at the front or rear.
+    void Gains(TFloat aVolume, TFloat aBalance, TFloat aFade,
+               TFloat* aGains) const;
+    TUint Channels() const;  // Of the negotiated layout.
+    // Name the speakers of the negotiated layout, in order.
+    void AppendLayout(Bwx& aBuf) const;
+    void Write(IWriter& aWriter) const;
+private:
+    struct Map
+    {
+        TUint iType;  // snd_pcm_chmap_type
+        TUint iChannels;
+        TUint iPositions[kMaxChannels];
+    };
+private:
+    TBool HasVariableMap(TUint aChannels) const;
+    TInt  Find(TUint aPosition) const;
+private:
+    std::vector<Map> iMaps;
+    TUint            iDevice[kMaxChannels];  // Negotiated positions.
+    TUint            iDeviceChannels;
+    TBool            iReported;  // iDevice came from the device.
+};
+
+} // namespace Media
+} // namespace OpenHome
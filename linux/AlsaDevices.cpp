@@ -0,0 +1,162 @@
+#include <OpenHome/Private/Printer.h>
+
+#include <alsa/asoundlib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AlsaDevices.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+void OpenHome::Media::AlsaListDevices(std::vector<AlsaDeviceHint>& aDevices)
+{
+    void **hints;
+
+    aDevices.clear();
+
+    auto err = snd_device_name_hint(-1, "pcm", &hints);
+    if (err < 0)
+    {
+        Log::Print("AlsaListDevices: snd_device_name_hint() error : %s\n",
+                   snd_strerror(err));
+        return;
+    }
+
+    for (void **hint = hints; *hint != nullptr; hint++)
+    {
+        char *name = snd_device_name_get_hint(*hint, "NAME");
+        char *desc = snd_device_name_get_hint(*hint, "DESC");
+        char *ioid = snd_device_name_get_hint(*hint, "IOID");
+
+        // No IOID means the device does both playback and capture.
+        if ((name != nullptr) && (strcmp(name, "null") != 0) &&
+            ((ioid == nullptr) || (strcmp(ioid, "Output") == 0)))
+        {
+            AlsaDeviceHint device;
+
+            device.iName = name;
+
+            if (desc != nullptr)
+            {
+                device.iDescription = desc;
+            }
+
+            aDevices.push_back(device);
+        }
+
+        free(name);
+        free(desc);
+        free(ioid);
+    }
+
+    snd_device_name_free_hint(hints);
+}
+
+// Split "plugin:CARD=x,DEV=y" or "plugin:x,y" into its card and device
+// arguments. Either may be left empty.
+static void ParseDevice(const std::string& aDevice, std::string& aCard,
+                        std::string& aDev)
+{
+    aCard.clear();
+    aDev.clear();
+
+    const auto colon = aDevice.find(':');
+
+    if (colon == std::string::npos)
+    {
+        return;
+    }
+
+    TUint  positional = 0;
+    size_t start      = colon + 1;
+
+    while (start < aDevice.size())
+    {
+        size_t end = aDevice.find(',', start);
+
+        if (end == std::string::npos)
+        {
+            end = aDevice.size();
+        }
+
+        const std::string arg = aDevice.substr(start, end - start);
+
+        if (arg.compare(0, 5, "CARD=") == 0)
+        {
+            aCard = arg.substr(5);
+        }
+        else if (arg.compare(0, 4, "DEV=") == 0)
+        {
+            aDev = arg.substr(4);
+        }
+        else if (arg.find('=') == std::string::npos)
+        {
+            if (positional == 0)
+            {
+                aCard = arg;
+            }
+            else if (positional == 1)
+            {
+                aDev = arg;
+            }
+
+            positional++;
+        }
+
+        start = end + 1;
+    }
+}
+
+std::string OpenHome::Media::AlsaDirectDevice(const std::string& aDevice)
+{
+    if ((aDevice.compare(0, 3, "hw:") == 0) ||
+        (aDevice.compare(0, 7, "plughw:") == 0))
+    {
+        return aDevice;
+    }
+
+    if (aDevice.empty() || (aDevice == "default"))
+    {
+        return "hw:0";
+    }
+
+    if (aDevice.find(':') == std::string::npos)
+    {
+        return "hw:" + aDevice;
+    }
+
+    std::string card;
+    std::string dev;
+
+    ParseDevice(aDevice, card, dev);
+
+    if (card.empty())
+    {
+        return "hw:0";
+    }
+
+    std::string direct = "hw:CARD=" + card;
+
+    if (! dev.empty())
+    {
+        direct += ",DEV=" + dev;
+    }
+
+    return direct;
+}
+
+std::string OpenHome::Media::AlsaMixerCard(const std::string& aDevice)
+{
+    std::string card;
+    std::string dev;
+
+    ParseDevice(aDevice, card, dev);
+
+    if (card.empty())
+    {
+        return "default";
+    }
+
+    return "hw:" + card;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <OpenHome/Types.h>
+
+#include <string>
+#include <vector>
+
+// ALSA device names.
+//
+// Playback devices are enumerated from the name hints ALSA provides, the
+// same list 'aplay -L' prints. Names are kept as ALSA gives them, e.g.
+// "hw:CARD=sndrpihifiberry,DEV=0", so they can be passed straight back to
+// snd_pcm_open().
+
+namespace OpenHome {
+namespace Media {
+
+struct AlsaDeviceHint
+{
+    std::string iName;
+    std::string iDescription;  // May span several lines.
+};
+
+// Playback capable PCMs, in the order ALSA lists them.
+void AlsaListDevices(std::vector<AlsaDeviceHint>& aDevices);
+
+// The hardware device behind aDevice, for direct output. "hw:" and
+// "plughw:" names are returned unchanged, "default" maps to the first
+// card and any other plugin's card and device arguments are kept, e.g.
+// "front:CARD=Audio,DEV=0" becomes "hw:CARD=Audio,DEV=0". A bare name is
+// taken to be a card.
+std::string AlsaDirectDevice(const std::string& aDevice);
+
+// The mixer belonging to aDevice: "hw:<card>" if the name identifies a
+// card, otherwise "default".
+std::string AlsaMixerCard(const std::string& aDevice);
+
+} // namespace Media
+} // namespace OpenHome
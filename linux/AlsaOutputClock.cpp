@@ -0,0 +1,119 @@
+#include <time.h>
+
+#include "AlsaOutputClock.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+static const TUint64 kNsPerSecond = 1000000000;
+
+AlsaOutputClock::AlsaOutputClock()
+    : iSequence(0)
+    , iBaseNs(0)
+    , iFrames(0)
+    , iStampNs(0)
+    , iSampleRate(0)
+    , iSegment(0)
+{
+}
+
+void AlsaOutputClock::Played(TUint aSegment, TUint64 aFrames,
+                             TUint64 aStampNs, TUint aSampleRate)
+{
+    if (aSampleRate == 0)
+    {
+        return;
+    }
+
+    Snapshot last;
+
+    Get(last);
+
+    // A new segment starts from where the last one's timeline has reached,
+    // the first from CLOCK_MONOTONIC.
+    TUint64 baseNs = last.iBaseNs;
+
+    if ((last.iSampleRate == 0) || (aSegment != iSegment))
+    {
+        baseNs = TimeAt(last, aStampNs) - FramesNs(aFrames, aSampleRate);
+    }
+
+    iSegment = aSegment;
+
+    const TUint sequence = iSequence.load(std::memory_order_relaxed);
+
+    iSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    iBaseNs.store(baseNs, std::memory_order_relaxed);
+    iFrames.store(aFrames, std::memory_order_relaxed);
+    iStampNs.store(aStampNs, std::memory_order_relaxed);
+    iSampleRate.store(aSampleRate, std::memory_order_relaxed);
+
+    iSequence.store(sequence + 2, std::memory_order_release);
+}
+
+TUint64 AlsaOutputClock::TimeAt(TUint64 aMonotonicNs) const
+{
+    Snapshot snapshot;
+
+    Get(snapshot);
+
+    return TimeAt(snapshot, aMonotonicNs);
+}
+
+TUint64 AlsaOutputClock::MonotonicNs()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((TUint64)now.tv_sec * kNsPerSecond) + now.tv_nsec;
+}
+
+void AlsaOutputClock::Get(Snapshot& aSnapshot) const
+{
+    for (;;)
+    {
+        const TUint before = iSequence.load(std::memory_order_acquire);
+
+        if ((before & 1) != 0)
+        {
+            continue;
+        }
+
+        aSnapshot.iBaseNs     = iBaseNs.load(std::memory_order_relaxed);
+        aSnapshot.iFrames     = iFrames.load(std::memory_order_relaxed);
+        aSnapshot.iStampNs    = iStampNs.load(std::memory_order_relaxed);
+        aSnapshot.iSampleRate = iSampleRate.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (iSequence.load(std::memory_order_relaxed) == before)
+        {
+            return;
+        }
+    }
+}
+
+// Instants before the measurement, as a mapped timestamp may be, are
+// extrapolated backwards.
+TUint64 AlsaOutputClock::TimeAt(const Snapshot& aSnapshot,
+                                TUint64 aMonotonicNs)
+{
+    if (aSnapshot.iSampleRate == 0)
+    {
+        return aMonotonicNs;
+    }
+
+    return aSnapshot.iBaseNs +
+           FramesNs(aSnapshot.iFrames, aSnapshot.iSampleRate) +
+           (aMonotonicNs - aSnapshot.iStampNs);
+}
+
+// Split, so days of frames at any rate don't overflow.
+TUint64 AlsaOutputClock::FramesNs(TUint64 aFrames, TUint aSampleRate)
+{
+    return ((aFrames / aSampleRate) * kNsPerSecond) +
+           (((aFrames % aSampleRate) * kNsPerSecond) / aSampleRate);
+}
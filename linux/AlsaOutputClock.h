@@ -0,0 +1,56 @@
+#pragma once
+
+#include <OpenHome/Types.h>
+
+#include <atomic>
+
+// The DAC's timeline, measured from ALSA hardware timestamps.
+//
+// The driver's audio thread publishes how many frames the device that
+// paces playback has played and the snd_pcm_status timestamp they were
+// measured at. TimeAt() gives the DAC's time at any CLOCK_MONOTONIC instant,
+// in nanoseconds, from the latest measurement. While the DAC runs this
+// advances at its crystal's rate, between measurements and while it is
+// stopped at the nominal rate. Each new PCM configuration continues the
+// timeline where the last left off, so it never steps. Before the first
+// measurement it is CLOCK_MONOTONIC.
+//
+// Measurements are published under a sequence lock, so neither the audio
+// thread nor readers ever block.
+
+namespace OpenHome {
+namespace Media {
+
+class AlsaOutputClock
+{
+public:
+    AlsaOutputClock();
+    // From the audio thread. aFrames counts the frames played since the PCM
+    // was configured, aSegment changes each time it is.
+    void    Played(TUint aSegment, TUint64 aFrames, TUint64 aStampNs,
+                   TUint aSampleRate);
+    TUint64 TimeAt(TUint64 aMonotonicNs) const;
+    static TUint64 MonotonicNs();
+private:
+    struct Snapshot
+    {
+        TUint64 iBaseNs;       // DAC time at the segment's first frame.
+        TUint64 iFrames;
+        TUint64 iStampNs;
+        TUint   iSampleRate;   // 0 before the first measurement.
+    };
+private:
+    void    Get(Snapshot& aSnapshot) const;
+    static TUint64 TimeAt(const Snapshot& aSnapshot, TUint64 aMonotonicNs);
+    static TUint64 FramesNs(TUint64 aFrames, TUint aSampleRate);
+private:
+    std::atomic<TUint>   iSequence;  // Odd while an update is in progress.
+    std::atomic<TUint64> iBaseNs;
+    std::atomic<TUint64> iFrames;
+    std::atomic<TUint64> iStampNs;
+    std::atomic<TUint>   iSampleRate;
+    TUint                iSegment;   // Audio thread only.
+};
+
+} // namespace Media
+} // namespace OpenHome
@@ -0,0 +1,312 @@
+#include <OpenHome/Private/Standard.h>
+
+#include "AlsaTelemetry.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// AlsaHistogram
+
+AlsaHistogram::AlsaHistogram()
+{
+    Reset();
+}
+
+void AlsaHistogram::Add(TUint aValue)
+{
+    TUint bucket = 0;
+
+    if (aValue != 0)
+    {
+        bucket = 32 - __builtin_clz(aValue);
+
+        if (bucket >= kBuckets)
+        {
+            bucket = kBuckets - 1;
+        }
+    }
+
+    iBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    if (aValue > iMax.load(std::memory_order_relaxed))
+    {
+        iMax.store(aValue, std::memory_order_relaxed);
+    }
+}
+
+void AlsaHistogram::Reset()
+{
+    for (TUint i = 0; i < kBuckets; i++)
+    {
+        iBuckets[i].store(0, std::memory_order_relaxed);
+    }
+
+    iMax.store(0, std::memory_order_relaxed);
+}
+
+// Written as "name (unit, max N): <1:a <2:b <4:c ...", skipping empty
+// buckets.
+void AlsaHistogram::Write(IWriter& aWriter, const TChar* aName,
+                          const TChar* aUnit) const
+{
+    Bws<64> entry;
+
+    entry.AppendPrintf("%s (%s, max %u):", aName, aUnit,
+                       iMax.load(std::memory_order_relaxed));
+    aWriter.Write(entry);
+
+    for (TUint i = 0; i < kBuckets; i++)
+    {
+        const TUint count = iBuckets[i].load(std::memory_order_relaxed);
+
+        if (count == 0)
+        {
+            continue;
+        }
+
+        entry.Replace("");
+
+        if (i == kBuckets - 1)
+        {
+            entry.AppendPrintf(" >=%u:%u", 1u << (i - 1), count);
+        }
+        else
+        {
+            entry.AppendPrintf(" <%u:%u", 1u << i, count);
+        }
+
+        aWriter.Write(entry);
+    }
+
+    aWriter.Write(Brn("\n"));
+}
+
+
+// AlsaTelemetry
+
+AlsaTelemetry::AlsaTelemetry()
+{
+    Reset();
+}
+
+void AlsaTelemetry::Xrun()
+{
+    iXruns.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AlsaTelemetry::Recovery(TBool aSucceeded)
+{
+    if (aSucceeded)
+    {
+        iRecoveries.fetch_add(1, std::memory_order_relaxed);
+    }
+    else
+    {
+        iRecoveryFailures.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void AlsaTelemetry::Write(TUint aAvailFrames, TUint aDurationUs,
+                          TUint aFrames)
+{
+    iWrites.fetch_add(1, std::memory_order_relaxed);
+    iFramesWritten.fetch_add(aFrames, std::memory_order_relaxed);
+    iAvail.Add(aAvailFrames);
+    iWriteUs.Add(aDurationUs);
+}
+
+void AlsaTelemetry::FormatChange(TBool aReconfigured)
+{
+    if (aReconfigured)
+    {
+        iFormatChanges.fetch_add(1, std::memory_order_relaxed);
+    }
+    else
+    {
+        iFormatsKept.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void AlsaTelemetry::Drain(TUint aDurationUs)
+{
+    iDrains.fetch_add(1, std::memory_order_relaxed);
+    iDrainMs.fetch_add(aDurationUs / 1000, std::memory_order_relaxed);
+    iDrainUs.Add(aDurationUs);
+}
+
+void AlsaTelemetry::Dropped(TUint aFrames)
+{
+    iDroppedFrames.fetch_add(aFrames, std::memory_order_relaxed);
+}
+
+void AlsaTelemetry::Resampled(TUint aSampleRate, TUint aFrames,
+                              TUint aDurationUs)
+{
+    TUint i = 0;
+
+    // Only the audio thread claims slots, so this can't race with itself.
+    for (; i < kResampleRates - 1; i++)
+    {
+        const TUint rate =
+            iResampleCosts[i].iSampleRate.load(std::memory_order_relaxed);
+
+        if (rate == aSampleRate)
+        {
+            break;
+        }
+
+        if (rate == 0)
+        {
+            iResampleCosts[i].iSampleRate.store(aSampleRate,
+                                                std::memory_order_relaxed);
+            break;
+        }
+    }
+
+    if (i == kResampleRates - 1)
+    {
+        iResampleCosts[i].iSampleRate.store(aSampleRate,
+                                            std::memory_order_relaxed);
+    }
+
+    iResampleCosts[i].iFrames.fetch_add(aFrames, std::memory_order_relaxed);
+    iResampleCosts[i].iUs.fetch_add(aDurationUs, std::memory_order_relaxed);
+}
+
+void AlsaTelemetry::ScheduledStart(TInt aErrorUs)
+{
+    iScheduledStarts.fetch_add(1, std::memory_order_relaxed);
+    iLastStartErrorUs.store(aErrorUs, std::memory_order_relaxed);
+    iStartErrorUs.Add((aErrorUs < 0) ? (TUint)-aErrorUs : (TUint)aErrorUs);
+}
+
+void AlsaTelemetry::Pause(TUint aLatencyUs, TBool aHeld)
+{
+    iPauses.fetch_add(1, std::memory_order_relaxed);
+
+    if (! aHeld)
+    {
+        iPausesDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    iPauseUs.Add(aLatencyUs);
+}
+
+void AlsaTelemetry::Resume(TUint aLatencyUs)
+{
+    iResumes.fetch_add(1, std::memory_order_relaxed);
+    iResumeUs.Add(aLatencyUs);
+}
+
+void AlsaTelemetry::Flush(TBool aFaded, TUint aStaleUs)
+{
+    iFlushes.fetch_add(1, std::memory_order_relaxed);
+
+    if (! aFaded)
+    {
+        iFlushesDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    iFlushUs.Add(aStaleUs);
+}
+
+void AlsaTelemetry::Reset()
+{
+    iXruns.store(0, std::memory_order_relaxed);
+    iRecoveries.store(0, std::memory_order_relaxed);
+    iRecoveryFailures.store(0, std::memory_order_relaxed);
+    iWrites.store(0, std::memory_order_relaxed);
+    iFramesWritten.store(0, std::memory_order_relaxed);
+    iFormatChanges.store(0, std::memory_order_relaxed);
+    iFormatsKept.store(0, std::memory_order_relaxed);
+    iDrains.store(0, std::memory_order_relaxed);
+    iDrainMs.store(0, std::memory_order_relaxed);
+    iDroppedFrames.store(0, std::memory_order_relaxed);
+    iScheduledStarts.store(0, std::memory_order_relaxed);
+    iLastStartErrorUs.store(0, std::memory_order_relaxed);
+    iPauses.store(0, std::memory_order_relaxed);
+    iPausesDropped.store(0, std::memory_order_relaxed);
+    iResumes.store(0, std::memory_order_relaxed);
+    iFlushes.store(0, std::memory_order_relaxed);
+    iFlushesDropped.store(0, std::memory_order_relaxed);
+
+    for (TUint i = 0; i < kResampleRates; i++)
+    {
+        iResampleCosts[i].iSampleRate.store(0, std::memory_order_relaxed);
+        iResampleCosts[i].iFrames.store(0, std::memory_order_relaxed);
+        iResampleCosts[i].iUs.store(0, std::memory_order_relaxed);
+    }
+
+    iAvail.Reset();
+    iWriteUs.Reset();
+    iDrainUs.Reset();
+    iStartErrorUs.Reset();
+    iPauseUs.Reset();
+    iResumeUs.Reset();
+    iFlushUs.Reset();
+}
+
+void AlsaTelemetry::Write(IWriter& aWriter) const
+{
+    Bws<512> line;
+
+    line.AppendPrintf("Xruns: %u, recoveries: %u, failed recoveries: %u\n",
+                      iXruns.load(std::memory_order_relaxed),
+                      iRecoveries.load(std::memory_order_relaxed),
+                      iRecoveryFailures.load(std::memory_order_relaxed));
+    line.AppendPrintf("Writes: %u, frames written: %u, dropped: %u\n",
+                      iWrites.load(std::memory_order_relaxed),
+                      iFramesWritten.load(std::memory_order_relaxed),
+                      iDroppedFrames.load(std::memory_order_relaxed));
+    line.AppendPrintf("Format changes: %u, kept: %u\n",
+                      iFormatChanges.load(std::memory_order_relaxed),
+                      iFormatsKept.load(std::memory_order_relaxed));
+    line.AppendPrintf("Drains: %u, total %ums\n",
+                      iDrains.load(std::memory_order_relaxed),
+                      iDrainMs.load(std::memory_order_relaxed));
+    line.AppendPrintf("Scheduled starts: %u, last %+dus from the time "
+                      "requested\n",
+                      iScheduledStarts.load(std::memory_order_relaxed),
+                      iLastStartErrorUs.load(std::memory_order_relaxed));
+    line.AppendPrintf("Pauses: %u (%u dropped the queue), resumes: %u\n",
+                      iPauses.load(std::memory_order_relaxed),
+                      iPausesDropped.load(std::memory_order_relaxed),
+                      iResumes.load(std::memory_order_relaxed));
+    line.AppendPrintf("Flushes: %u (%u dropped without a fade)\n",
+                      iFlushes.load(std::memory_order_relaxed),
+                      iFlushesDropped.load(std::memory_order_relaxed));
+    aWriter.Write(line);
+
+    iAvail.Write(aWriter, "Avail before write", "frames");
+    iWriteUs.Write(aWriter, "Write duration", "us");
+    iDrainUs.Write(aWriter, "Drain duration", "us");
+    iStartErrorUs.Write(aWriter, "Scheduled start error", "us");
+    iPauseUs.Write(aWriter, "Pause to silence", "us");
+    iResumeUs.Write(aWriter, "Resume to sound", "us");
+    iFlushUs.Write(aWriter, "Flush to silence", "us");
+
+    // Cost as a share of one CPU while playing, in tenths of a percent.
+    for (TUint i = 0; i < kResampleRates; i++)
+    {
+        const TUint rate =
+            iResampleCosts[i].iSampleRate.load(std::memory_order_relaxed);
+        const TUint frames =
+            iResampleCosts[i].iFrames.load(std::memory_order_relaxed);
+        const TUint us = iResampleCosts[i].iUs.load(std::memory_order_relaxed);
+
+        if ((rate == 0) || (frames == 0))
+        {
+            continue;
+        }
+
+        const TUint audioMs = (TUint)(((TUint64)frames * 1000) / rate);
+        const TUint permille =
+            (TUint)(((TUint64)us * rate) / ((TUint64)frames * 1000));
+
+        line.Replace("");
+        line.AppendPrintf("Resampling from %u Hz: %ums of audio in %uus, "
+                          "%u.%u%% CPU\n", rate, audioMs, us,
+                          permille / 10, permille % 10);
+        aWriter.Write(line);
+    }
+}
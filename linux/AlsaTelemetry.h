@@ -0,0 +1,99 @@
+#pragma once
+
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Types.h>
+
+#include <atomic>
+
+// Counters and histograms describing the ALSA driver's output.
+//
+// Each value is updated by a single audio thread with relaxed atomics, so
+// recording never takes a lock. Any thread may read or reset them, reads
+// are not a consistent snapshot across values.
+
+namespace OpenHome {
+namespace Media {
+
+// Log2 histogram. Bucket 0 counts zeroes, bucket n counts values in
+// [2^(n-1), 2^n), the last bucket also counts anything larger.
+class AlsaHistogram
+{
+public:
+    static const TUint kBuckets = 20;
+public:
+    AlsaHistogram();
+    void Add(TUint aValue);
+    void Reset();
+    void Write(IWriter& aWriter, const TChar* aName,
+               const TChar* aUnit) const;
+private:
+    std::atomic<TUint> iBuckets[kBuckets];
+    std::atomic<TUint> iMax;
+};
+
+class AlsaTelemetry
+{
+public:
+    AlsaTelemetry();
+
+    void Xrun();
+    void Recovery(TBool aSucceeded);
+    void Write(TUint aAvailFrames, TUint aDurationUs, TUint aFrames);
+    void FormatChange(TBool aReconfigured);
+    void Drain(TUint aDurationUs);
+    void Dropped(TUint aFrames);        // No room for converted audio.
+    // Time spent resampling aFrames frames of audio at aSampleRate.
+    void Resampled(TUint aSampleRate, TUint aFrames, TUint aDurationUs);
+    // A scheduled start, aErrorUs after the time requested.
+    void ScheduledStart(TInt aErrorUs);
+    // Output stopped aLatencyUs after a halt, with its queued audio kept
+    // if aHeld, else dropped.
+    void Pause(TUint aLatencyUs, TBool aHeld);
+    // Output audible again aLatencyUs after audio followed a pause.
+    void Resume(TUint aLatencyUs);
+    // Audio cut short by a seek, skip or stop, faded out over what played
+    // on for aStaleUs, or dropped.
+    void Flush(TBool aFaded, TUint aStaleUs);
+
+    void Reset();
+    void Write(IWriter& aWriter) const;
+private:
+    // Resampling cost per source rate. Slots are claimed in the order rates
+    // are first seen, rates beyond the last slot share it.
+    struct ResampleCost
+    {
+        std::atomic<TUint> iSampleRate;
+        std::atomic<TUint> iFrames;     // Wraps after 2^32 frames.
+        std::atomic<TUint> iUs;         // Wraps after ~71 minutes.
+    };
+    static const TUint kResampleRates = 8;
+private:
+    std::atomic<TUint> iXruns;
+    std::atomic<TUint> iRecoveries;
+    std::atomic<TUint> iRecoveryFailures;
+    std::atomic<TUint> iWrites;
+    std::atomic<TUint> iFramesWritten;  // Wraps after 2^32 frames.
+    std::atomic<TUint> iFormatChanges;  // PCM reconfigured.
+    std::atomic<TUint> iFormatsKept;    // Stream changes without a gap.
+    std::atomic<TUint> iDrains;
+    std::atomic<TUint> iDrainMs;
+    std::atomic<TUint> iDroppedFrames;
+    std::atomic<TUint> iScheduledStarts;
+    std::atomic<TInt>  iLastStartErrorUs;
+    std::atomic<TUint> iPauses;
+    std::atomic<TUint> iPausesDropped;  // The device couldn't pause.
+    std::atomic<TUint> iResumes;
+    std::atomic<TUint> iFlushes;
+    std::atomic<TUint> iFlushesDropped;  // Not faded.
+    AlsaHistogram      iAvail;          // Frames free before each write.
+    AlsaHistogram      iWriteUs;        // Duration of each write call.
+    AlsaHistogram      iDrainUs;
+    AlsaHistogram      iStartErrorUs;   // Magnitude of each start's error.
+    AlsaHistogram      iPauseUs;        // Halt to silence.
+    AlsaHistogram      iResumeUs;       // Audio after a pause to sound.
+    AlsaHistogram      iFlushUs;        // Stale audio played after a flush.
+    ResampleCost       iResampleCosts[kResampleRates];
+};
+
+} // namespace Media
+} // namespace OpenHome
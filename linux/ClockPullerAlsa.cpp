@@ -0,0 +1,241 @@
+#include <OpenHome/Media/Pipeline/Msg.h>
+#include <OpenHome/Private/Printer.h>
+
+#include <math.h>
+
+#include "ClockPullerAlsa.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+static const TUint64 kJiffiesPerMs = Jiffies::kPerSecond / 1000;
+
+ClockPullerAlsa::ClockPullerAlsa()
+    : iActive(false)
+    , iPlayedJiffies(0)
+    , iCorrectionPpb(0)
+    , iDriftPpb(0)
+    , iErrorJiffies(0)
+    , iDacPpb(0)
+    , iDacValid(false)
+    , iDriftValid(false)
+    , iPlaying(false)
+    , iLastPlayed(0)
+    , iError(0)
+    , iAbsorbed(0)
+    , iCorrection(0)
+    , iWindowPlayed(0)
+    , iSamples(0)
+    , iSumP(0)
+    , iSumV(0)
+    , iSumPP(0)
+    , iSumPV(0)
+    , iDrift(0)
+    , iWindows(0)
+    , iLastFrames(0)
+    , iLastRate(0)
+    , iDacFrames(0)
+    , iDacStampNs(0)
+{
+}
+
+TBool ClockPullerAlsa::Active() const
+{
+    return iActive.load();
+}
+
+TInt ClockPullerAlsa::CorrectionPpb() const
+{
+    return iCorrectionPpb.load(std::memory_order_relaxed);
+}
+
+void ClockPullerAlsa::NotifyPlayed(TUint64 aFrames, TUint64 aStampNs,
+                                   TUint aSampleRate)
+{
+    // A new PCM configuration, or a rate change, starts the count again.
+    if ((aSampleRate != iLastRate) || (aFrames < iLastFrames) ||
+        (aStampNs < iDacStampNs))
+    {
+        iLastRate    = aSampleRate;
+        iLastFrames  = aFrames;
+        iDacFrames   = aFrames;
+        iDacStampNs  = aStampNs;
+        return;
+    }
+
+    iPlayedJiffies.fetch_add((aFrames - iLastFrames) *
+                             Jiffies::PerSample(aSampleRate),
+                             std::memory_order_relaxed);
+    iLastFrames = aFrames;
+
+    const TUint64 elapsedNs = aStampNs - iDacStampNs;
+
+    if (elapsedNs < (TUint64)kWindowMs * 1000000)
+    {
+        return;
+    }
+
+    const double expected = ((double)elapsedNs * aSampleRate) / 1e9;
+    const double ppb      = (((aFrames - iDacFrames) / expected) - 1.0) * 1e9;
+
+    // Anything further out spans a stall or dropped audio.
+    if (fabs(ppb) < kMaxDacPpb)
+    {
+        iDacPpb.store((TInt)llround(ppb), std::memory_order_relaxed);
+        iDacValid.store(true);
+    }
+
+    iDacFrames  = aFrames;
+    iDacStampNs = aStampNs;
+}
+
+void ClockPullerAlsa::Write(IWriter& aWriter) const
+{
+    Bws<256> line;
+
+    line.AppendPrintf("Clock puller: %s",
+                      iActive.load() ? "active" : "inactive");
+
+    if (iDriftValid.load())
+    {
+        line.AppendPrintf(", drift %+.2f ppm, correction %+.2f ppm, "
+                          "buffer %+.2f ms",
+                          iDriftPpb.load() / 1000.0,
+                          iCorrectionPpb.load() / 1000.0,
+                          (double)iErrorJiffies.load() / kJiffiesPerMs);
+    }
+
+    if (iDacValid.load())
+    {
+        line.AppendPrintf(", DAC %+.2f ppm against the system clock",
+                          iDacPpb.load() / 1000.0);
+    }
+
+    line.Append("\n");
+    aWriter.Write(line);
+}
+
+void ClockPullerAlsa::Update(TInt aDelta)
+{
+    if (! iActive.load())
+    {
+        return;
+    }
+
+    const TUint64 played = iPlayedJiffies.load(std::memory_order_relaxed);
+
+    // The buffer fills before the DAC starts. Its level once playing is
+    // the one to hold.
+    if (! iPlaying)
+    {
+        if (played == iLastPlayed)
+        {
+            return;
+        }
+
+        iPlaying       = true;
+        iLastPlayed    = played;
+        iWindowPlayed  = played;
+        return;
+    }
+
+    iError      += aDelta;
+    iAbsorbed   += iCorrection * (double)(played - iLastPlayed);
+    iLastPlayed  = played;
+
+    const double p = (double)(played - iWindowPlayed);
+    const double v = (double)iError + iAbsorbed;
+
+    iSamples++;
+    iSumP  += p;
+    iSumV  += v;
+    iSumPP += p * p;
+    iSumPV += p * v;
+
+    if (played - iWindowPlayed >= (TUint64)kWindowMs * kJiffiesPerMs)
+    {
+        CloseWindow(played);
+    }
+}
+
+void ClockPullerAlsa::Start()
+{
+    iPlaying     = false;
+    iLastPlayed  = iPlayedJiffies.load(std::memory_order_relaxed);
+    iError       = 0;
+    iAbsorbed    = 0;
+    iCorrection  = 0;
+    iSamples     = 0;
+    iSumP        = 0;
+    iSumV        = 0;
+    iSumPP       = 0;
+    iSumPV       = 0;
+    iDrift       = 0;
+    iWindows     = 0;
+
+    iCorrectionPpb.store(0);
+    iDriftPpb.store(0);
+    iErrorJiffies.store(0);
+    iDriftValid.store(false);
+    iActive.store(true);
+}
+
+void ClockPullerAlsa::Stop()
+{
+    iActive.store(false);
+    iCorrectionPpb.store(0);
+
+    if (iDriftValid.load())
+    {
+        Report();
+    }
+}
+
+void ClockPullerAlsa::CloseWindow(TUint64 aPlayed)
+{
+    const double n     = iSamples;
+    const double denom = (n * iSumPP) - (iSumP * iSumP);
+
+    if ((iSamples >= 2) && (denom > 0))
+    {
+        const double slope = ((n * iSumPV) - (iSumP * iSumV)) / denom;
+        const double end   = (double)(aPlayed - iWindowPlayed);
+        const double level = (iSumV / n) + (slope * (end - (iSumP / n)));
+        const double error = level - iAbsorbed;
+        const double limit = kMaxCorrectionPpb / 1e9;
+
+        iDrift = iDriftValid.load() ? iDrift + ((slope - iDrift) /
+                                                kAverageWeight)
+                                    : slope;
+
+        iCorrection = iDrift + (error / ((double)kSettleMs * kJiffiesPerMs));
+        iCorrection = (iCorrection > limit) ? limit : iCorrection;
+        iCorrection = (iCorrection < -limit) ? -limit : iCorrection;
+
+        iDriftPpb.store((TInt)llround(iDrift * 1e9));
+        iErrorJiffies.store((TInt)llround(error));
+        iDriftValid.store(true);
+        iCorrectionPpb.store((TInt)llround(iCorrection * 1e9),
+                             std::memory_order_relaxed);
+
+        if ((++iWindows % kLogWindows) == 0)
+        {
+            Report();
+        }
+    }
+
+    iWindowPlayed = aPlayed;
+    iSamples      = 0;
+    iSumP         = 0;
+    iSumV         = 0;
+    iSumPP        = 0;
+    iSumPV        = 0;
+}
+
+void ClockPullerAlsa::Report() const
+{
+    Log::Print("ClockPullerAlsa: drift %+.2f ppm, correction %+.2f ppm, "
+               "buffer %+.2f ms\n", iDriftPpb.load() / 1000.0,
+               iCorrectionPpb.load() / 1000.0,
+               (double)iErrorJiffies.load() / kJiffiesPerMs);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Media/ClockPuller.h>
+#include <OpenHome/Types.h>
+
+#include <atomic>
+
+// Clock puller for the Songcast receiver.
+//
+// The receiver reports each change in its buffer's occupancy through
+// Update(), in jiffies, positive when the buffer grows because the sender's
+// clock runs faster than our DAC. The driver reports the frames the DAC has
+// played, with the ALSA hardware timestamp they were measured at, through
+// NotifyPlayed().
+//
+// Drift is measured against played audio, not system time, so it is the
+// sender's rate relative to the DAC. Each window of kWindowMs of played
+// audio yields the slope of the buffer's occupancy, with the correction
+// already applied added back, and a moving average of those slopes is the
+// drift estimate. The correction is that estimate plus a term that returns
+// the buffer to where it stood when playing began over kSettleMs. The
+// driver's adaptive resampler applies it, consuming input faster when
+// positive. The slope and the buffer's level are least squares fits over
+// the window, as single reports of either are too coarse to act on.
+//
+// Update(), Start() and Stop() come from the receiver's thread.
+//
+// The DAC's own rate against CLOCK_MONOTONIC is estimated from the
+// timestamps alone, for reporting.
+
+namespace OpenHome {
+namespace Media {
+
+class ClockPullerAlsa : public IClockPuller
+{
+public:
+    static const TInt kMaxCorrectionPpb = 500000;
+public:
+    ClockPullerAlsa();
+    // Whether the receiver is between Start() and Stop().
+    TBool Active() const;
+    // Correction for the resampler, in parts per billion.
+    TInt  CorrectionPpb() const;
+    // From the audio thread of the device the receiver's buffer drains
+    // into. aFrames counts every frame played since the PCM was configured
+    // and only grows while the PCM runs at aSampleRate.
+    void  NotifyPlayed(TUint64 aFrames, TUint64 aStampNs, TUint aSampleRate);
+    void  Write(IWriter& aWriter) const;
+public: // from IClockPuller
+    void Update(TInt aDelta) override;
+    void Start() override;
+    void Stop() override;
+private:
+    void CloseWindow(TUint64 aPlayed);
+    void Report() const;
+private:
+    static const TUint kWindowMs       = 10000;
+    static const TUint kSettleMs       = 60000;
+    static const TUint kLogWindows     = 6;    // Windows between reports.
+    static const TUint kAverageWeight  = 4;    // 1/n of each new slope.
+    static const TInt  kMaxDacPpb      = 1000000;
+private:
+    std::atomic<TBool>   iActive;
+    std::atomic<TUint64> iPlayedJiffies;  // Written by the audio thread.
+    std::atomic<TInt>    iCorrectionPpb;
+    std::atomic<TInt>    iDriftPpb;       // Estimate, for reporting.
+    std::atomic<TInt>    iErrorJiffies;   // Fitted buffer growth.
+    std::atomic<TInt>    iDacPpb;         // DAC against CLOCK_MONOTONIC.
+    std::atomic<TBool>   iDacValid;
+    std::atomic<TBool>   iDriftValid;     // A window has closed.
+
+    // Receiver thread only. Windows fit the buffer's growth, with the
+    // correction's drain added back, against played jiffies.
+    TBool   iPlaying;        // The DAC has played since Start().
+    TUint64 iLastPlayed;
+    TInt64  iError;          // Buffer growth since playing started.
+    double  iAbsorbed;       // Jiffies the correction has drained.
+    double  iCorrection;     // As applied, a ratio.
+    TUint64 iWindowPlayed;   // Where the current window started.
+    TUint   iSamples;
+    double  iSumP;           // Played, relative to iWindowPlayed.
+    double  iSumV;
+    double  iSumPP;
+    double  iSumPV;
+    double  iDrift;          // Estimate, a ratio.
+    TUint   iWindows;
+
+    // Audio thread only.
+    TUint64 iLastFrames;
+    TUint   iLastRate;
+    TUint64 iDacFrames;      // Where the DAC window started.
+    TUint64 iDacStampNs;
+};
+
+} // namespace Media
+} // namespace OpenHome
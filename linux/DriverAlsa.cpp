@@ -1,10 +1,23 @@
 #include <OpenHome/Private/Printer.h>
 #include <OpenHome/Net/Private/Globals.h>
 #include <OpenHome/OsWrapper.h>
+#include <OpenHome/Configuration/IStore.h>
 #include <alsa/asoundlib.h>
+#include <atomic>
 #include <memory>
-
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "AlsaCalibration.h"
+#include "AlsaCapabilities.h"
+#include "AlsaChannelMap.h"
+#include "AlsaDevices.h"
+#include "AlsaTelemetry.h"
 #include "DriverAlsa.h"
+#include "SampleConvert.h"
+#include "SampleRing.h"
 
 using namespace OpenHome;
 using namespace OpenHome::Media;
@@ -36,73 +49,199 @@ TUint PriorityArbitratorDriver::HostRange() const
     return 1;
 }
 
-class IDataSink
+static TUint64 MonotonicUs()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((TUint64)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+static TUint64 MonotonicNs()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((TUint64)now.tv_sec * 1000000000) + now.tv_nsec;
+}
+
+// WaitStat
+//
+// Accumulates the time one thread spends blocked. Only the owning thread
+// calls Add(), any thread may read the published totals.
+
+class WaitStat
 {
 public:
-    virtual void Write(const Brx& aData) = 0;
-    virtual     ~IDataSink() {}
+    WaitStat();
+    void Add(TUint64 aUs);
+    void Get(DriverAlsaWaitStats& aStats) const;
+private:
+    TUint64            iTotalUs;  // Owning thread only.
+    std::atomic<TUint> iCount;
+    std::atomic<TUint> iTotalMs;
+    std::atomic<TUint> iMaxUs;
 };
 
-// PcmProcessorBase
+WaitStat::WaitStat()
+: iTotalUs(0)
+, iCount(0)
+, iTotalMs(0)
+, iMaxUs(0)
+{
+}
 
-class PcmProcessorBase : public IPcmProcessor
+void WaitStat::Add(TUint64 aUs)
+{
+    iTotalUs += aUs;
+
+    iCount.fetch_add(1, std::memory_order_relaxed);
+    iTotalMs.store((TUint)(iTotalUs / 1000), std::memory_order_relaxed);
+
+    if (aUs > iMaxUs.load(std::memory_order_relaxed))
+    {
+        iMaxUs.store((TUint)aUs, std::memory_order_relaxed);
+    }
+}
+
+void WaitStat::Get(DriverAlsaWaitStats& aStats) const
+{
+    aStats.iCount   = iCount.load(std::memory_order_relaxed);
+    aStats.iTotalMs = iTotalMs.load(std::memory_order_relaxed);
+    aStats.iMaxUs   = iMaxUs.load(std::memory_order_relaxed);
+}
+
+// DelaySnapshot
+//
+// The most recent delay reported by ALSA and when it was measured. The
+// audio thread publishes it under a sequence lock, so queries from other
+// threads never block it and never see a torn snapshot.
+//
+// Timestamps are the low 32 bits of CLOCK_MONOTONIC in microseconds, which
+// is ample for the intervals they are compared over.
+
+class DelaySnapshot
 {
-protected:
-    PcmProcessorBase(IDataSink& aDataSink, Bwx& aBuffer);
-public: // IPcmProcessor
-    virtual void BeginBlock();
-    virtual void EndBlock();
-    virtual void Flush();
 public:
-    void SetDuplicateChannel(TBool duplicateChannel);
-    void SetBitDepth(TUint bitDepth);
-protected:
-    void Append(const TByte* aData, TUint aBytes);
-protected:
-    IDataSink& iSink;
-    Bwx&       iBuffer;
-    TBool      iDuplicateChannel;
-    TUint      iBitDepth;
+    DelaySnapshot();
+    void  Set(TUint aDelayFrames, TUint aStampUs, TUint aSampleRate,
+              TBool aRunning);
+    void  Clear();
+    // Returns false if there is no snapshot.
+    TBool Get(TUint& aDelayFrames, TUint& aStampUs, TUint& aSampleRate,
+              TBool& aRunning) const;
+private:
+    std::atomic<TUint> iSequence;  // Odd while an update is in progress.
+    std::atomic<TUint> iDelayFrames;
+    std::atomic<TUint> iStampUs;
+    std::atomic<TUint> iSampleRate;
+    std::atomic<TBool> iRunning;
 };
 
-PcmProcessorBase::PcmProcessorBase(IDataSink& aDataSink, Bwx& aBuffer)
-: iSink(aDataSink)
-, iBuffer(aBuffer)
-, iDuplicateChannel(false)
-, iBitDepth(0)
+DelaySnapshot::DelaySnapshot()
+: iSequence(0)
+, iDelayFrames(0)
+, iStampUs(0)
+, iSampleRate(0)
+, iRunning(false)
 {
 }
 
-void PcmProcessorBase::SetDuplicateChannel(TBool duplicateChannel)
+void DelaySnapshot::Set(TUint aDelayFrames, TUint aStampUs,
+                        TUint aSampleRate, TBool aRunning)
 {
-    iDuplicateChannel = duplicateChannel;
+    const TUint sequence = iSequence.load(std::memory_order_relaxed);
+
+    iSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    iDelayFrames.store(aDelayFrames, std::memory_order_relaxed);
+    iStampUs.store(aStampUs, std::memory_order_relaxed);
+    iSampleRate.store(aSampleRate, std::memory_order_relaxed);
+    iRunning.store(aRunning, std::memory_order_relaxed);
+
+    iSequence.store(sequence + 2, std::memory_order_release);
 }
 
-void PcmProcessorBase::SetBitDepth(TUint bitDepth)
+void DelaySnapshot::Clear()
 {
-    iBitDepth = bitDepth;
+    Set(0, 0, 0, false);
 }
 
-void PcmProcessorBase::Append(const TByte* aData, TUint aBytes)
+TBool DelaySnapshot::Get(TUint& aDelayFrames, TUint& aStampUs,
+                         TUint& aSampleRate, TBool& aRunning) const
 {
-    if (iBuffer.BytesRemaining() < aBytes)
-        Flush();
+    for (;;)
+    {
+        const TUint before = iSequence.load(std::memory_order_acquire);
+
+        if ((before & 1) != 0)
+        {
+            continue;
+        }
+
+        aDelayFrames = iDelayFrames.load(std::memory_order_relaxed);
+        aStampUs     = iStampUs.load(std::memory_order_relaxed);
+        aSampleRate  = iSampleRate.load(std::memory_order_relaxed);
+        aRunning     = iRunning.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (iSequence.load(std::memory_order_relaxed) == before)
+        {
+            return aSampleRate != 0;
+        }
+    }
+}
+
+// IPcmOutput
+//
+// Destination for converted audio. Samples are written directly into
+// memory supplied by the output in whole frames of the negotiated format,
+// so no memory is allocated while processing audio.
+
+class IPcmOutput
+{
+public:
+    // Return space for up to aFrames frames. On return aFrames holds the
+    // number of frames that will fit, which is always at least one.
+    virtual TByte* Reserve(TUint& aFrames) = 0;
+    // Queue aFrames frames, written to the space returned by Reserve(),
+    // for playback.
+    virtual void   Commit(TUint aFrames) = 0;
+    // Pass any partially filled buffer to the audio device.
+    virtual void   Flush() = 0;
+    virtual       ~IPcmOutput() {}
+};
+
+// PcmProcessorBase
+
+class PcmProcessorBase : public IPcmProcessor
+{
+protected:
+    PcmProcessorBase(IPcmOutput& aOutput);
+public: // IPcmProcessor
+    virtual void BeginBlock();
+    virtual void EndBlock();
+    virtual void Flush();
+protected:
+    IPcmOutput& iOutput;
+};
 
-    iBuffer.Append(aData, aBytes);
+PcmProcessorBase::PcmProcessorBase(IPcmOutput& aOutput)
+: iOutput(aOutput)
+{
 }
 
 void PcmProcessorBase::Flush()
 {
-    if (iBuffer.Bytes() != 0)
-    {
-        iSink.Write(iBuffer);
-        iBuffer.SetBytes(0);
-    }
+    iOutput.Flush();
 }
 
 void PcmProcessorBase::BeginBlock()
 {
-    ASSERT(iBuffer.Bytes() == 0);
 }
 
 void PcmProcessorBase::EndBlock()
@@ -112,405 +251,317 @@ void PcmProcessorBase::EndBlock()
 
 
 // PcmProcessorLe
+//
+// Converts pipeline audio to the little endian sample layout and channel
+// layout negotiated with ALSA.
+//
+// The conversion kernels are selected once per stream, by SetFormat(),
+// for every input width the stream can deliver. Fragments of a different
+// width to the stream (e.g. 32 bit audio generated by the ramper) are
+// converted to the same output layout. Fragments that already have the
+// device's channel count are played channel for channel.
+//
+// When the device lacks the stream's rate, audio passes through a
+// Resampler first and leaves it as 32 bit samples for the 32 bit kernels.
+//
+// Digital volume is applied by the same kernels, as the gain of the
+// channel matrix's outputs. Audio narrowed to 16 bits is dithered by them
+// too, if enabled.
 
 class PcmProcessorLe : public PcmProcessorBase
 {
 public:
-    PcmProcessorLe(IDataSink& aSink, Bwx& aBuffer);
+    PcmProcessorLe(IPcmOutput& aOutput);
+    void SetFormat(SampleLayout aLayout, const ChannelMatrix& aMatrix);
+    // Gain for each output channel, reached over aRampFrames frames.
+    void SetGain(const TFloat* aGains, TUint aChannels, TUint aRampFrames);
+    void SetDither(DitherMode aMode);
+    DitherMode Dither() const;
+    void SetResampler(Resampler* aResampler);  // nullptr to stop resampling.
+    // Input frames resampled, and the time taken, since the last call.
+    void TakeResampleCost(TUint& aFrames, TUint& aUs);
 public: // IPcmProcessor
-    virtual void ProcessFragment8(const Brx& aData, TUint aNumChannels);
-    virtual void ProcessFragment16(const Brx& aData, TUint aNumChannels);
-    virtual void ProcessFragment24(const Brx& aData, TUint aNumChannels);
-    virtual void ProcessFragment32(const Brx& aData, TUint aNumChannels);
+    void ProcessFragment8(const Brx& aData, TUint aNumChannels) override;
+    void ProcessFragment16(const Brx& aData, TUint aNumChannels) override;
+    void ProcessFragment24(const Brx& aData, TUint aNumChannels) override;
+    void ProcessFragment32(const Brx& aData, TUint aNumChannels) override;
+private:
+    void ProcessFragment(const Brx& aData, TUint aNumChannels, TUint aInBytes);
+    const SampleConverter* Converter(TUint aNumChannels, TUint aInBytes) const;
+    void Resample(const Brx& aData, TUint aNumChannels, TUint aInBytes);
+private:
+    static const TUint kResampleFrames = 256;  // Per conversion.
+private:
+    // Indexed by [input bytes per sample - 1].
+    SampleConverter iConverters[4];   // Stream channels to the device's.
+    SampleConverter iPassthrough[4];  // Device channels as they are.
+    SampleGain      iGain;            // Shared, so ramps span fragments.
+    SampleDither    iDither;
+    TUint           iInChannels;
+    TUint           iOutChannels;
+    Resampler*      iResampler;
+    Bwh             iResampleBuffer;  // Resampler output, big endian.
+    TUint           iResampleFrames;
+    TUint64         iResampleNs;
 };
 
-PcmProcessorLe::PcmProcessorLe(IDataSink& aSink, Bwx& aBuffer)
-: PcmProcessorBase(aSink, aBuffer)
+PcmProcessorLe::PcmProcessorLe(IPcmOutput& aOutput)
+: PcmProcessorBase(aOutput)
+, iInChannels(1)
+, iOutChannels(1)
+, iResampler(nullptr)
+, iResampleBuffer(kResampleFrames * Resampler::kMaxChannels * 4)
+, iResampleFrames(0)
+, iResampleNs(0)
 {
 }
 
-void PcmProcessorLe::ProcessFragment8(const Brx& aData, TUint aNumChannels)
+void PcmProcessorLe::SetFormat(SampleLayout aLayout,
+                               const ChannelMatrix& aMatrix)
 {
-    TByte *nData;
-    TUint  bytes;
+    ChannelMatrix passthrough;
 
-    // The input data is converted from unsigned 8 bit to signed 16 bit.
-    // to removes poor audio quality and glitches when part of a playlist
-    // with tracks of a different bit depth.
-    //
-    // Accordingly the amount of data is doubled.
-    bytes = aData.Bytes() * 2;
+    passthrough.SetIdentity(aMatrix.OutChannels());
 
-    // If we are manually converting mono to stereo the data will double.
-    if (iDuplicateChannel)
+    for (TUint i = 0; i < 4; i++)
     {
-        bytes *= 2;
+        iConverters[i].Set(i + 1, aLayout, aMatrix);
+        iPassthrough[i].Set(i + 1, aLayout, passthrough);
     }
 
-    nData = new TByte[bytes];
-    ASSERT(nData != NULL);
-
-    TByte *ptr  = (TByte *)(aData.Ptr() + 0);
-    TByte *ptr1 = (TByte *)nData;
-    TByte *endp = ptr1 + bytes;
+    iInChannels  = aMatrix.InChannels();
+    iOutChannels = aMatrix.OutChannels();
 
-    while (ptr1 < endp)
-    {
-        // Convert U8 to S16 data in little endian format.
-        *ptr1++ = 0x00;
-        *ptr1++ = *ptr - 0x80;
-
-        if (iDuplicateChannel)
-        {
-            *ptr1++ = 0x00;
-            *ptr1++ = *ptr - 0x80;
-        }
-
-        ptr++;
-    }
+    iDither.Reset();
+}
 
-    Brn fragment(nData, bytes);
-    Flush();
-    iSink.Write(fragment);
-    delete[] nData;
+void PcmProcessorLe::SetGain(const TFloat* aGains, TUint aChannels,
+                             TUint aRampFrames)
+{
+    iGain.Set(aGains, aChannels, aRampFrames);
 }
 
-void PcmProcessorLe::ProcessFragment16(const Brx& aData, TUint aNumChannels)
+void PcmProcessorLe::SetDither(DitherMode aMode)
 {
-    TByte *nData;
-    TUint  bytes;
+    iDither.SetMode(aMode);
+}
 
-    bytes = aData.Bytes();
+DitherMode PcmProcessorLe::Dither() const
+{
+    return iDither.Mode();
+}
 
-    // If we are manually converting mono to stereo the data will double.
-    if (iDuplicateChannel)
+// The converter for a fragment, or nullptr if its channels can't be
+// arranged for the device.
+const SampleConverter* PcmProcessorLe::Converter(TUint aNumChannels,
+                                                 TUint aInBytes) const
+{
+    if (aNumChannels == iInChannels)
     {
-        bytes *= 2;
+        return &iConverters[aInBytes - 1];
     }
 
-    nData = new TByte[bytes];
-    ASSERT(nData != NULL);
+    if (aNumChannels == iOutChannels)
+    {
+        return &iPassthrough[aInBytes - 1];
+    }
 
-    TByte *ptr  = (TByte *)(aData.Ptr() + 0);
-    TByte *ptr1 = (TByte *)nData;
-    TByte *endp = ptr1 + bytes;
+    return nullptr;
+}
 
-    ASSERT(bytes % 2 == 0);
+void PcmProcessorLe::SetResampler(Resampler* aResampler)
+{
+    iResampler = aResampler;
+}
 
-    while (ptr1 < endp)
-    {
-        // Store the S16 data in little endian format.
-        *ptr1++ = *(ptr+1);
-        *ptr1++ = *(ptr);
+void PcmProcessorLe::TakeResampleCost(TUint& aFrames, TUint& aUs)
+{
+    aFrames = iResampleFrames;
+    aUs     = (TUint)(iResampleNs / 1000);
 
-        if (iDuplicateChannel)
-        {
-            *ptr1++ = *(ptr+1);
-            *ptr1++ = *(ptr);
-        }
+    iResampleFrames = 0;
+    iResampleNs    %= 1000;
+}
 
-        ptr +=2;
-    }
+void PcmProcessorLe::ProcessFragment8(const Brx& aData, TUint aNumChannels)
+{
+    // The input data is converted from unsigned 8 bit to signed 16 bit.
+    // to removes poor audio quality and glitches when part of a playlist
+    // with tracks of a different bit depth.
+    ProcessFragment(aData, aNumChannels, 1);
+}
 
-    Brn fragment(nData, bytes);
-    Flush();
-    iSink.Write(fragment);
-    delete[] nData;
+void PcmProcessorLe::ProcessFragment16(const Brx& aData, TUint aNumChannels)
+{
+    ProcessFragment(aData, aNumChannels, 2);
 }
 
 void PcmProcessorLe::ProcessFragment24(const Brx& aData, TUint aNumChannels)
 {
-    TByte *nData;
-    TUint  bytes;
+    ProcessFragment(aData, aNumChannels, 3);
+}
 
-    // 24 bit audio is not supported on the platform so it is converted
-    // to signed 16 bit audio for playback.
+void PcmProcessorLe::ProcessFragment32(const Brx& aData, TUint aNumChannels)
+{
+    // Currently the only 32 bit pcm in the pipeline is auto-generated by
+    // the ramper.
     //
-    // Accordingly one third of the input data is discarded.
-    bytes = (aData.Bytes() * 2) / 3;
+    // This may differ from the stream format so we must do the conversion
+    // here.
+    ProcessFragment(aData, aNumChannels, 4);
+}
 
-    // If we are manually converting mono to stereo the data will double.
-    if (iDuplicateChannel)
+void PcmProcessorLe::ProcessFragment(const Brx& aData, TUint aNumChannels,
+                                     TUint aInBytes)
+{
+    if (iResampler != nullptr)
     {
-        bytes *= 2;
+        Resample(aData, aNumChannels, aInBytes);
+        return;
     }
 
-    nData = new TByte[bytes];
-    ASSERT(nData != NULL);
+    // aNumChannels must be checked as the ramper can inject 32 bit
+    // stereo into the pipeline.
+    const SampleConverter *converter = Converter(aNumChannels, aInBytes);
 
-    TByte *ptr  = (TByte *)(aData.Ptr() + 0);
-    TByte *ptr1 = (TByte *)nData;
-    TByte *endp = ptr1 + bytes;
+    if (converter == nullptr)
+    {
+        return;
+    }
 
-    ASSERT(bytes % 2 == 0);
+    const TUint  inFrameBytes = aNumChannels * aInBytes;
+    const TByte *src          = aData.Ptr();
+    TUint        frames       = aData.Bytes() / inFrameBytes;
 
-    while (ptr1 < endp)
+    while (frames > 0)
     {
-        // Store the data in little endian format.
-        *ptr1++ = *(ptr+1);
-        *ptr1++ = *(ptr+0);
+        TUint  count = frames;
+        TByte *dst   = iOutput.Reserve(count);
 
-        if (iDuplicateChannel)
-        {
-            *ptr1++ = *(ptr+1);
-            *ptr1++ = *(ptr+0);
-        }
+        converter->Convert(src, dst, count, iGain, iDither);
+        iOutput.Commit(count);
 
-        ptr += 3;
+        src    += count * inFrameBytes;
+        frames -= count;
     }
-
-    Brn fragment(nData, bytes);
-    Flush();
-    iSink.Write(fragment);
-    delete[] nData;
 }
 
-void PcmProcessorLe::ProcessFragment32(const Brx& aData, TUint aNumChannels)
+void PcmProcessorLe::Resample(const Brx& aData, TUint aNumChannels,
+                              TUint aInBytes)
 {
-    TByte *nData;
-    TUint  bytes;
-
-    // Currently the only 32 bit pcm in the pipeline is auto-generated by
-    // the ramper.
-    //
-    // This may differ from the stream format so we must do the conversion
-    // here.
-    bytes = aData.Bytes();
-
-    // If we are manually converting mono to stereo the data will double.
-    //
-    // aNumChannels must be checked as the ramper can inject 32 bit
-    // stereo into the pipeline.
-    if (iDuplicateChannel && (aNumChannels != 2))
+    // The filter history is per channel, so only audio with the stream's
+    // channel count can pass through it.
+    if (aNumChannels != iResampler->Channels())
     {
-        bytes *= 2;
+        return;
     }
 
-    nData = new TByte[bytes];
-    ASSERT(nData != NULL);
+    const SampleConverter& converter = iConverters[3];
 
-    TByte *ptr  = (TByte *)(aData.Ptr() + 0);
-    TByte *endp = ptr + aData.Bytes();
-    TByte *ptr1 = (TByte *)nData;
+    const TUint  inFrameBytes = aNumChannels * aInBytes;
+    const TByte *src          = aData.Ptr();
+    TUint        frames       = aData.Bytes() / inFrameBytes;
+    TByte       *buffer       = const_cast<TByte*>(iResampleBuffer.Ptr());
 
-    TUint outBytes = 0;
-
-    while (ptr < endp)
+    while (frames > 0)
     {
-        switch (iBitDepth)
-        {
-            // The system only supports upto 16 bit.
-            //
-            // Convert everything above that to 16 bit.
-            case 32:
-            // Fallthrough
-            case 24:
-            // Fallthrough
-            case 16:
-            {
-                // Store the data in little endian format.
-                *ptr1++ = *(ptr+1);
-                *ptr1++ = *(ptr+0);
-                outBytes += 2;
+        TUint64     start = MonotonicNs();
+        const TUint taken = iResampler->Write(src, frames, aInBytes);
 
-                if (iDuplicateChannel && (aNumChannels != 2))
-                {
-                    *ptr1++ = *(ptr+1);
-                    *ptr1++ = *(ptr+0);
-                    outBytes += 2;
-                }
+        iResampleNs     += MonotonicNs() - start;
+        iResampleFrames += taken;
 
-                break;
-            }
-            // The platform is configured for 8 bit. Convert.
-            case 8:
-            {
-                *ptr1++ = *(ptr+0);
-                outBytes += 1;
+        src    += taken * inFrameBytes;
+        frames -= taken;
 
-                if (iDuplicateChannel && (aNumChannels != 2))
-                {
-                    *ptr1++ = *(ptr+0);
-                    outBytes += 1;
-                }
+        // Only reserve output once there is audio to fill it.
+        TUint available;
 
-                break;
-            }
-        }
+        while ((available = iResampler->Available()) > 0)
+        {
+            TUint count = (available < kResampleFrames) ? available
+                                                        : kResampleFrames;
+            TByte *dst  = iOutput.Reserve(count);
 
-        ptr += 4;
-    }
+            // Time the filter alone, not waits for the device.
+            start        = MonotonicNs();
+            count        = iResampler->Read(buffer, count);
+            iResampleNs += MonotonicNs() - start;
 
-    Brn fragment(nData, outBytes);
-    Flush();
-    iSink.Write(fragment);
-    delete[] nData;
+            converter.Convert(buffer, dst, count, iGain, iDither);
+            iOutput.Commit(count);
+        }
+    }
 }
 
-// PcmProcessorLe32
 
-class PcmProcessorLe32 : public PcmProcessorLe
+
+// DsdProcessorLe
+//
+// Packs pipeline DSD into the DoP or native DSD frames negotiated with
+// ALSA.
+
+class DsdProcessorLe : public IDsdProcessor
 {
 public:
-    PcmProcessorLe32(IDataSink& aSink, Bwx& aBuffer);
-public: // IPcmProcessor
-    void ProcessFragment24(const Brx& aData, TUint aNumChannels);
-    void ProcessFragment32(const Brx& aData, TUint aNumChannels);
+    DsdProcessorLe(IPcmOutput& aOutput);
+    void SetLayout(DsdLayout aLayout);
+public: // IDsdProcessor
+    void BeginBlock() override;
+    void ProcessFragment(const Brx& aData, TUint aNumChannels,
+                         TUint aSampleBlockWords) override;
+    void EndBlock() override;
+    void Flush() override;
+private:
+    IPcmOutput& iOutput;
+    DsdPacker   iPacker;
 };
 
-PcmProcessorLe32::PcmProcessorLe32(IDataSink& aSink, Bwx& aBuffer)
-: PcmProcessorLe(aSink, aBuffer)
+DsdProcessorLe::DsdProcessorLe(IPcmOutput& aOutput)
+: iOutput(aOutput)
 {
 }
 
-void PcmProcessorLe32::ProcessFragment24(const Brx& aData, TUint aNumChannels)
+void DsdProcessorLe::SetLayout(DsdLayout aLayout)
 {
-    TByte *nData;
-    TUint  bytes;
-
-    // 24 bit audio is not supported on the platform so it is converted
-    // to signed 32 bit audio for playback.
-    //
-    // Accordingly we allocate room for 4 byte samples.
-    bytes = (aData.Bytes() * 4) / 3;
-
-    // If we are manually converting mono to stereo the data will double.
-    if (iDuplicateChannel)
-    {
-        bytes *= 2;
-    }
+    iPacker.Set(aLayout);
+}
 
-    nData = new TByte[bytes];
-    ASSERT(nData != NULL);
+void DsdProcessorLe::BeginBlock()
+{
+}
 
-    TByte *ptr  = (TByte *)(aData.Ptr() + 0);
-    TByte *ptr1 = (TByte *)nData;
-    TByte *endp = ptr1 + bytes;
+void DsdProcessorLe::ProcessFragment(const Brx& aData,
+                                     TUint /*aNumChannels*/,
+                                     TUint aSampleBlockWords)
+{
+    // Only stereo streams are accepted, in the block size we asked for.
+    ASSERT(aSampleBlockWords == DsdPacker::kBlockWords);
 
-    ASSERT(bytes % 4 == 0);
+    const TByte *src    = aData.Ptr();
+    TUint        frames = aData.Bytes() / iPacker.InBytes();
 
-    while (ptr1 < endp)
+    while (frames > 0)
     {
-        // Store the data in little endian format.
-        *ptr1++ = 0;
-        *ptr1++ = *(ptr+2);
-        *ptr1++ = *(ptr+1);
-        *ptr1++ = *(ptr+0);
+        TUint  count = frames;
+        TByte *dst   = iOutput.Reserve(count);
 
-        if (iDuplicateChannel)
-        {
-            *ptr1++ = 0;
-            *ptr1++ = *(ptr+2);
-            *ptr1++ = *(ptr+1);
-            *ptr1++ = *(ptr+0);
-        }
+        iPacker.Pack(src, dst, count);
+        iOutput.Commit(count);
 
-        ptr += 3;
+        src    += count * iPacker.InBytes();
+        frames -= count;
     }
+}
 
-    Brn fragment(nData, bytes);
+void DsdProcessorLe::EndBlock()
+{
     Flush();
-    iSink.Write(fragment);
-    delete[] nData;
 }
 
-void PcmProcessorLe32::ProcessFragment32(const Brx& aData, TUint aNumChannels)
+void DsdProcessorLe::Flush()
 {
-    TByte *nData;
-    TUint  bytes;
-
-    // Currently the only 32 bit pcm in the pipeline is auto-generated by
-    // the ramper.
-    //
-    // This may differ from the stream format so we must do the conversion
-    // here.
-    bytes = aData.Bytes();
-
-    // If we are manually converting mono to stereo the data will double.
-    //
-    // aNumChannels must be checked as the ramper can inject 32 bit
-    // stereo into the pipeline.
-    if (iDuplicateChannel && (aNumChannels != 2))
-    {
-        bytes *= 2;
-    }
-
-    nData = new TByte[bytes];
-    ASSERT(nData != NULL);
-
-    TByte *ptr  = (TByte *)(aData.Ptr() + 0);
-    TByte *endp = ptr + aData.Bytes();
-    TByte *ptr1 = (TByte *)nData;
-
-    TUint outBytes = 0;
-
-    while (ptr < endp)
-    {
-        switch (iBitDepth)
-        {
-            // The platform supports and is configured for 32 bit audio.
-            case 32:
-            // Fallthrough
-            case 24:
-            {
-                *ptr1++ = *(ptr+3);
-                *ptr1++ = *(ptr+2);
-                *ptr1++ = *(ptr+1);
-                *ptr1++ = *(ptr+0);
-                outBytes += 4;
-
-                if (iDuplicateChannel && (aNumChannels != 2))
-                {
-                    *ptr1++ = *(ptr+3);
-                    *ptr1++ = *(ptr+2);
-                    *ptr1++ = *(ptr+1);
-                    *ptr1++ = *(ptr+0);
-                    outBytes += 4;
-                }
-
-                break;
-            }
-            // The platform is configured for 16 bit. Convert.
-            case 16:
-            {
-                *ptr1++ = *(ptr+1);
-                *ptr1++ = *(ptr+0);
-                outBytes += 2;
-
-                if (iDuplicateChannel && (aNumChannels != 2))
-                {
-                    *ptr1++ = *(ptr+1);
-                    *ptr1++ = *(ptr+0);
-                    outBytes += 2;
-                }
-
-                break;
-            }
-            // The platform is configured for 8 bit. Convert.
-            case 8:
-            {
-                *ptr1++ = *(ptr+1);
-                *ptr1++ = *(ptr+0);
-                outBytes += 2;
-
-                if (iDuplicateChannel && (aNumChannels != 2))
-                {
-                    *ptr1++ = *(ptr+1);
-                    *ptr1++ = *(ptr+0);
-                    outBytes += 2;
-                }
-
-                break;
-            }
-        }
-
-        ptr += 4;
-    }
-
-    Brn fragment(nData, outBytes);
-    Flush();
-    iSink.Write(fragment);
-    delete[] nData;
+    iOutput.Flush();
 }
 
 typedef std::pair<snd_pcm_format_t, TUint> OutputFormat;
@@ -518,23 +569,20 @@ typedef std::pair<snd_pcm_format_t, TUint> OutputFormat;
 class Profile
 {
 public:
-    Profile(IPcmProcessor* aPcmProcessor, OutputFormat aFormat32,
-                                          OutputFormat aFormat24,
-                                          OutputFormat aFormat16,
-                                          OutputFormat aFormat8);
+    Profile(OutputFormat aFormat32,
+            OutputFormat aFormat24,
+            OutputFormat aFormat16,
+            OutputFormat aFormat8);
 public:
-    OutputFormat   GetFormat(TUint aBitDepth) const;
-    IPcmProcessor& GetPcmProcessor() const;
+    OutputFormat GetFormat(TUint aBitDepth) const;
 private:
-    std::unique_ptr<IPcmProcessor> iPcmProcessor;
-    OutputFormat                   iOutputDesc[4];
+    OutputFormat iOutputDesc[4];
 };
 
-Profile::Profile(IPcmProcessor* aPcmProcessor, OutputFormat aFormat32,
-                                               OutputFormat aFormat24,
-                                               OutputFormat aFormat16,
-                                               OutputFormat aFormat8)
-: iPcmProcessor(aPcmProcessor)
+Profile::Profile(OutputFormat aFormat32,
+                 OutputFormat aFormat24,
+                 OutputFormat aFormat16,
+                 OutputFormat aFormat8)
 {
     iOutputDesc[0] = aFormat32;
     iOutputDesc[1] = aFormat24;
@@ -560,9 +608,44 @@ OutputFormat Profile::GetFormat(TUint aBitDepth) const
     }
 }
 
-IPcmProcessor& Profile::GetPcmProcessor() const
+// Ways of playing DSD, in order of preference. Native DSD needs no
+// markers, DoP works with any DAC that detects it in 24 bit PCM.
+struct DsdMode
+{
+    snd_pcm_format_t iFormat;
+    DsdLayout        iLayout;
+    TUint            iRateDivisor;  // DSD rate / PCM rate.
+};
+
+static const DsdMode kDsdModes[] =
 {
-    return *iPcmProcessor;
+    { SND_PCM_FORMAT_DSD_U32_BE, DsdLayout::U32Be,      32 },
+    { SND_PCM_FORMAT_DSD_U32_LE, DsdLayout::U32Le,      32 },
+    { SND_PCM_FORMAT_S32_LE,     DsdLayout::DopS32Le,   16 },
+    { SND_PCM_FORMAT_S24_3LE,    DsdLayout::DopS24_3Le, 16 },
+    { SND_PCM_FORMAT_S24_LE,     DsdLayout::DopS24Le,   16 },
+};
+
+static const TUint kDsd64Rate = 2822400;
+
+// Map an ALSA output format onto the layout produced by the conversion
+// kernels.
+static SampleLayout LayoutOf(snd_pcm_format_t aFormat)
+{
+    switch (aFormat)
+    {
+        case SND_PCM_FORMAT_S16_LE:
+            return SampleLayout::S16Le;
+        case SND_PCM_FORMAT_S32_LE:
+            return SampleLayout::S32Le;
+        case SND_PCM_FORMAT_S24_3LE:
+            return SampleLayout::S24_3Le;
+        case SND_PCM_FORMAT_S24_LE:
+            return SampleLayout::S24Le;
+        default:
+            ASSERTS();
+            return SampleLayout::S16Le;
+    }
 }
 
 /*  Pimpl
@@ -571,333 +654,2818 @@ IPcmProcessor& Profile::GetPcmProcessor() const
     and plays it.
 */
 
-class DriverAlsa::Pimpl : public IDataSink
+class DriverAlsa::Pimpl : public IPcmOutput
 {
 public:
-    Pimpl(const TChar* aAlsaDevice, TUint aBufferUs);
+    Pimpl(const TChar* aAlsaDevice, TUint aIndex,
+          const DriverAlsaInitParams& aInitParams);
     virtual ~Pimpl();
-    void ProcessDecodedStream(MsgDecodedStream* aMsg);
+    // aFlush cuts short the audio queued before the message.
+    void ProcessDecodedStream(MsgDecodedStream* aMsg, TBool aFlush);
     void ProcessPlayable(MsgPlayable* aMsg);
-    void ProcessDrain();
+    void ProcessDrain(TBool aFlush);
+    TBool EndsQuiet();
+    void Pause(TUint64 aHaltUs);
+    void Resume(TBool aPlaying);
     void LogPCMState();
-    TUint DriverDelayJiffies(TUint aSampleRate);
-public:
-    virtual void Write(const Brx& aData);
+    TUint DriverDelayJiffies(AudioFormat aFormat, TUint aSampleRate,
+                             TUint aNumChannels);
+    TUint BufferJiffies() const;
+    void GetRingStats(DriverAlsaRingStats& aStats) const;
+    void Interrupt();
+    TUint MaxBitDepth() const;
+    TBool DsdSupported(TUint aSampleRate, TUint aNumChannels) const;
+    void WriteCapabilities(IWriter& aWriter);
+    void RequestCalibration();
+    void StartAt(TUint64 aMonotonicNs);
+    void WriteStats(IWriter& aWriter) const;
+    void ResetStats();
+    // Mirroring. A device that negotiated the same output format as one
+    // before it takes a copy of that device's converted audio instead of
+    // converting the stream itself.
+    TBool SameOutput(const Pimpl& aOther) const;
+    void  ClearMirrors();
+    void  AddMirror(Pimpl& aMirror);
+    TBool Mirrored() const;
+public: // from IPcmOutput
+    TByte* Reserve(TUint& aFrames) override;
+    void   Commit(TUint aFrames) override;
+    void   Flush() override;
 private:
-    TBool TryProfile(Profile& aProfile, TUint aBitDepth, TUint aNumChannels,
+    TByte* ReserveSpace(TUint& aFrames);
+    void   WriteFrames(const TByte* aData, TUint aFrames);
+    void   MirrorFrames(const TByte* aData, TUint aFrames);
+    TByte* RingReserve(TUint& aFrames);
+    void   RingCommit(TUint aFrames);
+    TBool  WaitRingEmpty();
+    void   ConfigureRing(TUint aSampleRate);
+    void   WriterThread();
+    TByte* MmapBegin(TUint& aFrames);
+    void   MmapCommit(TUint aFrames);
+    TByte* DiscardSpace(TUint& aFrames);
+    TBool  Recover(TInt aErr);
+    TBool  WaitDevice();
+    void   StartScheduled(snd_pcm_sframes_t aAvail, TBool aNow);
+    TBool  HoldStart(TBool aHold);
+    TBool  WaitUntil(TUint64 aMonotonicNs);
+    void   Wake();
+    void   Drain();
+    void   Drop();
+    void   Prepare();
+    void   DiscardRing();
+    void   Cut();
+    void   Remember(const TByte* aData, TUint aFrames);
+    void   Recall(TUint64 aFrame, TByte* aData, TUint aFrames) const;
+    TBool  ProfileSupported(Profile& aProfile, TUint aBitDepth,
+                            TUint aNumChannels, TUint aSampleRate,
+                            Bwx& aReason) const;
+    TBool  TryProfile(Profile& aProfile, TUint aBitDepth, TUint aNumChannels,
+                      TUint aSampleRate, TUint aBufferUs);
+    TBool  TryFormat(snd_pcm_format_t aFormat, TUint aNumChannels,
                      TUint aSampleRate, TUint aBufferUs);
+    TInt   SelectProfile(TUint aBitDepth, TUint aNumChannels,
+                         TUint aSampleRate);
+    TUint  DeviceChannels(TUint aNumChannels) const;
+    void   ConfigureChannels(TUint aNumChannels);
+    void   UpdateVolume(TBool aForce);
+    TBool  ConfigureDsd(TUint aSampleRate, TUint aNumChannels);
+    void   StartOutput(TUint aDeviceRate);
+    TBool  PullClock(const DecodedStreamInfo& aInfo) const;
+    TBool  ConfigureResampler(TUint aSampleRate, TUint aDeviceRate,
+                              TUint aNumChannels);
+    TBool  RetargetStream(const DecodedStreamInfo& aInfo);
+    void   TakeResampleCost();
+    void   AllocateSampleBuffer();
+    void   UpdateDelay();
+    void   LoadTimings();
+    void   Calibrate();
 private:
     snd_pcm_t* iHandle;
+    const Brhz iDevice;
+    // Every device but the first is a follower. Followers always have a
+    // ring and writer thread and never block the pipeline thread: audio
+    // that doesn't fit in the ring is dropped.
+    const TBool iFollower;
+    AlsaCapabilities iCaps;
+    TBool iCapsValid;
+    Mutex iSelectionLock;
+    Bws<512> iSelection; // How the current stream's format was chosen.
+    snd_pcm_access_t iAccess;
+    snd_pcm_uframes_t iMmapOffset;
+    TBool iDiscard;     // No room, discard the reserved frames.
+    TUint iMmapAvail;   // Frames free when the mmap area was reserved.
     Bwh iSampleBuffer;  // buffer ProcessSampleX data
     TUint iSampleBytes;
-    TBool iDuplicateChannel;
+    AlsaChannelMap iChannelMap;
+    ChannelMatrix iChannelMatrix;  // Stream channels to the device's.
+    PcmProcessorLe iPcmProcessor;
+    DsdProcessorLe iDsdProcessor;
+    IDriverAlsaVolume* iVolume;  // nullptr without digital volume.
+    TUint iVolumeGeneration;     // Of the settings last applied.
+    const TBool iDsd;          // DSD passthrough enabled.
+    snd_pcm_format_t iFormat;  // Valid while iProfileIndex != -1.
+    TByte* iReserved;          // Space handed out by the last Reserve().
+    std::vector<Pimpl*> iMirrors;
+    TBool iMirrored;           // Fed by another device's conversion.
     std::vector<Profile> iProfiles;
     TInt iProfileIndex;
+    TUint iStreamBitDepth;    // Format the PCM is configured for, valid
+    TUint iStreamSampleRate;  // while iProfileIndex != -1.
+    TUint iStreamNumChannels;
+    AudioFormat iStreamFormat;
+    TUint iDeviceRate;        // iStreamSampleRate unless resampling.
+    const ResamplerQuality iResampleQuality;
+    TUint iFixedSampleRate;   // 0 unless every stream plays at one rate
+    const TUint iFixedBitDepth; // and depth.
+    Resampler iResampler;
+    ClockPullerAlsa* iClockPuller;  // First device only.
+    AlsaOutputClock* iOutputClock;  // First device only.
+    TBool iPullClock;         // The stream is resampled adaptively.
     TBool iDitch;
     TUint iBytesSent;
+    TUint64 iFramesWritten;   // Since the PCM was configured.
+    TUint iOutputSegment;     // Counts PCM configurations.
     TUint iBufferUs;
-
+    TUint iPeriodUs;             // 0 leaves the period to ALSA.
+    const TChar* iTimingSource;  // Where iBufferUs/iPeriodUs came from.
+    Configuration::IStoreReadWrite* iStore;
+    Bws<128> iKeyBufferUs;
+    Bws<128> iKeyPeriodUs;
+    std::atomic<TBool> iCalibrateRequested;
+    std::atomic<TUint64> iStartAtNs;  // 0 unless a start is scheduled.
+    TBool iStartHeld;  // The start threshold is out of reach.
+    // A halt pauses the PCM, keeping its queued audio, or where the device
+    // can't pause stops it. The next audio restarts it.
+    enum class PauseState { None, Paused, Dropped };
+    PauseState iPause;
+    std::atomic<TUint64> iResumeUs;  // Set until the restarted PCM runs.
+    // The last buffer's worth of audio passed to ALSA, indexed by frame
+    // number, which a flush fades out from. Empty where it can't.
+    Bwh   iHistory;
+    TUint iHistoryFrames;
+    AlsaCalibration iCalibration;
+    TBool iMmap;
+    TUint iBufferAllocs; // sample buffer (re)allocations, for debug.
+    snd_pcm_uframes_t iPeriodFrames;
+    snd_pcm_uframes_t iBufferFrames;
+    std::atomic<TUint> iBufferJiffies;  // ALSA buffer plus ring.
+
+    // Delay measured by the audio thread, refreshed at most once a period,
+    // for delay queries.
+    snd_pcm_status_t *iStatus;
+    DelaySnapshot     iDelay;
+    TUint             iDelayStampUs;    // Audio thread only.
+    TUint             iDelayPeriodUs;   // Audio thread only.
+
+    // Optional ring between the pipeline thread (producer) and a writer
+    // thread feeding ALSA (consumer). Disabled when iRingMs is 0.
+    TUint              iRingMs;
+    SampleRing         iRing;
+    Semaphore          iRingData;   // Signalled by the producer.
+    Semaphore          iRingSpace;  // Signalled by the consumer.
+    std::atomic<TBool> iWriterQuit;
+    std::atomic<TBool> iAbandon;    // Writer discards the ring's contents.
+    ThreadFunctor     *iWriterThread;
+    ThreadScheduler   *iScheduler;
+    WaitStat           iPullerWait;
+    WaitStat           iWriterWait;
+    WaitStat           iDeviceWait;
+    AlsaTelemetry      iTelemetry;
+
+    // The PCM is non-blocking. Waits poll its descriptors together with
+    // iWakeFd, which Interrupt() signals.
+    std::vector<struct pollfd> iPollFds;
+    TInt                       iWakeFd;
+    std::atomic<TBool>         iInterrupted;
+
+    static const TInt  kProfileDsd    = -2;  // DSD has no profile.
+    static const TUint kVolumeRampMs  = 20;
     static const TUint kSampleBufSize = 16 * 1024;
+    static const TInt  kDeviceWaitMs  = 1000;
+    static const TUint64 kStartSleepNs = 2000000;  // Final wait to a start.
+    static const TUint kFlushFadeMs   = 5;
+    static const TUint kQuietMs       = 1;       // Checked before a halt,
+    static const TUint kQuietPeak     = 1 << 18; // for below -78dBFS.
+    static const TUint kFollowerRingMsDefault = 100;
+    static const TUint kFollowerWaitMs = 1000; // Before giving up on it.
+    static const TInt  kDirectModes   = SND_PCM_NO_AUTO_RESAMPLE |
+                                        SND_PCM_NO_AUTO_CHANNELS |
+                                        SND_PCM_NO_AUTO_FORMAT |
+                                        SND_PCM_NO_SOFTVOL;
+    static const TChar* kKeyBufferUs;
+    static const TChar* kKeyPeriodUs;
+    static const TChar* kTimingStored;
+    static const TChar* kTimingCalibrated;
+    static const TChar* kTimingFailed;
 };
 
-DriverAlsa::Pimpl::Pimpl(const TChar* aAlsaDevice, TUint aBufferUs)
+const TChar* DriverAlsa::Pimpl::kKeyBufferUs      = "Alsa.BufferUs";
+const TChar* DriverAlsa::Pimpl::kKeyPeriodUs      = "Alsa.PeriodUs";
+const TChar* DriverAlsa::Pimpl::kTimingStored     = "stored";
+const TChar* DriverAlsa::Pimpl::kTimingCalibrated = "calibrated";
+const TChar* DriverAlsa::Pimpl::kTimingFailed     = "calibration failed";
+
+DriverAlsa::Pimpl::Pimpl(const TChar* aAlsaDevice, TUint aIndex,
+                         const DriverAlsaInitParams& aInitParams)
 : iHandle(nullptr)
+, iDevice(aInitParams.Direct() ? AlsaDirectDevice(aAlsaDevice).c_str()
+                               : aAlsaDevice)
+, iFollower(aIndex != 0)
+, iCapsValid(false)
+, iSelectionLock("ASEL")
+, iAccess(SND_PCM_ACCESS_RW_INTERLEAVED)
+, iMmapOffset(0)
+, iDiscard(false)
+, iMmapAvail(0)
 , iSampleBuffer(kSampleBufSize)
 , iSampleBytes(0)
-, iDuplicateChannel(false)
+, iPcmProcessor(*this)
+, iDsdProcessor(*this)
+, iVolume(aInitParams.Volume())
+, iVolumeGeneration(0)
+, iDsd(aInitParams.Dsd())
+, iFormat(SND_PCM_FORMAT_UNKNOWN)
+, iReserved(nullptr)
+, iMirrored(false)
 , iProfileIndex(-1)
+, iStreamBitDepth(0)
+, iStreamSampleRate(0)
+, iStreamNumChannels(0)
+, iStreamFormat(AudioFormat::Undefined)
+, iDeviceRate(0)
+, iResampleQuality(aInitParams.ResampleQuality())
+, iFixedSampleRate(aInitParams.FixedSampleRate())
+, iFixedBitDepth(aInitParams.FixedBitDepth())
+, iClockPuller((aIndex == 0) ? aInitParams.ClockPuller() : nullptr)
+, iOutputClock((aIndex == 0) ? aInitParams.OutputClock() : nullptr)
+, iPullClock(false)
 , iDitch(false)
 , iBytesSent(0)
-, iBufferUs(aBufferUs)
+, iFramesWritten(0)
+, iOutputSegment(0)
+, iBufferUs(aInitParams.BufferUs())
+, iPeriodUs(0)
+, iTimingSource("default")
+, iStore(aInitParams.Store())
+, iCalibrateRequested(false)
+, iStartAtNs(0)
+, iStartHeld(false)
+, iPause(PauseState::None)
+, iResumeUs(0)
+, iHistoryFrames(0)
+, iMmap(aInitParams.Mmap())
+, iBufferAllocs(0)
+, iPeriodFrames(0)
+, iBufferFrames(0)
+, iBufferJiffies(0)
+, iStatus(nullptr)
+, iDelayStampUs(0)
+, iDelayPeriodUs(0)
+, iRingMs(aInitParams.RingMs())
+, iRingData("ARDA", 0)
+, iRingSpace("ARSP", 0)
+, iWriterQuit(false)
+, iAbandon(false)
+, iWriterThread(nullptr)
+, iScheduler(aInitParams.Scheduler())
+, iWakeFd(-1)
+, iInterrupted(false)
 {
-    auto err = snd_pcm_open(&iHandle, aAlsaDevice, SND_PCM_STREAM_PLAYBACK, 0);
-    ASSERT(err == 0);
+    TInt mode = SND_PCM_NONBLOCK;
 
-    // PcmProcessorLe with S32 support
-    iProfiles.emplace_back(new PcmProcessorLe32(*this, iSampleBuffer),
-            OutputFormat(SND_PCM_FORMAT_S32_LE, 4),  // S32 -> S32
-            OutputFormat(SND_PCM_FORMAT_S32_LE, 4),  // S24 -> S32
-            OutputFormat(SND_PCM_FORMAT_S16_LE, 2),  // S16
-            OutputFormat(SND_PCM_FORMAT_S16_LE, 2)); // U8 -> S16
+    iPcmProcessor.SetDither(aInitParams.Dither());
 
-    // PcmProcessorLe without S32 support
-    iProfiles.emplace_back(new PcmProcessorLe(*this, iSampleBuffer),
-            OutputFormat(SND_PCM_FORMAT_S16_LE, 2),  // S32 -> S16
-            OutputFormat(SND_PCM_FORMAT_S16_LE, 2),  // S24 -> S16
-            OutputFormat(SND_PCM_FORMAT_S16_LE, 2),  // S16
-            OutputFormat(SND_PCM_FORMAT_S16_LE, 2)); // U8 -> S16
-}
+    if (aInitParams.Direct())
+    {
+        Log::Print("DriverAlsa: Direct output to %s\n", iDevice.CString());
+        mode |= kDirectModes;
+    }
 
-DriverAlsa::Pimpl::~Pimpl()
-{
-    auto err = snd_pcm_close(iHandle);
-    ASSERT(err == 0);
-}
+    auto err = snd_pcm_open(&iHandle, iDevice.CString(),
+                            SND_PCM_STREAM_PLAYBACK, mode);
+    if (err < 0)
+    {
+        Log::Print("DriverAlsa: snd_pcm_open(%s) error : %s\n",
+                   iDevice.CString(), snd_strerror(err));
+        ASSERTS();
+    }
 
-void DriverAlsa::Pimpl::ProcessPlayable(MsgPlayable* aMsg)
+    iWakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    ASSERT(iWakeFd >= 0);
+
+    // One extra entry for the wake up event.
+    err = snd_pcm_poll_descriptors_count(iHandle);
+    ASSERT(err > 0);
+    iPollFds.resize(err + 1);
+
+    // Everything the device can do is known up front, so stream format
+    // selection doesn't have to try each profile on the hardware.
+    iCapsValid = iCaps.Probe(iHandle);
+    iChannelMap.Query(iHandle);
+
+    if (iFixedSampleRate != 0)
+    {
+        if (iResampleQuality == ResamplerQuality::Off)
+        {
+            Log::Print("DriverAlsa: Fixed output needs resampling, "
+                       "following each stream instead\n");
+            iFixedSampleRate = 0;
+        }
+        else if (iCapsValid && ! iCaps.SupportsRate(iFixedSampleRate))
+        {
+            Log::Print("DriverAlsa: %s can't play %u Hz, following each "
+                       "stream instead\n", iDevice.CString(),
+                       iFixedSampleRate);
+            iFixedSampleRate = 0;
+        }
+        else
+        {
+            Log::Print("DriverAlsa: Fixed output at %u Hz, %u bit on %s\n",
+                       iFixedSampleRate, iFixedBitDepth, iDevice.CString());
+        }
+    }
+
+    err = snd_pcm_status_malloc(&iStatus);
+    ASSERT(err == 0);
+
+    // The first device keeps the original keys. Followers are calibrated
+    // separately, under keys naming the device.
+    iKeyBufferUs.Replace(kKeyBufferUs);
+    iKeyPeriodUs.Replace(kKeyPeriodUs);
+
+    if (iFollower)
+    {
+        iKeyBufferUs.AppendPrintf(".%s", iDevice.CString());
+        iKeyPeriodUs.AppendPrintf(".%s", iDevice.CString());
+
+        if (iRingMs == 0)
+        {
+            iRingMs = kFollowerRingMsDefault;
+        }
+    }
+
+    LoadTimings();
+
+    Log::Print("DriverAlsa: Using %s sample conversion kernels\n",
+               SampleConverter::IsaName(SampleConverter::SelectedIsa()));
+
+    // Profiles are tried in order, so the most efficient format for 24 bit
+    // audio comes first. The pipeline carries at most 24 bits, so 32 bit
+    // input loses nothing when packed.
+
+    // Profile with packed 24 bit support (USB DACs, some I2S HATs).
+    iProfiles.emplace_back(
+            OutputFormat(SND_PCM_FORMAT_S24_3LE, 3),  // S32 -> S24_3
+            OutputFormat(SND_PCM_FORMAT_S24_3LE, 3),  // S24 -> S24_3
+            OutputFormat(SND_PCM_FORMAT_S16_LE,  2),  // S16
+            OutputFormat(SND_PCM_FORMAT_S16_LE,  2)); // U8 -> S16
+
+    // Profile with S32 support
+    iProfiles.emplace_back(
+            OutputFormat(SND_PCM_FORMAT_S32_LE, 4),  // S32 -> S32
+            OutputFormat(SND_PCM_FORMAT_S32_LE, 4),  // S24 -> S32
+            OutputFormat(SND_PCM_FORMAT_S16_LE, 2),  // S16
+            OutputFormat(SND_PCM_FORMAT_S16_LE, 2)); // U8 -> S16
+
+    // Profile with 24 bit in 32 bit container support
+    iProfiles.emplace_back(
+            OutputFormat(SND_PCM_FORMAT_S24_LE, 4),  // S32 -> S24
+            OutputFormat(SND_PCM_FORMAT_S24_LE, 4),  // S24 -> S24
+            OutputFormat(SND_PCM_FORMAT_S16_LE, 2),  // S16
+            OutputFormat(SND_PCM_FORMAT_S16_LE, 2)); // U8 -> S16
+
+    // Profile without 24 or 32 bit support
+    iProfiles.emplace_back(
+            OutputFormat(SND_PCM_FORMAT_S16_LE, 2),  // S32 -> S16
+            OutputFormat(SND_PCM_FORMAT_S16_LE, 2),  // S24 -> S16
+            OutputFormat(SND_PCM_FORMAT_S16_LE, 2),  // S16
+            OutputFormat(SND_PCM_FORMAT_S16_LE, 2)); // U8 -> S16
+
+    // Calibrate now, while nothing plays, rather than hold up the first
+    // stream. A failure is stored too, so it isn't repeated at every start.
+    if ((iTimingSource != kTimingStored) &&
+        (iTimingSource != kTimingFailed) && aInitParams.Calibrate())
+    {
+        Calibrate();
+    }
+
+    if (iRingMs != 0)
+    {
+        Log::Print("DriverAlsa: Using %ums ring and writer thread for %s\n",
+                   iRingMs, iDevice.CString());
+
+        iWriterThread =
+            new ThreadFunctor("AlsaWriter",
+                              MakeFunctor(*this, &Pimpl::WriterThread),
+                              kPrioritySystemHighest);
+        iWriterThread->Start();
+    }
+}
+
+DriverAlsa::Pimpl::~Pimpl()
+{
+    Interrupt();
+
+    if (iWriterThread != nullptr)
+    {
+        iWriterQuit.store(true);
+        iRingData.Signal();
+
+        delete iWriterThread;
+    }
+
+    close(iWakeFd);
+    snd_pcm_status_free(iStatus);
+
+    auto err = snd_pcm_close(iHandle);
+    ASSERT(err == 0);
+}
+
+void DriverAlsa::Pimpl::ProcessPlayable(MsgPlayable* aMsg)
 {
-    if (! iDitch)
-    	aMsg->Read(iProfiles[iProfileIndex].GetPcmProcessor());
+    if (! iDitch && ! iMirrored)
+    {
+        if (iStreamFormat == AudioFormat::Dsd)
+        {
+            aMsg->Read(iDsdProcessor);
+        }
+        else
+        {
+            UpdateVolume(false);
+
+            if (iPullClock)
+            {
+                iResampler.SetDrift(iClockPuller->CorrectionPpb());
+            }
+
+            aMsg->Read(iPcmProcessor);
+        }
+    }
+
+    TakeResampleCost();
 }
 
-void DriverAlsa::Pimpl::ProcessDrain()
+void DriverAlsa::Pimpl::ProcessDrain(TBool aFlush)
 {
+    if (aFlush)
+    {
+        DiscardRing();
+        Cut();
+    }
+
+    const TBool stalled = WaitRingEmpty();
+
+    // Audio held by a pause plays out with the rest.
+    Resume(false);
+
     // Wait for the native audio buffers to empty.
     if (iProfileIndex != -1)
     {
-        // Drain the PCM buffers.
-        auto err = snd_pcm_drain(iHandle);
-        if (err < 0)
+        // Drain the PCM buffers, unless the device has stopped taking
+        // audio.
+        if (stalled)
         {
-            Log::Print("DriverAlsa: snd_pcm_drain() error : %s\n",
-                       snd_strerror(err));
-            ASSERTS();
+            Drop();
+        }
+        else
+        {
+            Drain();
         }
 
-        // Prepare the PCM to accept new data.
-        err = snd_pcm_prepare(iHandle);
+        Prepare();
 
-        if (err < 0)
+        // Audio after a drain doesn't follow on from what went before.
+        if ((iDeviceRate != iStreamSampleRate) || iPullClock)
         {
-            Log::Print("DriverAlsa: snd_pcm_prepare() error : %s\n",
-                       snd_strerror(err));
-            ASSERTS();
+            iResampler.Reset();
+        }
+    }
+}
+
+TByte* DriverAlsa::Pimpl::Reserve(TUint& aFrames)
+{
+    iReserved = ReserveSpace(aFrames);
+    return iReserved;
+}
+
+TByte* DriverAlsa::Pimpl::ReserveSpace(TUint& aFrames)
+{
+    if (iRingMs != 0)
+    {
+        return RingReserve(aFrames);
+    }
+
+    if (iAccess == SND_PCM_ACCESS_MMAP_INTERLEAVED)
+    {
+        return MmapBegin(aFrames);
+    }
+
+    TUint room = iSampleBuffer.BytesRemaining() / iSampleBytes;
+
+    if (room == 0)
+    {
+        Flush();
+        room = iSampleBuffer.BytesRemaining() / iSampleBytes;
+        ASSERT(room != 0);
+    }
+
+    if (aFrames > room)
+    {
+        aFrames = room;
+    }
+
+    return const_cast<TByte*>(iSampleBuffer.Ptr()) + iSampleBuffer.Bytes();
+}
+
+void DriverAlsa::Pimpl::Commit(TUint aFrames)
+{
+    for (auto mirror : iMirrors)
+    {
+        mirror->MirrorFrames(iReserved, aFrames);
+    }
+
+    if (iDiscard)
+    {
+        iDiscard = false;
+        iTelemetry.Dropped(aFrames);
+        return;
+    }
+
+    if (iRingMs != 0)
+    {
+        RingCommit(aFrames);
+    }
+    else if (iAccess == SND_PCM_ACCESS_MMAP_INTERLEAVED)
+    {
+        MmapCommit(aFrames);
+    }
+    else
+    {
+        iSampleBuffer.SetBytes(iSampleBuffer.Bytes() +
+                               (aFrames * iSampleBytes));
+    }
+}
+
+void DriverAlsa::Pimpl::Flush()
+{
+    // Frames written to the ring or mmap area are queued on commit.
+    if (iSampleBuffer.Bytes() != 0)
+    {
+        WriteFrames(iSampleBuffer.Ptr(),
+                    iSampleBuffer.Bytes() / iSampleBytes);
+        iSampleBuffer.SetBytes(0);
+    }
+}
+
+// Return contiguous free space in the ring, waiting for the writer thread
+// if the ring is full.
+TByte* DriverAlsa::Pimpl::RingReserve(TUint& aFrames)
+{
+    for (;;)
+    {
+        TUint  bytes = aFrames * iSampleBytes;
+        TByte *space = iRing.WriteSpace(bytes);
+
+        if (bytes != 0)
+        {
+            aFrames = bytes / iSampleBytes;
+            return space;
+        }
+
+        iRingSpace.Clear();
+
+        if (iRing.OccupancyBytes() < iRing.CapacityBytes())
+        {
+            continue;
+        }
+
+        // Only the first device may hold up the pipeline.
+        if (iFollower)
+        {
+            return DiscardSpace(aFrames);
+        }
+
+        const TUint64 start = MonotonicUs();
+
+        iRingSpace.Wait();
+        iPullerWait.Add(MonotonicUs() - start);
+    }
+}
+
+void DriverAlsa::Pimpl::RingCommit(TUint aFrames)
+{
+    iRing.Produce(aFrames * iSampleBytes);
+    iRingData.Signal();
+}
+
+// Queue a copy of frames another device has converted, dropping whatever
+// doesn't fit.
+void DriverAlsa::Pimpl::MirrorFrames(const TByte* aData, TUint aFrames)
+{
+    TUint bytes = aFrames * iSampleBytes;
+
+    while (bytes > 0)
+    {
+        TUint  run   = bytes;
+        TByte *space = iRing.WriteSpace(run);
+
+        if (run == 0)
+        {
+            iTelemetry.Dropped(bytes / iSampleBytes);
+            break;
+        }
+
+        memcpy(space, aData, run);
+        iRing.Produce(run);
+
+        aData += run;
+        bytes -= run;
+    }
+
+    iRingData.Signal();
+}
+
+// Wait for the writer thread to pass everything queued to ALSA.
+//
+// The writer only touches the PCM while the ring holds data, so once it is
+// empty the caller has sole use of the PCM.
+//
+// A follower that makes no progress for kFollowerWaitMs has its queued
+// audio discarded, and true is returned so the caller doesn't wait for the
+// device again.
+TBool DriverAlsa::Pimpl::WaitRingEmpty()
+{
+    if (iRingMs == 0)
+    {
+        return false;
+    }
+
+    for (;;)
+    {
+        iRingSpace.Clear();
+
+        if (iRing.Empty())
+        {
+            break;
+        }
+
+        if (! iFollower || iAbandon.load())
+        {
+            iRingSpace.Wait();
+            continue;
+        }
+
+        try
+        {
+            iRingSpace.Wait(kFollowerWaitMs);
+        }
+        catch (Timeout&)
+        {
+            Log::Print("DriverAlsa: %s stalled, discarding queued audio\n",
+                       iDevice.CString());
+
+            iAbandon.store(true);
+            Wake();
+        }
+    }
+
+    if (! iAbandon.load())
+    {
+        return false;
+    }
+
+    // The writer is idle, so the wake up can be reset.
+    eventfd_t value;
+
+    iAbandon.store(false);
+    (void)eventfd_read(iWakeFd, &value);
+
+    return true;
+}
+
+void DriverAlsa::Pimpl::ConfigureRing(TUint aSampleRate)
+{
+    if (iRingMs == 0)
+    {
+        return;
+    }
+
+    TUint frames = (TUint)(((TUint64)aSampleRate * iRingMs) / 1000);
+
+    // The writer hands ALSA up to a period at a time.
+    if (frames < iPeriodFrames)
+    {
+        frames = (TUint)iPeriodFrames;
+    }
+
+    iRing.Configure(frames * iSampleBytes, iSampleBytes);
+}
+
+void DriverAlsa::Pimpl::WriterThread()
+{
+    if (iScheduler != nullptr)
+    {
+        iScheduler->ApplyToCurrent(ThreadScheduler::Role::Output,
+                                   "AlsaWriter", kPrioritySystemHighest);
+    }
+
+    while (! iWriterQuit.load())
+    {
+        TUint        bytes;
+        const TByte *data = iRing.ReadData(bytes);
+
+        if (bytes == 0)
+        {
+            iRingData.Clear();
+
+            if (! iRing.Empty() || iWriterQuit.load())
+            {
+                continue;
+            }
+
+            const TUint64 start = MonotonicUs();
+
+            iRingData.Wait();
+            iWriterWait.Add(MonotonicUs() - start);
+            continue;
+        }
+
+        TUint frames = bytes / iSampleBytes;
+
+        if ((iPeriodFrames != 0) && (frames > iPeriodFrames))
+        {
+            frames = (TUint)iPeriodFrames;
+        }
+
+        if (! iAbandon.load())
+        {
+            WriteFrames(data, frames);
+        }
+
+        iRing.Consume(frames * iSampleBytes);
+        iRingSpace.Signal();
+    }
+}
+
+TUint DriverAlsa::Pimpl::MaxBitDepth() const
+{
+    if (! iCapsValid || (iCaps.MaxBitDepth() == 0))
+    {
+        return 24;
+    }
+
+    return iCaps.MaxBitDepth();
+}
+
+// Whether a DSD stream can be played, going by the capabilities alone.
+// Without a successful probe there is no DoP or native DSD format known to
+// work, so DSD is refused rather than sent to the device as PCM noise.
+TBool DriverAlsa::Pimpl::DsdSupported(TUint aSampleRate,
+                                      TUint aNumChannels) const
+{
+    if (! iDsd || ! iCapsValid || (aNumChannels != 2))
+    {
+        return false;
+    }
+
+    for (auto& mode : kDsdModes)
+    {
+        if (((aSampleRate % mode.iRateDivisor) == 0) &&
+            iCaps.SupportsFormat(mode.iFormat) &&
+            iCaps.SupportsRate(aSampleRate / mode.iRateDivisor))
+        {
+            return true;
         }
     }
+
+    return false;
 }
 
-void DriverAlsa::Pimpl::Write(const Brx& aData)
+// Use buffer and period times from an earlier calibration, if any.
+void DriverAlsa::Pimpl::LoadTimings()
 {
-    int err;
+    if (iStore == nullptr)
+    {
+        return;
+    }
+
+    Bws<16> bufferUs;
+    Bws<16> periodUs;
+
+    try
+    {
+        iStore->Read(iKeyBufferUs, bufferUs);
+        iStore->Read(iKeyPeriodUs, periodUs);
 
-    err = snd_pcm_writei(iHandle, aData.Ptr(), aData.Bytes() / iSampleBytes);
+        const TUint buffer = Ascii::Uint(bufferUs);
+        const TUint period = Ascii::Uint(periodUs);
+
+        if ((buffer != 0) && (period != 0) && (period <= buffer))
+        {
+            iBufferUs     = buffer;
+            iPeriodUs     = period;
+            iTimingSource = kTimingStored;
+        }
+        else if ((buffer == 0) && (period == 0))
+        {
+            iTimingSource = kTimingFailed;  // Keep the defaults.
+        }
+    }
+    catch (StoreKeyNotFound&)
+    {
+    }
+    catch (StoreReadBufferUndersized&)
+    {
+    }
+    catch (AsciiError&)
+    {
+    }
+
+    Log::Print("DriverAlsa: %s buffer %uus, period %uus (%s)\n",
+               iDevice.CString(), iBufferUs, iPeriodUs, iTimingSource);
+}
+
+// Find the lowest latency the device plays reliably, with a margin, and
+// keep it for later starts. If nothing plays reliably the defaults are
+// kept, and zero times are stored to record the failure.
+void DriverAlsa::Pimpl::Calibrate()
+{
+    snd_pcm_format_t format   = SND_PCM_FORMAT_S16_LE;
+    TUint            channels = 2;
+    TUint            rate     = 48000;
 
-    // Handle underrun errors.
-    if(err == -EPIPE) {
-        err = snd_pcm_prepare(iHandle);
+    // Calibrate in a format the device plays: the first profile's, as
+    // streams would use, at 24 then 16 bits.
+    if (iCapsValid)
+    {
+        TBool found = false;
+
+        for (TUint depth = 24; (depth >= 16) && ! found; depth -= 8)
+        {
+            for (auto& profile : iProfiles)
+            {
+                if (iCaps.SupportsFormat(profile.GetFormat(depth).first))
+                {
+                    format = profile.GetFormat(depth).first;
+                    found  = true;
+                    break;
+                }
+            }
+        }
+
+        channels = iCaps.ChannelsFor(2, ChannelMatrix::kMaxChannels);
+        channels = (channels == 0) ? 2 : channels;
+
+        if (! iCaps.SupportsRate(rate))
+        {
+            rate = iCaps.SupportsRate(44100) ? 44100
+                                             : iCaps.ResampleRate(rate);
+            rate = (rate == 0) ? 48000 : rate;
+        }
+    }
+
+    const TBool passed = iCalibration.Run(iHandle, format, channels, rate);
+
+    if (passed)
+    {
+        iBufferUs     = iCalibration.BufferUs();
+        iPeriodUs     = iCalibration.PeriodUs();
+        iTimingSource = kTimingCalibrated;
+    }
+    else
+    {
+        iTimingSource = kTimingFailed;
+    }
+
+    if (iStore != nullptr)
+    {
+        Bws<16> value;
+
+        value.AppendPrintf("%u", passed ? iBufferUs : 0);
+        iStore->Write(iKeyBufferUs, value);
+
+        value.Replace("");
+        value.AppendPrintf("%u", passed ? iPeriodUs : 0);
+        iStore->Write(iKeyPeriodUs, value);
+    }
+}
+
+void DriverAlsa::Pimpl::RequestCalibration()
+{
+    iCalibrateRequested.store(true);
+}
+
+void DriverAlsa::Pimpl::StartAt(TUint64 aMonotonicNs)
+{
+    iStartAtNs.store(aMonotonicNs);
+}
+
+void DriverAlsa::Pimpl::WriteStats(IWriter& aWriter) const
+{
+    iTelemetry.Write(aWriter);
+
+    if (iClockPuller != nullptr)
+    {
+        iClockPuller->Write(aWriter);
+    }
+
+    if (iRingMs != 0)
+    {
+        DriverAlsaRingStats stats;
+        Bws<256>            line;
+
+        GetRingStats(stats);
+
+        line.AppendPrintf("Ring: %u of %u bytes, peak %u\n",
+                          stats.iOccupancyBytes, stats.iCapacityBytes,
+                          stats.iPeakBytes);
+        line.AppendPrintf("Ring waits: pipeline %u (%ums, max %uus), "
+                          "writer %u (%ums, max %uus)\n",
+                          stats.iPullerWaits.iCount,
+                          stats.iPullerWaits.iTotalMs,
+                          stats.iPullerWaits.iMaxUs,
+                          stats.iWriterWaits.iCount,
+                          stats.iWriterWaits.iTotalMs,
+                          stats.iWriterWaits.iMaxUs);
+        aWriter.Write(line);
+    }
+
+    DriverAlsaWaitStats device;
+    Bws<128>            line;
+
+    iDeviceWait.Get(device);
+
+    line.AppendPrintf("Device waits: %u (%ums, max %uus)\n", device.iCount,
+                      device.iTotalMs, device.iMaxUs);
+    aWriter.Write(line);
+}
+
+void DriverAlsa::Pimpl::ResetStats()
+{
+    iTelemetry.Reset();
+}
+
+void DriverAlsa::Pimpl::WriteCapabilities(IWriter& aWriter)
+{
+    Bws<128> line;
+
+    line.AppendPrintf("Device: %s%s\n", iDevice.CString(),
+                      iFollower ? " (follower)" : "");
+    aWriter.Write(line);
+
+    if (! iCapsValid)
+    {
+        aWriter.Write(Brn("Capabilities unavailable\n"));
+        return;
+    }
+
+    iCaps.Write(aWriter);
+    iChannelMap.Write(aWriter);
+
+    AutoMutex am(iSelectionLock);
+
+    line.Replace("");
+    line.AppendPrintf("Buffer %uus, period %uus (%s)%s\n", iBufferUs,
+                      iPeriodUs, iTimingSource,
+                      iCalibrateRequested.load() ? ", calibration pending"
+                                                 : "");
+    aWriter.Write(line);
+    iCalibration.Write(aWriter);
+
+    aWriter.Write(Brn("Last stream: "));
+    aWriter.Write(iSelection);
+    aWriter.Write(Brn("\n"));
+}
+
+void DriverAlsa::Pimpl::GetRingStats(DriverAlsaRingStats& aStats) const
+{
+    aStats.iDepthMs        = iRingMs;
+    aStats.iCapacityBytes  = iRing.CapacityBytes();
+    aStats.iOccupancyBytes = iRing.OccupancyBytes();
+    aStats.iPeakBytes      = iRing.PeakBytes();
+
+    iPullerWait.Get(aStats.iPullerWaits);
+    iWriterWait.Get(aStats.iWriterWaits);
+    iDeviceWait.Get(aStats.iDeviceWaits);
+}
+
+// Return the next contiguous run of free frames in the device ring buffer,
+// waiting for space if the buffer is full.
+TByte* DriverAlsa::Pimpl::MmapBegin(TUint& aFrames)
+{
+    for (;;)
+    {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(iHandle);
+
+        StartScheduled(avail, false);
+
+        if (avail == 0)
+        {
+            // Unlike snd_pcm_writei() committing frames doesn't start the
+            // PCM, so start it once the buffer has been filled.
+            if (snd_pcm_state(iHandle) == SND_PCM_STATE_PREPARED)
+            {
+                avail = snd_pcm_start(iHandle);
+            }
+
+            if (avail == 0)
+            {
+                if (! WaitDevice())
+                {
+                    return DiscardSpace(aFrames);
+                }
+
+                continue;
+            }
+        }
+
+        const snd_pcm_channel_area_t *areas;
+        snd_pcm_uframes_t             frames = aFrames;
+
+        if (avail > 0)
+        {
+            if (frames > (snd_pcm_uframes_t)avail)
+            {
+                frames = avail;
+            }
+
+            avail = snd_pcm_mmap_begin(iHandle, &areas, &iMmapOffset, &frames);
+        }
+
+        if (avail < 0)
+        {
+            if (Recover((TInt)avail))
+            {
+                continue;
+            }
+
+            return DiscardSpace(aFrames);
+        }
+
+        aFrames   = (TUint)frames;
+        iMmapAvail = (TUint)avail;
+
+        return (TByte *)areas[0].addr +
+               ((areas[0].first + (iMmapOffset * areas[0].step)) / 8);
+    }
+}
+
+// Convert into the sample buffer and discard the result so the pipeline
+// keeps moving when the device can't take audio.
+TByte* DriverAlsa::Pimpl::DiscardSpace(TUint& aFrames)
+{
+    iDiscard = true;
+    aFrames = std::min(aFrames, iSampleBuffer.MaxBytes() / iSampleBytes);
+
+    return const_cast<TByte*>(iSampleBuffer.Ptr());
+}
+
+// A short commit still hands over the frames it committed, so they are
+// accounted for before recovering from the shortfall.
+void DriverAlsa::Pimpl::MmapCommit(TUint aFrames)
+{
+    const TUint64 start     = MonotonicUs();
+    auto          committed = snd_pcm_mmap_commit(iHandle, iMmapOffset,
+                                                  aFrames);
+
+    if (committed > 0)
+    {
+        const TUint frames = std::min((TUint)committed, aFrames);
+
+        iTelemetry.Write(iMmapAvail, (TUint)(MonotonicUs() - start), frames);
+        Remember(iReserved, frames);
+        iBytesSent     += frames * iSampleBytes;
+        iFramesWritten += frames;
+        UpdateDelay();
+    }
+
+    if (committed < 0 || (TUint)committed < aFrames)
+    {
+        const TInt err = (committed < 0) ? (TInt)committed : -EPIPE;
+
+        Log::Print("DriverAlsa: snd_pcm_mmap_commit() took %u of %u frames "
+                   ": %s\n", (committed < 0) ? 0 : (TUint)committed, aFrames,
+                   snd_strerror(err));
+
+        Recover(err);
+    }
+}
+
+// Handle underrun (-EPIPE) and suspend (-ESTRPIPE) errors, returning true
+// if the PCM can accept more data.
+TBool DriverAlsa::Pimpl::Recover(TInt aErr)
+{
+    if (aErr == -EPIPE)
+    {
+        iTelemetry.Xrun();
+    }
+
+    auto err = snd_pcm_recover(iHandle, aErr, 1);  // silent
+
+    iTelemetry.Recovery(err >= 0);
+
+    if (err < 0)
+    {
+        Log::Print("DriverAlsa: unrecoverable error %s (recovering from %s)\n",
+                   snd_strerror(err), snd_strerror(aErr));
+        return false;
+    }
+
+    return true;
+}
+
+// Wait until the PCM can accept more audio.
+//
+// Returns false if Interrupt() has been called, in which case any audio
+// still to be written should be dropped.
+TBool DriverAlsa::Pimpl::WaitDevice()
+{
+    const TUint   count = (TUint)iPollFds.size() - 1;
+    const TUint64 start = MonotonicUs();
+
+    for (;;)
+    {
+        if (iInterrupted.load() || iAbandon.load())
+        {
+            return false;
+        }
+
+        snd_pcm_poll_descriptors(iHandle, &iPollFds[0], count);
+
+        iPollFds[count].fd      = iWakeFd;
+        iPollFds[count].events  = POLLIN;
+        iPollFds[count].revents = 0;
+
+        auto ret = poll(&iPollFds[0], count + 1, kDeviceWaitMs);
+
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            Log::Print("DriverAlsa: poll() error : %s\n", strerror(errno));
+            return false;
+        }
+
+        if ((iPollFds[count].revents & POLLIN) != 0)
+        {
+            return false;
+        }
+
+        unsigned short revents = 0;
+
+        if (ret > 0)
+        {
+            snd_pcm_poll_descriptors_revents(iHandle, &iPollFds[0], count,
+                                             &revents);
+        }
+
+        // Timeouts and errors are left to the caller's next access to the
+        // PCM, which reports the state the device is in.
+        if ((ret == 0) || ((revents & (POLLOUT | POLLERR)) != 0))
+        {
+            iDeviceWait.Add(MonotonicUs() - start);
+            return true;
+        }
+    }
+}
+
+// Start a prepared PCM at the scheduled time, if there is one. Until then
+// the start threshold is held out of reach so writes fill the buffer
+// without starting it. aAvail is the room left in the buffer. Once it is
+// full, the time has passed with at least a period buffered, or aNow is
+// set, this waits for the time and starts the PCM.
+void DriverAlsa::Pimpl::StartScheduled(snd_pcm_sframes_t aAvail, TBool aNow)
+{
+    const TUint64 startNs = iStartAtNs.load(std::memory_order_relaxed);
+
+    if (((startNs == 0) && ! iStartHeld) || (aAvail < 0) ||
+        (snd_pcm_state(iHandle) != SND_PCM_STATE_PREPARED))
+    {
+        return;
+    }
+
+    // Cancelled, so start as writes would have.
+    if (startNs == 0)
+    {
+        HoldStart(false);
+
+        if (aAvail == 0)
+        {
+            snd_pcm_start(iHandle);
+        }
+
+        return;
+    }
+
+    if (! iStartHeld && ! HoldStart(true))
+    {
+        iStartAtNs.store(0);
+        return;
+    }
+
+    const snd_pcm_uframes_t buffered =
+        iBufferFrames - std::min((snd_pcm_uframes_t)aAvail, iBufferFrames);
+
+    if ((buffered == 0) ||
+        (! aNow && (aAvail > 0) &&
+         ((MonotonicNs() < startNs) || (buffered < iPeriodFrames))))
+    {
+        return;
+    }
+
+    if (! WaitUntil(startNs))
+    {
+        return;
+    }
+
+    auto err = snd_pcm_start(iHandle);
+
+    HoldStart(false);
+
+    // A request made meanwhile is for the next start.
+    TUint64 expected = startNs;
+
+    iStartAtNs.compare_exchange_strong(expected, 0);
+
+    if (err < 0)
+    {
+        Log::Print("DriverAlsa: snd_pcm_start() error : %s\n",
+                   snd_strerror(err));
+        return;
+    }
+
+    // The trigger timestamp is when the device started, which may be
+    // later than the call.
+    TUint64          startedNs = MonotonicNs();
+    snd_htimestamp_t trigger;
+
+    if (snd_pcm_status(iHandle, iStatus) == 0)
+    {
+        snd_pcm_status_get_trigger_htstamp(iStatus, &trigger);
+
+        if ((trigger.tv_sec != 0) || (trigger.tv_nsec != 0))
+        {
+            startedNs = ((TUint64)trigger.tv_sec * 1000000000) +
+                        trigger.tv_nsec;
+        }
+    }
+
+    const TInt errorUs = (TInt)(((TInt64)startedNs - (TInt64)startNs) / 1000);
+
+    iTelemetry.ScheduledStart(errorUs);
+
+    Log::Print("DriverAlsa: %s started %+dus from the time requested with "
+               "%u frames buffered\n", iDevice.CString(), errorUs,
+               (TUint)buffered);
+}
+
+// Move the start threshold beyond the buffer, or back to a full buffer.
+TBool DriverAlsa::Pimpl::HoldStart(TBool aHold)
+{
+    snd_pcm_sw_params_t *swParams;
+    snd_pcm_uframes_t    threshold = iBufferFrames;
+    int                  err;
+
+    snd_pcm_sw_params_alloca(&swParams);
+
+    if ((err = snd_pcm_sw_params_current(iHandle, swParams)) == 0)
+    {
+        if (aHold)
+        {
+            err = snd_pcm_sw_params_get_boundary(swParams, &threshold);
+        }
+        else if (iPeriodFrames != 0)
+        {
+            threshold = (iBufferFrames / iPeriodFrames) * iPeriodFrames;
+        }
+    }
+
+    if ((err < 0) ||
+        ((err = snd_pcm_sw_params_set_start_threshold(iHandle, swParams,
+                                                      threshold)) < 0) ||
+        ((err = snd_pcm_sw_params(iHandle, swParams)) < 0))
+    {
+        Log::Print("DriverAlsa: Can't set start threshold : %s\n",
+                   snd_strerror(err));
+        return false;
+    }
+
+    iStartHeld = aHold;
+    return true;
+}
+
+// Sleep until aMonotonicNs. Returns false if Interrupt() has been called
+// or the writer told to abandon its audio.
+TBool DriverAlsa::Pimpl::WaitUntil(TUint64 aMonotonicNs)
+{
+    for (;;)
+    {
+        if (iInterrupted.load() || iAbandon.load())
+        {
+            return false;
+        }
+
+        const TUint64 now = MonotonicNs();
+
+        if (now >= aMonotonicNs)
+        {
+            return true;
+        }
+
+        // Long waits watch iWakeFd, the last few ms sleep to the time.
+        if (aMonotonicNs - now > kStartSleepNs)
+        {
+            const TUint64 ms = std::min<TUint64>(
+                (aMonotonicNs - now - kStartSleepNs) / 1000000, kDeviceWaitMs);
+            struct pollfd wake = { iWakeFd, POLLIN, 0 };
+
+            (void)poll(&wake, 1, (int)ms);
+            continue;
+        }
+
+        struct timespec until;
+
+        until.tv_sec  = (time_t)(aMonotonicNs / 1000000000);
+        until.tv_nsec = (long)(aMonotonicNs % 1000000000);
+
+        (void)clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr);
+    }
+}
+
+// Abandon any write in progress and make future waits return at once.
+void DriverAlsa::Pimpl::Interrupt()
+{
+    iInterrupted.store(true);
+    Wake();
+}
+
+// Make the writer, or pipeline, thread's current and future device waits
+// return until the event is read.
+void DriverAlsa::Pimpl::Wake()
+{
+    const eventfd_t one = 1;
+
+    if (write(iWakeFd, &one, sizeof(one)) != (ssize_t)sizeof(one))
+    {
+        Log::Print("DriverAlsa: Failed to wake audio thread\n");
+    }
+}
+
+// Drain the PCM. Draining is a blocking operation, so the PCM is switched
+// out of non-blocking mode for the duration.
+void DriverAlsa::Pimpl::Drain()
+{
+    // Audio held for a scheduled start still plays at its time.
+    StartScheduled(snd_pcm_avail_update(iHandle), true);
+
+    const TUint64 start = MonotonicUs();
+
+    snd_pcm_nonblock(iHandle, 0);
+
+    auto err = snd_pcm_drain(iHandle);
+    if (err < 0)
+    {
+        Log::Print("DriverAlsa: snd_pcm_drain() error : %s\n",
+                   snd_strerror(err));
+
+        // A follower failing, e.g. by being unplugged, mustn't stop
+        // playback on the others.
+        if (! iFollower)
+        {
+            ASSERTS();
+        }
+    }
+
+    snd_pcm_nonblock(iHandle, 1);
+
+    iTelemetry.Drain((TUint)(MonotonicUs() - start));
+}
+
+// Stop the PCM, discarding anything it still holds.
+void DriverAlsa::Pimpl::Drop()
+{
+    auto err = snd_pcm_drop(iHandle);
+    if (err < 0)
+    {
+        Log::Print("DriverAlsa: snd_pcm_drop() error : %s\n",
+                   snd_strerror(err));
+    }
+}
+
+// Prepare a stopped PCM to accept new data.
+void DriverAlsa::Pimpl::Prepare()
+{
+    auto err = snd_pcm_prepare(iHandle);
+
+    if (err < 0)
+    {
+        Log::Print("DriverAlsa: snd_pcm_prepare() error : %s\n",
+                   snd_strerror(err));
+
+        if (! iFollower)
+        {
+            ASSERTS();
+        }
+    }
+}
+
+// Have the writer thread throw away what the ring holds, rather than pass
+// it to ALSA, and wait for it to go idle.
+void DriverAlsa::Pimpl::DiscardRing()
+{
+    if ((iRingMs == 0) || iRing.Empty())
+    {
+        return;
+    }
+
+    iAbandon.store(true);
+    Wake();
+    (void)WaitRingEmpty();
+}
+
+// Stop the old audio within a period, for a seek, skip or stop. What the
+// device can still take back is rewound, and the start of it rewritten
+// fading to silence, so nothing stale plays on and the cut doesn't click.
+// The PCM keeps running, ready for what comes next.
+//
+// Where that can't be done (DSD, a follower, a device that can't rewind
+// to within a period of the hardware) the PCM is dropped instead. So is
+// audio held by a pause, or not yet started.
+void DriverAlsa::Pimpl::Cut()
+{
+    const snd_pcm_state_t state = snd_pcm_state(iHandle);
+
+    if ((state != SND_PCM_STATE_RUNNING) && (state != SND_PCM_STATE_PAUSED) &&
+        (state != SND_PCM_STATE_PREPARED))
+    {
+        return;
+    }
+
+    // Nothing queued, nothing to cut.
+    if ((state == SND_PCM_STATE_PREPARED) &&
+        (snd_pcm_avail_update(iHandle) >= (snd_pcm_sframes_t)iBufferFrames))
+    {
+        return;
+    }
+
+    const TUint fadeFrames =
+        std::min((iDeviceRate * kFlushFadeMs) / 1000,
+                 (TUint)(iPeriodFrames / 2));
+    snd_pcm_sframes_t rewound = 0;
+    snd_pcm_uframes_t kept    = 0;
+
+    if ((state == SND_PCM_STATE_RUNNING) && (iHistoryFrames != 0))
+    {
+        const auto avail      = snd_pcm_avail_update(iHandle);
+        const auto rewindable = snd_pcm_rewindable(iHandle);
+
+        if ((avail >= 0) && (rewindable > 0))
+        {
+            const snd_pcm_uframes_t queued =
+                iBufferFrames - std::min((snd_pcm_uframes_t)avail,
+                                         iBufferFrames);
+
+            kept = queued - std::min((snd_pcm_uframes_t)rewindable, queued);
+
+            if (kept + fadeFrames <= iPeriodFrames)
+            {
+                rewound = snd_pcm_rewind(iHandle, rewindable);
+            }
+        }
+    }
+
+    if (rewound <= 0)
+    {
+        Drop();
+        Prepare();
+
+        iPause = PauseState::None;
+        iOutputSegment++;  // Dropped frames were counted as written.
+        iTelemetry.Flush(false, 0);
+        return;
+    }
+
+    iFramesWritten -= (TUint64)rewound;
+
+    const TUint  fade = std::min(fadeFrames, (TUint)rewound);
+    TByte* const data = const_cast<TByte*>(iSampleBuffer.Ptr());
+
+    Recall(iFramesWritten, data, fade);
+    SampleConverter::FadeOut(data, fade, iChannelMatrix.OutChannels(),
+                             LayoutOf(iFormat));
+    WriteFrames(data, fade);
+
+    iTelemetry.Flush(true, (TUint)(((kept + fade) * 1000000) / iDeviceRate));
+
+    iDelayStampUs = 0;
+    UpdateDelay();
+}
+
+// Keep a copy of frames about to be counted as written.
+void DriverAlsa::Pimpl::Remember(const TByte* aData, TUint aFrames)
+{
+    TUint64 frame = iFramesWritten;
+
+    // Only the newest can be rewound.
+    if (aFrames > iHistoryFrames)
+    {
+        aData  += (aFrames - iHistoryFrames) * iSampleBytes;
+        frame  += aFrames - iHistoryFrames;
+        aFrames = iHistoryFrames;
+    }
+
+    while (aFrames > 0)
+    {
+        const TUint at  = (TUint)(frame % iHistoryFrames);
+        const TUint run = std::min(aFrames, iHistoryFrames - at);
+
+        memcpy(const_cast<TByte*>(iHistory.Ptr()) + (at * iSampleBytes),
+               aData, run * iSampleBytes);
+
+        aData   += run * iSampleBytes;
+        frame   += run;
+        aFrames -= run;
+    }
+}
+
+void DriverAlsa::Pimpl::Recall(TUint64 aFrame, TByte* aData,
+                               TUint aFrames) const
+{
+    while (aFrames > 0)
+    {
+        const TUint at  = (TUint)(aFrame % iHistoryFrames);
+        const TUint run = std::min(aFrames, iHistoryFrames - at);
+
+        memcpy(aData, iHistory.Ptr() + (at * iSampleBytes),
+               run * iSampleBytes);
+
+        aData   += run * iSampleBytes;
+        aFrame  += run;
+        aFrames -= run;
+    }
+}
+
+// Whether the audio last passed to ALSA ends in silence, as it does when
+// the pipeline ramps down before a halt. A stream that simply ends stops
+// on whatever it was playing. Audio that can't be checked, DSD say, counts
+// as not quiet.
+TBool DriverAlsa::Pimpl::EndsQuiet()
+{
+    (void)WaitRingEmpty();
+
+    if ((iProfileIndex == -1) || (iHistoryFrames == 0))
+    {
+        return false;
+    }
+
+    const TUint frames =
+        std::min(std::min((iDeviceRate * kQuietMs) / 1000, iHistoryFrames),
+                 iSampleBuffer.MaxBytes() / iSampleBytes);
+
+    if ((frames == 0) || (iFramesWritten < frames))
+    {
+        return false;
+    }
+
+    TByte* const data = const_cast<TByte*>(iSampleBuffer.Ptr());
+
+    Recall(iFramesWritten - frames, data, frames);
+
+    return SampleConverter::Peak(data, frames, iChannelMatrix.OutChannels(),
+                                 LayoutOf(iFormat)) < kQuietPeak;
+}
+
+// Silence the device at a halt without waiting for its buffer to play
+// out. Only called once the halt is known to follow a ramp down, so what
+// is still queued fades to silence. Where the device can pause the queue
+// is kept and resumes with the next audio, otherwise it is dropped.
+//
+// Anything in the ring is passed to ALSA first, so that this thread has
+// sole use of the PCM.
+void DriverAlsa::Pimpl::Pause(TUint64 aHaltUs)
+{
+    if ((iProfileIndex == -1) || (iPause != PauseState::None))
+    {
+        return;
+    }
+
+    const TBool stalled = WaitRingEmpty();
+
+    // A PCM that hasn't started, e.g. one held for a scheduled start, is
+    // already silent.
+    if (snd_pcm_state(iHandle) != SND_PCM_STATE_RUNNING)
+    {
+        return;
+    }
+
+    snd_pcm_hw_params_t *hwParams;
+    snd_pcm_hw_params_alloca(&hwParams);
+
+    iPause = PauseState::Dropped;
+
+    if (! stalled && (snd_pcm_hw_params_current(iHandle, hwParams) == 0) &&
+        snd_pcm_hw_params_can_pause(hwParams))
+    {
+        auto err = snd_pcm_pause(iHandle, 1);
+
+        if (err == 0)
+        {
+            iPause = PauseState::Paused;
+        }
+        else
+        {
+            Log::Print("DriverAlsa: snd_pcm_pause() error : %s\n",
+                       snd_strerror(err));
+        }
+    }
+
+    if (iPause == PauseState::Dropped)
+    {
+        Drop();
+        Prepare();
+    }
+
+    iTelemetry.Pause((TUint)(MonotonicUs() - aHaltUs),
+                     iPause == PauseState::Paused);
+
+    // Delay queries see the PCM stopped.
+    iDelayStampUs = 0;
+    UpdateDelay();
+}
+
+// Restart the PCM after a pause, before any more audio is queued. A paused
+// PCM plays its queue straight away. A dropped one starts once new audio
+// fills it, and UpdateDelay() notes when if aPlaying.
+void DriverAlsa::Pimpl::Resume(TBool aPlaying)
+{
+    if (iPause == PauseState::None)
+    {
+        return;
+    }
+
+    const TUint64 start = MonotonicUs();
+
+    if (iPause == PauseState::Paused)
+    {
+        auto err = snd_pcm_pause(iHandle, 0);
+
+        // E.g. the device was suspended meanwhile. Start it afresh.
+        if (err < 0)
+        {
+            Log::Print("DriverAlsa: snd_pcm_pause() error : %s\n",
+                       snd_strerror(err));
+
+            Drop();
+            Prepare();
+        }
+    }
+
+    // The DAC's timeline stood still while paused, so continue it from
+    // here rather than stepping back by the pause.
+    iOutputSegment++;
+    iDelayStampUs = 0;
+
+    if (aPlaying)
+    {
+        if (snd_pcm_state(iHandle) == SND_PCM_STATE_RUNNING)
+        {
+            iTelemetry.Resume((TUint)(MonotonicUs() - start));
+        }
+        else
+        {
+            iResumeUs.store(start);
+        }
+    }
+
+    iPause = PauseState::None;
+}
+
+void DriverAlsa::Pimpl::WriteFrames(const TByte* aData, TUint aFrames)
+{
+    // The writer thread copies from the ring into the mmap area.
+    auto writei = (iAccess == SND_PCM_ACCESS_MMAP_INTERLEAVED) ?
+                  snd_pcm_mmap_writei : snd_pcm_writei;
+
+    // The PCM is non-blocking, so each call takes as many frames as fit.
+    while (aFrames > 0)
+    {
+        const auto avail = snd_pcm_avail_update(iHandle);
+
+        StartScheduled(avail, false);
+
+        const TUint64 start   = MonotonicUs();
+        auto          written = writei(iHandle, aData, aFrames);
+
+        if (written >= 0)
+        {
+            iTelemetry.Write((avail > 0) ? (TUint)avail : 0,
+                             (TUint)(MonotonicUs() - start),
+                             (TUint)written);
+            Remember(aData, (TUint)written);
+            iFramesWritten += (TUint)written;
+            UpdateDelay();
+
+            aData      += written * iSampleBytes;
+            aFrames    -= (TUint)written;
+            iBytesSent += (TUint)written * iSampleBytes;
+
+            if (written != 0)
+            {
+                continue;
+            }
+
+            written = -EAGAIN;
+        }
+
+        if (written == -EAGAIN)
+        {
+            if (! WaitDevice())
+            {
+                return;
+            }
+        }
+        else if (! Recover((TInt)written))
+        {
+            Log::Print("DriverAlsa: snd_pcm_writei() got error %s\n",
+                       snd_strerror((int)written));
+            return;
+        }
+    }
+}
+
+#ifdef DEBUG
+void DriverAlsa::Pimpl::LogPCMState()
+{
+    switch (snd_pcm_state(iHandle))
+    {
+        case SND_PCM_STATE_OPEN:
+            Log::Print("PCM STATE: SND_PCM_STATE_OPEN\n");
+            break;
+        case SND_PCM_STATE_SETUP:
+            Log::Print("PCM STATE: SND_PCM_STATE_SETUP\n");
+            break;
+        case SND_PCM_STATE_PREPARED:
+            Log::Print("PCM STATE: SND_PCM_STATE_PREPARED\n");
+            break;
+        case SND_PCM_STATE_RUNNING:
+            Log::Print("PCM STATE: SND_PCM_STATE_RUNNING\n");
+            break;
+        case SND_PCM_STATE_XRUN:
+            Log::Print("PCM STATE: SND_PCM_STATE_XRUN\n");
+            break;
+        case SND_PCM_STATE_DRAINING:
+            Log::Print("PCM STATE: SND_PCM_STATE_DRAINING\n");
+            break;
+        case SND_PCM_STATE_PAUSED:
+            Log::Print("PCM STATE: SND_PCM_STATE_PAUSED\n");
+            break;
+        case SND_PCM_STATE_SUSPENDED:
+            Log::Print("PCM STATE: SND_PCM_STATE_SUSPENDED\n");
+            break;
+        case SND_PCM_STATE_DISCONNECTED:
+            Log::Print("PCM STATE: SND_PCM_STATE_DISCONNECTED\n");
+            break;
+        default:
+            Log::Print("PCM STATE: UNKNOWN\n");
+            break;
+    }
+}
+#endif
+
+void DriverAlsa::Pimpl::ProcessDecodedStream(MsgDecodedStream* aMsg,
+                                             TBool aFlush)
+{
+    auto decodedStreamInfo = aMsg->StreamInfo();
+
+    TakeResampleCost();
+
+    // A seek, skip or stop. Whatever follows doesn't continue the old
+    // audio, even in the same format.
+    if (aFlush && (iProfileIndex != -1))
+    {
+        DiscardRing();
+        Cut();
+
+        if ((iDeviceRate != iStreamSampleRate) || iPullClock)
+        {
+            iResampler.Reset();
+        }
+    }
+
+    // Consecutive tracks, and seeks, usually share a format. Keep the PCM
+    // running so there is no gap in playback.
+    if ((iProfileIndex != -1) && ! iCalibrateRequested.load() &&
+        (decodedStreamInfo.Format()      == iStreamFormat) &&
+        (decodedStreamInfo.BitDepth()    == iStreamBitDepth) &&
+        (decodedStreamInfo.SampleRate()  == iStreamSampleRate) &&
+        (decodedStreamInfo.NumChannels() == iStreamNumChannels) &&
+        (PullClock(decodedStreamInfo)    == iPullClock))
+    {
+        Log::Print("DriverAlsa: Stream format unchanged, PCM left running\n");
+        iTelemetry.FormatChange(false);
+        return;
+    }
+
+    // A fixed output PCM only needs reconfiguring for a different number
+    // of channels.
+    if ((iFixedSampleRate != 0) && (iProfileIndex >= 0) &&
+        (decodedStreamInfo.Format() == AudioFormat::Pcm) &&
+        ! iCalibrateRequested.load() &&
+        (DeviceChannels(decodedStreamInfo.NumChannels()) ==
+         iChannelMatrix.OutChannels()) &&
+        RetargetStream(decodedStreamInfo))
+    {
+        iTelemetry.FormatChange(false);
+        return;
+    }
+
+    const TBool stalled = WaitRingEmpty();
+
+    Resume(false);
+
+    if (iProfileIndex != -1)
+    {
+        // Drain and stop the PCM.
+        if (stalled)
+        {
+            Drop();
+        }
+        else
+        {
+            Drain();
+        }
+    }
+
+    iTelemetry.FormatChange(true);
+
+    // The PCM is idle, so this is the time to calibrate it.
+    if (iCalibrateRequested.exchange(false))
+    {
+        Calibrate();
+        iProfileIndex = -1;
+    }
+
+    Log::Print("DriverAlsa: Bytes Sent since last MsgDecodedStream = %d\n",
+               iBytesSent);
+
+    iBytesSent = 0;
+
+    if (iRingMs != 0)
+    {
+        DriverAlsaRingStats stats;
+
+        GetRingStats(stats);
+
+        Log::Print("DriverAlsa: Ring peak %u of %u bytes, waits: pipeline "
+                   "%u (%ums), writer %u (%ums), device %u (%ums)\n",
+                   stats.iPeakBytes, stats.iCapacityBytes,
+                   stats.iPullerWaits.iCount, stats.iPullerWaits.iTotalMs,
+                   stats.iWriterWaits.iCount, stats.iWriterWaits.iTotalMs,
+                   stats.iDeviceWaits.iCount, stats.iDeviceWaits.iTotalMs);
+    }
+
+#ifdef DEBUG
+    // The conversion path never allocates, so this should only move when
+    // a stream needs a larger buffer than any before it.
+    Log::Print("DriverAlsa: Sample buffer allocations = %u\n", iBufferAllocs);
+#endif // DEBUG
+
+    Log::Print("DriverAlsa: Finding PcmProcessor for stream on %s: "
+               "BitDepth = %d, SampleRate = %d, Channels = %d\n",
+               iDevice.CString(), decodedStreamInfo.BitDepth(), decodedStreamInfo.SampleRate(),
+               decodedStreamInfo.NumChannels());
+
+    AutoMutex am(iSelectionLock);
+
+    iSelection.Replace("");
+    iSelection.AppendPrintf("%u bit, %u Hz, %u channels:",
+                            decodedStreamInfo.BitDepth(),
+                            decodedStreamInfo.SampleRate(),
+                            decodedStreamInfo.NumChannels());
+
+    const TUint bitDepth    = decodedStreamInfo.BitDepth();
+    const TUint sampleRate  = decodedStreamInfo.SampleRate();
+    const TUint numChannels = decodedStreamInfo.NumChannels();
+
+    iStreamFormat = decodedStreamInfo.Format();
+    iPullClock    = PullClock(decodedStreamInfo);
+
+    if (iStreamFormat == AudioFormat::Dsd)
+    {
+        iPcmProcessor.SetResampler(nullptr);
+
+        if (ConfigureDsd(sampleRate, numChannels))
+        {
+            iStreamBitDepth    = bitDepth;
+            iStreamSampleRate  = sampleRate;
+            iStreamNumChannels = numChannels;
+            return;
+        }
+
+        Log::Print("DriverAlsa: Could not play DSD stream! SampleRate = %d, "
+                   "Channels = %d\n", sampleRate, numChannels);
+
+        iSelection.Append(" no DSD mode");
+        iDelay.Clear();
+        iBufferJiffies.store(0);
+
+        iDitch = true;
+        iProfileIndex = -1;
+        return;
+    }
+    const TBool fixed          = (iFixedSampleRate != 0);
+    const TUint outputDepth    = fixed ? iFixedBitDepth : bitDepth;
+    const TUint deviceChannels = DeviceChannels(numChannels);
+    TUint       deviceRate     = fixed ? iFixedSampleRate : sampleRate;
+    TInt        profile        = -1;
+
+    if (deviceChannels == 0)
+    {
+        iSelection.AppendPrintf(" %u channels unsupported;", numChannels);
+    }
+    else if (((deviceRate == sampleRate) && ! iPullClock) ||
+             ConfigureResampler(sampleRate, deviceRate, numChannels))
+    {
+        profile = SelectProfile(outputDepth, deviceChannels, deviceRate);
+    }
+
+    // Otherwise play rates the device lacks at the nearest rate it has.
+    if ((profile == -1) && (deviceChannels != 0) && ! fixed &&
+        iCapsValid && ! iCaps.SupportsRate(sampleRate))
+    {
+        deviceRate = iCaps.ResampleRate(sampleRate);
+
+        if ((deviceRate != 0) &&
+            ConfigureResampler(sampleRate, deviceRate, numChannels))
+        {
+            profile = SelectProfile(outputDepth, deviceChannels, deviceRate);
+        }
+    }
+
+    if (profile != -1)
+    {
+        iProfileIndex = profile;
+
+        auto outputFormat = iProfiles[profile].GetFormat(outputDepth);
+
+        iFormat = outputFormat.first;
+
+        iChannelMap.Negotiate(iHandle, numChannels, deviceChannels);
+        ConfigureChannels(numChannels);
+
+        iPcmProcessor.SetResampler(((deviceRate != sampleRate) || iPullClock)
+                                   ? &iResampler : nullptr);
+
+        iSampleBytes = deviceChannels * outputFormat.second;
+
+        StartOutput(deviceRate);
+
+        iStreamBitDepth    = bitDepth;
+        iStreamSampleRate  = sampleRate;
+        iStreamNumChannels = numChannels;
+        iDeviceRate        = deviceRate;
+
+        iSelection.AppendPrintf(" profile %d (%s)", iProfileIndex,
+                                snd_pcm_format_name(outputFormat.first));
+
+        Log::Print("Found PcmProcessor %d\n", iProfileIndex);
+
+        return;
+    }
+
+    Log::Print("DriverAlsa: Could not find a PcmProcessor for stream! "
+               "BitDepth = %d, SampleRate = %d, Channels = %d\n",
+               bitDepth, sampleRate, numChannels);
+
+    iSelection.Append(" no profile");
+
+    iPcmProcessor.SetResampler(nullptr);
+    iDelay.Clear();
+    iBufferJiffies.store(0);
+
+    iDitch = true;
+    iProfileIndex = -1;
+}
+
+// Play a DSD stream in the first mode the device accepts.
+TBool DriverAlsa::Pimpl::ConfigureDsd(TUint aSampleRate, TUint aNumChannels)
+{
+    if (! iDsd)
+    {
+        iSelection.Append(" DSD disabled;");
+        return false;
+    }
+
+    if (aNumChannels != 2)
+    {
+        iSelection.AppendPrintf(" %u channel DSD unsupported;",
+                                aNumChannels);
+        return false;
+    }
+
+    for (auto& mode : kDsdModes)
+    {
+        const TUint rate = aSampleRate / mode.iRateDivisor;
+
+        if ((aSampleRate % mode.iRateDivisor) != 0)
+        {
+            continue;
+        }
+
+        if (iCapsValid && (! iCaps.SupportsFormat(mode.iFormat) ||
+                           ! iCaps.SupportsRate(rate)))
+        {
+            continue;
+        }
+
+        if (! TryFormat(mode.iFormat, 2, rate, iBufferUs))
+        {
+            continue;
+        }
+
+        iProfileIndex = kProfileDsd;
+        iFormat       = mode.iFormat;
+
+        iDsdProcessor.SetLayout(mode.iLayout);
+        iChannelMatrix.SetIdentity(2);
+        iSampleBytes = 2 * (snd_pcm_format_physical_width(mode.iFormat) / 8);
+
+        StartOutput(rate);
+
+        iDeviceRate = rate;
+
+        iSelection.AppendPrintf(" %s at %u Hz",
+                                DsdPacker::LayoutName(mode.iLayout), rate);
+
+        Log::Print("DriverAlsa: Playing DSD as %s at %u Hz\n",
+                   DsdPacker::LayoutName(mode.iLayout), rate);
+
+        return true;
+    }
+
+    return false;
+}
+
+// Size the buffers and delay reporting for a newly configured PCM.
+void DriverAlsa::Pimpl::StartOutput(TUint aDeviceRate)
+{
+    AllocateSampleBuffer();
+    ConfigureRing(aDeviceRate);
+
+    iDelayPeriodUs = (TUint)(((TUint64)iPeriodFrames * 1000000) /
+                             aDeviceRate);
+    iDelayStampUs  = 0;
+    iFramesWritten = 0;
+    iOutputSegment++;
+    iStartHeld     = false;  // New parameters reset the threshold.
+    iResumeUs.store(0);
+
+    // Followers, which may have stalled, and DSD, which can't be faded,
+    // are dropped at a flush.
+    iHistoryFrames = 0;
+
+    if (! iFollower && (iStreamFormat == AudioFormat::Pcm))
+    {
+        iHistoryFrames = (TUint)iBufferFrames;
+
+        if (iHistoryFrames * iSampleBytes > iHistory.MaxBytes())
+        {
+            iHistory.Grow(iHistoryFrames * iSampleBytes);
+        }
+    }
+    iDelay.Clear();
+
+    // Everything downstream of the pipeline: the ALSA buffer and any ring
+    // in front of it.
+    iBufferJiffies.store(
+        ((TUint)iBufferFrames + (iRing.CapacityBytes() / iSampleBytes)) *
+        Jiffies::PerSample(aDeviceRate));
+
+    iDitch = false;
+}
+
+// A live stream starting while the Songcast receiver runs is the
+// receiver's, whose clock the puller follows. Others, internet radio
+// included, are resampled only where the device needs it, so they stay bit
+// perfect. The choice is made at each stream boundary.
+TBool DriverAlsa::Pimpl::PullClock(const DecodedStreamInfo& aInfo) const
+{
+    return (iClockPuller != nullptr) &&
+           (iResampleQuality != ResamplerQuality::Off) &&
+           (aInfo.Format() == AudioFormat::Pcm) && aInfo.Live() &&
+           iClockPuller->Active();
+}
+
+// Prepare the resampler for a stream, noting it in the selection.
+TBool DriverAlsa::Pimpl::ConfigureResampler(TUint aSampleRate,
+                                            TUint aDeviceRate,
+                                            TUint aNumChannels)
+{
+    if (! iResampler.Configure(aSampleRate, aDeviceRate, aNumChannels,
+                               iResampleQuality, iPullClock))
+    {
+        iSelection.AppendPrintf(" can't resample to %u Hz;", aDeviceRate);
+        return false;
+    }
+
+    iSelection.AppendPrintf(" resampling to %u Hz (%s, %u taps%s):",
+                            aDeviceRate,
+                            Resampler::QualityName(iResampleQuality),
+                            iResampler.Taps(),
+                            iPullClock ? ", clock pulled" : "");
+
+    return true;
+}
+
+// Move a running fixed output PCM on to a new stream. Audio already
+// converted plays out as usual, only the conversion of what follows
+// changes.
+TBool DriverAlsa::Pimpl::RetargetStream(const DecodedStreamInfo& aInfo)
+{
+    const TUint sampleRate  = aInfo.SampleRate();
+    const TUint numChannels = aInfo.NumChannels();
+
+    AutoMutex am(iSelectionLock);
+
+    iSelection.Replace("");
+    iSelection.AppendPrintf("%u bit, %u Hz, %u channels: fixed output,",
+                            aInfo.BitDepth(), sampleRate, numChannels);
+
+    iPullClock = PullClock(aInfo);
+
+    if (((sampleRate != iFixedSampleRate) || iPullClock) &&
+        ! ConfigureResampler(sampleRate, iFixedSampleRate, numChannels))
+    {
+        return false;
+    }
+
+    ConfigureChannels(numChannels);
+
+    iPcmProcessor.SetResampler(((sampleRate != iFixedSampleRate) ||
+                                iPullClock) ? &iResampler : nullptr);
+
+    iStreamBitDepth    = aInfo.BitDepth();
+    iStreamSampleRate  = sampleRate;
+    iStreamNumChannels = numChannels;
+
+    iSelection.AppendPrintf(" profile %d (%s) kept running", iProfileIndex,
+                            snd_pcm_format_name(iFormat));
+
+    Log::Print("DriverAlsa: Fixed output, %u Hz stream played at %u Hz "
+               "with the PCM left running\n", sampleRate, iFixedSampleRate);
+
+    return true;
+}
+
+// Record the cost of the resampling done since the last call.
+void DriverAlsa::Pimpl::TakeResampleCost()
+{
+    TUint frames;
+    TUint us;
+
+    iPcmProcessor.TakeResampleCost(frames, us);
+
+    if (frames != 0)
+    {
+        iTelemetry.Resampled(iStreamSampleRate, frames, us);
+    }
+}
+
+// Configure the PCM with the first usable profile, returning its index or
+// -1 if there is none.
+TInt DriverAlsa::Pimpl::SelectProfile(TUint aBitDepth, TUint aNumChannels,
+                                      TUint aSampleRate)
+{
+    for (TUint i = 0; i < iProfiles.size(); ++i)
+    {
+        if (! ProfileSupported(iProfiles[i], aBitDepth, aNumChannels,
+                               aSampleRate, iSelection))
+        {
+            continue;
+        }
+
+        if (TryProfile(iProfiles[i], aBitDepth, aNumChannels, aSampleRate,
+                       iBufferUs))
+        {
+            return (TInt)i;
+        }
+    }
+
+    return -1;
+}
+
+// Channels to open the PCM with for a stream, 0 if it can't be played.
+//
+// Mono plays badly on the Raspberry Pi and causes issues when switching
+// to a stereo track, so it is played as stereo. Other streams play at
+// their own channel count where the device has it, and are otherwise
+// arranged into the nearest count it has.
+TUint DriverAlsa::Pimpl::DeviceChannels(TUint aNumChannels) const
+{
+    const TUint channels = (aNumChannels == 1) ? 2 : aNumChannels;
+
+    if (aNumChannels > ChannelMatrix::kMaxChannels)
+    {
+        return 0;
+    }
+
+    if (! iCapsValid)
+    {
+        return channels;
+    }
+
+    return iCaps.ChannelsFor(channels, ChannelMatrix::kMaxChannels);
+}
+
+// Arrange a stream's channels for the device's negotiated layout and
+// select the conversion kernels that do it.
+void DriverAlsa::Pimpl::ConfigureChannels(TUint aNumChannels)
+{
+    TInt source[ChannelMatrix::kMaxChannels];
+
+    iChannelMap.Matrix(aNumChannels, iChannelMatrix);
+    iPcmProcessor.SetFormat(LayoutOf(iFormat), iChannelMatrix);
+    UpdateVolume(true);
+
+    iSelection.Append(" to ");
+    iChannelMap.AppendLayout(iSelection);
+
+    if (! iChannelMatrix.IsRoute(source))
+    {
+        iSelection.Append(" mixed");
+    }
+    else if (! iChannelMatrix.IsIdentity())
+    {
+        iSelection.Append(" rearranged");
+    }
+
+    if (iVolume != nullptr)
+    {
+        iSelection.Append(" with digital volume");
+    }
+
+    if ((LayoutOf(iFormat) == SampleLayout::S16Le) &&
+        (iPcmProcessor.Dither() != DitherMode::Off))
+    {
+        iSelection.AppendPrintf(" %s dither",
+                                SampleDither::ModeName(iPcmProcessor.Dither()));
+    }
+
+    iSelection.Append(";");
+}
+
+// Apply the digital volume's settings when they change. A new stream, or
+// layout, takes them at once. Playing streams ramp to them so the change
+// doesn't click.
+void DriverAlsa::Pimpl::UpdateVolume(TBool aForce)
+{
+    if (iVolume == nullptr)
+    {
+        return;
+    }
+
+    const TUint generation = iVolume->VolumeGeneration();
+
+    if (! aForce && (generation == iVolumeGeneration))
+    {
+        return;
+    }
+
+    iVolumeGeneration = generation;
+
+    TFloat volume;
+    TFloat balance;
+    TFloat fade;
+    TFloat gains[ChannelMatrix::kMaxChannels];
+
+    iVolume->ReadVolume(volume, balance, fade);
+    iChannelMap.Gains(volume, balance, fade, gains);
+
+    iPcmProcessor.SetGain(gains, iChannelMap.Channels(),
+                          aForce ? 0 : (iDeviceRate * kVolumeRampMs) / 1000);
+}
+
+// Check a profile against the device capabilities, noting why it can't be
+// used in aReason.
+TBool DriverAlsa::Pimpl::ProfileSupported(Profile& aProfile, TUint aBitDepth,
+                                          TUint aNumChannels,
+                                          TUint aSampleRate,
+                                          Bwx& aReason) const
+{
+    if (! iCapsValid)
+    {
+        return true;
+    }
+
+    auto format = aProfile.GetFormat(aBitDepth).first;
+
+    if (! iCaps.SupportsFormat(format))
+    {
+        aReason.AppendPrintf(" %s unsupported;", snd_pcm_format_name(format));
+        return false;
+    }
+
+    if (! iCaps.SupportsRate(aSampleRate))
+    {
+        aReason.AppendPrintf(" %u Hz unsupported;", aSampleRate);
+        return false;
+    }
+
+    if (! iCaps.SupportsChannels(aNumChannels))
+    {
+        aReason.AppendPrintf(" %u channels unsupported;", aNumChannels);
+        return false;
+    }
+
+    return true;
+}
+
+TBool DriverAlsa::Pimpl::TryProfile(Profile& aProfile, TUint aBitDepth,
+                                    TUint aNumChannels, TUint aSampleRate,
+                                    TUint aBufferUs)
+{
+    auto outputFormat = aProfile.GetFormat(aBitDepth);
+
+    return TryFormat(outputFormat.first, aNumChannels, aSampleRate,
+                     aBufferUs);
+}
+
+TBool DriverAlsa::Pimpl::TryFormat(snd_pcm_format_t aFormat,
+                                   TUint aNumChannels, TUint aSampleRate,
+                                   TUint aBufferUs)
+{
+    // Prefer converting straight into the device buffer. Not every device
+    // or plugin chain supports mmap access, so fall back to read/write.
+    if (iMmap)
+    {
+        auto err = AlsaSetParams(iHandle,
+                                 aFormat,
+                                 SND_PCM_ACCESS_MMAP_INTERLEAVED,
+                                 aNumChannels,
+                                 aSampleRate,
+                                 aBufferUs,
+                                 iPeriodUs);
+        if (err == 0)
+        {
+            iAccess = SND_PCM_ACCESS_MMAP_INTERLEAVED;
+            return true;
+        }
+    }
+
+    auto err = AlsaSetParams(iHandle,
+                             aFormat,
+                             SND_PCM_ACCESS_RW_INTERLEAVED,
+                             aNumChannels,
+                             aSampleRate,
+                             aBufferUs,
+                             iPeriodUs);
+    if (err == 0)
+    {
+        if (iMmap)
+        {
+            Log::Print("DriverAlsa: mmap access unavailable, "
+                       "using RW_INTERLEAVED\n");
+        }
+
+        iAccess = SND_PCM_ACCESS_RW_INTERLEAVED;
+    }
+
+    return err == 0;
+}
+
+// Ensure the sample buffer holds at least one ALSA period in the negotiated
+// format, so the conversion path can write each period without allocating.
+void DriverAlsa::Pimpl::AllocateSampleBuffer()
+{
+    snd_pcm_uframes_t bufferSize;
+    snd_pcm_uframes_t periodSize;
+
+    auto err = snd_pcm_get_params(iHandle, &bufferSize, &periodSize);
+    if (err < 0)
+    {
+        Log::Print("DriverAlsa: snd_pcm_get_params() error : %s\n",
+                   snd_strerror(err));
+        bufferSize = 0;
+        periodSize = 0;
+    }
+
+    iPeriodFrames = periodSize;
+    iBufferFrames = bufferSize;
+
+    TUint bytes = (TUint)periodSize * iSampleBytes;
+
+    if (bytes < kSampleBufSize)
+    {
+        bytes = kSampleBufSize;
+    }
+
+    if (bytes > iSampleBuffer.MaxBytes())
+    {
+        iSampleBuffer.Grow(bytes);
+        iBufferAllocs++;
+    }
+
+    iSampleBuffer.SetBytes(0);
+}
+
+// Snapshot the delay reported by ALSA, with the time it was measured, at
+// most once a period.
+void DriverAlsa::Pimpl::UpdateDelay()
+{
+    const TUint now = (TUint)MonotonicUs();
+
+    if ((iDelayStampUs != 0) && (now - iDelayStampUs < iDelayPeriodUs))
+    {
+        return;
+    }
+
+    iDelayStampUs = now;
+
+    if (snd_pcm_status(iHandle, iStatus) < 0)
+    {
+        return;
+    }
+
+    const auto       delay = snd_pcm_status_get_delay(iStatus);
+    snd_htimestamp_t stamp;
+
+    snd_pcm_status_get_htstamp(iStatus, &stamp);
+
+    // Plugins that don't support timestamps leave them at zero.
+    const TBool stamped = (stamp.tv_sec != 0) || (stamp.tv_nsec != 0);
+    const TUint stampUs = ! stamped ? now :
+                          (TUint)(((TUint64)stamp.tv_sec * 1000000) +
+                                  (stamp.tv_nsec / 1000));
+
+    const TBool running =
+        (snd_pcm_status_get_state(iStatus) == SND_PCM_STATE_RUNNING);
+
+    iDelay.Set((delay > 0) ? (TUint)delay : 0, stampUs, iDeviceRate,
+               running);
+
+    const TUint64 resumeUs = iResumeUs.load();
+
+    // A PCM restarted after a pause is audible from when it triggered.
+    if (running && (resumeUs != 0))
+    {
+        snd_htimestamp_t trigger;
+        TUint64          startedUs = MonotonicUs();
+
+        snd_pcm_status_get_trigger_htstamp(iStatus, &trigger);
+
+        if ((trigger.tv_sec != 0) || (trigger.tv_nsec != 0))
+        {
+            startedUs = ((TUint64)trigger.tv_sec * 1000000) +
+                        (trigger.tv_nsec / 1000);
+        }
+
+        iTelemetry.Resume((startedUs > resumeUs) ?
+                          (TUint)(startedUs - resumeUs) : 0);
+        iResumeUs.store(0);
+    }
+
+    // Only real timestamps measure the DAC's progress.
+    if (! running || ! stamped || (delay < 0) ||
+        ((TUint64)delay > iFramesWritten))
+    {
+        return;
+    }
+
+    const TUint64 played  = iFramesWritten - (TUint64)delay;
+    const TUint64 stampNs = ((TUint64)stamp.tv_sec * 1000000000) +
+                            stamp.tv_nsec;
+
+    if (iClockPuller != nullptr)
+    {
+        iClockPuller->NotifyPlayed(played, stampNs, iDeviceRate);
+    }
+
+    if (iOutputClock != nullptr)
+    {
+        iOutputClock->Played(iOutputSegment, played, stampNs, iDeviceRate);
+    }
+}
+
+TUint DriverAlsa::Pimpl::DriverDelayJiffies(AudioFormat aFormat,
+                                            TUint aSampleRate,
+                                            TUint aNumChannels)
+{
+    if (!aSampleRate) {
+        return 0;
+    }
+
+    if (aFormat == AudioFormat::Dsd)
+    {
+        if (! DsdSupported(aSampleRate, aNumChannels))
+        {
+            THROW(FormatUnsupported);
+        }
+    }
+    // Verify the supplied sample rate is supported, directly or by
+    // resampling.
+    else if (iCapsValid && ! iCaps.SupportsRate(aSampleRate) &&
+        ((iResampleQuality == ResamplerQuality::Off) ||
+         (iCaps.ResampleRate(aSampleRate) == 0)))
+    {
+        THROW(SampleRateUnsupported);
+    }
+
+    TUint delay;
+    TUint stampUs;
+    TUint sampleRate;
+    TBool running;
+
+    if (! iDelay.Get(delay, stampUs, sampleRate, running))
+    {
+        return 0;
+    }
+
+    // Allow for the audio played since the snapshot was taken.
+    if (running)
+    {
+        const TUint elapsedUs = (TUint)MonotonicUs() - stampUs;
+        const TUint played    = (TUint)(((TUint64)elapsedUs * sampleRate) /
+                                        1000000);
+
+        delay = (played < delay) ? (delay - played) : 0;
+    }
+
+    // Audio still queued in the ring plays after everything ALSA holds.
+    if ((iRingMs != 0) && (iSampleBytes != 0))
+    {
+        delay += iRing.OccupancyBytes() / iSampleBytes;
+    }
+
+    return delay * Jiffies::PerSample(sampleRate);
+}
+
+TUint DriverAlsa::Pimpl::BufferJiffies() const
+{
+    return iBufferJiffies.load();
+}
+
+TBool DriverAlsa::Pimpl::SameOutput(const Pimpl& aOther) const
+{
+    return (iProfileIndex != -1) && (aOther.iProfileIndex != -1) &&
+           (iFormat == aOther.iFormat) &&
+           (iSampleBytes == aOther.iSampleBytes) &&
+           (iChannelMatrix == aOther.iChannelMatrix) &&
+           (iDeviceRate == aOther.iDeviceRate);
+}
+
+void DriverAlsa::Pimpl::ClearMirrors()
+{
+    iMirrors.clear();
+    iMirrored = false;
+}
+
+// Only followers, which always have a ring, can be mirrors.
+void DriverAlsa::Pimpl::AddMirror(Pimpl& aMirror)
+{
+    ASSERT(aMirror.iFollower);
+
+    iMirrors.push_back(&aMirror);
+    aMirror.iMirrored = true;
+}
+
+TBool DriverAlsa::Pimpl::Mirrored() const
+{
+    return iMirrored;
+}
+
+
+// DriverAlsa
+
+const TUint DriverAlsa::kSupportedMsgTypes = PipelineElement::MsgType::eMode
+| PipelineElement::MsgType::eDrain
+| PipelineElement::MsgType::eHalt
+| PipelineElement::MsgType::eDecodedStream
+| PipelineElement::MsgType::ePlayable
+| PipelineElement::MsgType::eQuit;
+
+// DriverAlsaInitParams
+
+const TChar* DriverAlsaInitParams::kDeviceDefault = "default";
+
+DriverAlsaInitParams* DriverAlsaInitParams::New()
+{
+    return new DriverAlsaInitParams();
+}
+
+DriverAlsaInitParams::DriverAlsaInitParams()
+    : iBufferUs(kBufferUsDefault)
+    , iMmap(kMmapDefault)
+    , iDirect(kDirectDefault)
+    , iRingMs(kRingMsDefault)
+    , iResampleQuality(kResampleQualityDefault)
+    , iFixedSampleRate(0)
+    , iFixedBitDepth(24)
+    , iDsd(kDsdDefault)
+    , iVolume(nullptr)
+    , iDither(kDitherDefault)
+    , iScheduler(nullptr)
+    , iClockPuller(nullptr)
+    , iOutputClock(nullptr)
+    , iStore(nullptr)
+    , iCalibrate(false)
+{
+}
+
+DriverAlsaInitParams::~DriverAlsaInitParams()
+{
+}
+
+void DriverAlsaInitParams::AddDevice(const TChar* aDevice)
+{
+    iDevices.emplace_back(aDevice);
+}
 
-        if (err < 0)
-        {
-            Log::Print("DriverAlsa: failed to snd_pcm_recover with %s\n",
-                       snd_strerror(err));
-            ASSERTS();
-        }
+void DriverAlsaInitParams::SetBufferUs(TUint aBufferUs)
+{
+    iBufferUs = aBufferUs;
+}
 
-        err = snd_pcm_writei(iHandle,
-                             aData.Ptr(),
-                             aData.Bytes() / iSampleBytes);
-    }
+void DriverAlsaInitParams::SetMmap(TBool aMmap)
+{
+    iMmap = aMmap;
+}
 
+TUint DriverAlsaInitParams::DeviceCount() const
+{
+    return iDevices.empty() ? 1 : (TUint)iDevices.size();
+}
 
-    if (err < 0)
-    {
-        Log::Print("DriverAlsa: snd_pcm_writei() got error %s\n",
-                   snd_strerror(err));
-    }
-    else
+const TChar* DriverAlsaInitParams::Device(TUint aIndex) const
+{
+    if (iDevices.empty())
     {
-        iBytesSent += aData.Bytes();
+        return kDeviceDefault;
     }
+
+    return iDevices[aIndex].c_str();
 }
 
-#ifdef DEBUG
-void DriverAlsa::Pimpl::LogPCMState()
+void DriverAlsaInitParams::SetDirect(TBool aDirect)
 {
-    switch (snd_pcm_state(iHandle))
-    {
-        case SND_PCM_STATE_OPEN:
-            Log::Print("PCM STATE: SND_PCM_STATE_OPEN\n");
-            break;
-        case SND_PCM_STATE_SETUP:
-            Log::Print("PCM STATE: SND_PCM_STATE_SETUP\n");
-            break;
-        case SND_PCM_STATE_PREPARED:
-            Log::Print("PCM STATE: SND_PCM_STATE_PREPARED\n");
-            break;
-        case SND_PCM_STATE_RUNNING:
-            Log::Print("PCM STATE: SND_PCM_STATE_RUNNING\n");
-            break;
-        case SND_PCM_STATE_XRUN:
-            Log::Print("PCM STATE: SND_PCM_STATE_XRUN\n");
-            break;
-        case SND_PCM_STATE_DRAINING:
-            Log::Print("PCM STATE: SND_PCM_STATE_DRAINING\n");
-            break;
-        case SND_PCM_STATE_PAUSED:
-            Log::Print("PCM STATE: SND_PCM_STATE_PAUSED\n");
-            break;
-        case SND_PCM_STATE_SUSPENDED:
-            Log::Print("PCM STATE: SND_PCM_STATE_SUSPENDED\n");
-            break;
-        case SND_PCM_STATE_DISCONNECTED:
-            Log::Print("PCM STATE: SND_PCM_STATE_DISCONNECTED\n");
-            break;
-        default:
-            Log::Print("PCM STATE: UNKNOWN\n");
-            break;
-    }
+    iDirect = aDirect;
 }
-#endif
 
-void DriverAlsa::Pimpl::ProcessDecodedStream(MsgDecodedStream* aMsg)
+TBool DriverAlsaInitParams::Direct() const
 {
-    if (iProfileIndex != -1)
-    {
-        // Drain and stop the PCM.
-        auto err = snd_pcm_drain(iHandle);
-        if (err < 0)
-        {
-            Log::Print("DriverAlsa: snd_pcm_drain() error : %s\n",
-                       snd_strerror(err));
-            ASSERTS();
-        }
-    }
+    return iDirect;
+}
 
-    auto decodedStreamInfo = aMsg->StreamInfo();
+TUint DriverAlsaInitParams::BufferUs() const
+{
+    return iBufferUs;
+}
 
-    Log::Print("DriverAlsa: Bytes Sent since last MsgDecodedStream = %d\n",
-               iBytesSent);
+TBool DriverAlsaInitParams::Mmap() const
+{
+    return iMmap;
+}
 
-    iBytesSent = 0;
+void DriverAlsaInitParams::SetRingMs(TUint aRingMs)
+{
+    iRingMs = aRingMs;
+}
 
-    Log::Print("DriverAlsa: Finding PcmProcessor for stream: BitDepth = %d, "
-               "SampleRate = %d, Channels = %d\n",
-               decodedStreamInfo.BitDepth(), decodedStreamInfo.SampleRate(),
-               decodedStreamInfo.NumChannels());
+TUint DriverAlsaInitParams::RingMs() const
+{
+    return iRingMs;
+}
 
-    // Mono plays badly on the Raspberry Pi and causes issues when
-    // switching to a stereo track.
-    //
-    // So we configure the playback for stereo and duplicate the
-    // channel data.
-    if (decodedStreamInfo.NumChannels() == 1)
-    {
-        iDuplicateChannel = true;
-    }
-    else
-    {
-        iDuplicateChannel = false;
-    }
+void DriverAlsaInitParams::SetResampleQuality(ResamplerQuality aQuality)
+{
+    iResampleQuality = aQuality;
+}
 
-    for (TUint i = 0; i < iProfiles.size(); ++i)
-    {
-        if (TryProfile(iProfiles[i], decodedStreamInfo.BitDepth(),
-                       decodedStreamInfo.NumChannels(),
-                       decodedStreamInfo.SampleRate(), iBufferUs))
-        {
-            iProfileIndex = i;
+ResamplerQuality DriverAlsaInitParams::ResampleQuality() const
+{
+    return iResampleQuality;
+}
 
-            PcmProcessorBase& pcmP =
-                (PcmProcessorBase&)iProfiles[i].GetPcmProcessor();
-            pcmP.SetDuplicateChannel(iDuplicateChannel);
-            pcmP.SetBitDepth(decodedStreamInfo.BitDepth());
+void DriverAlsaInitParams::SetFixedOutput(TUint aSampleRate,
+                                          TUint aBitDepth)
+{
+    ASSERT((aBitDepth == 16) || (aBitDepth == 24));
 
-            iSampleBytes =
-                decodedStreamInfo.NumChannels() *
-                iProfiles[i].GetFormat(decodedStreamInfo.BitDepth()).second;
+    iFixedSampleRate = aSampleRate;
+    iFixedBitDepth   = aBitDepth;
+}
 
-            // If we manually converting mono to stereo the sample size doubles.
-            if (iDuplicateChannel)
-            {
-                iSampleBytes *= 2;
-            }
+TUint DriverAlsaInitParams::FixedSampleRate() const
+{
+    return iFixedSampleRate;
+}
 
-            iDitch = false;
+TUint DriverAlsaInitParams::FixedBitDepth() const
+{
+    return iFixedBitDepth;
+}
 
-            Log::Print("Found PcmProcessor %d\n", iProfileIndex);
+void DriverAlsaInitParams::SetDsd(TBool aDsd)
+{
+    iDsd = aDsd;
+}
 
-            return;
-        }
-    }
+TBool DriverAlsaInitParams::Dsd() const
+{
+    return iDsd;
+}
 
-    Log::Print("DriverAlsa: Could not find a PcmProcessor for stream! "
-               "BitDepth = %d, SampleRate = %d, Channels = %d\n",
-               decodedStreamInfo.BitDepth(), decodedStreamInfo.SampleRate(),
-               decodedStreamInfo.NumChannels());
+void DriverAlsaInitParams::SetVolume(IDriverAlsaVolume& aVolume)
+{
+    iVolume = &aVolume;
+}
 
-    iDitch = true;
-    iProfileIndex = -1;
+IDriverAlsaVolume* DriverAlsaInitParams::Volume() const
+{
+    return iVolume;
 }
 
-TBool DriverAlsa::Pimpl::TryProfile(Profile& aProfile, TUint aBitDepth,
-                                    TUint aNumChannels, TUint aSampleRate,
-                                    TUint aBufferUs)
+void DriverAlsaInitParams::SetDither(DitherMode aMode)
 {
-    auto outputFormat = aProfile.GetFormat(aBitDepth);
+    iDither = aMode;
+}
 
-    if (iDuplicateChannel)
-    {
-        // We are manually converting a mono input to stereo.
-        // Configure the stream for stereo.
-        aNumChannels *= 2;
-    }
+DitherMode DriverAlsaInitParams::Dither() const
+{
+    return iDither;
+}
 
-    auto err = snd_pcm_set_params(iHandle,
-                                  outputFormat.first,
-                                  SND_PCM_ACCESS_RW_INTERLEAVED,
-                                  aNumChannels,
-                                  aSampleRate,
-                                  0,             // no soft-resample
-                                  aBufferUs);
-    return err == 0;
+void DriverAlsaInitParams::SetScheduler(ThreadScheduler& aScheduler)
+{
+    iScheduler = &aScheduler;
 }
 
-TUint DriverAlsa::Pimpl::DriverDelayJiffies(TUint aSampleRate)
+ThreadScheduler* DriverAlsaInitParams::Scheduler() const
 {
-    snd_pcm_sframes_t dp;
-    int ret;
+    return iScheduler;
+}
 
-    if (!aSampleRate) {
-        return 0;
-    }
+void DriverAlsaInitParams::SetClockPuller(ClockPullerAlsa& aClockPuller)
+{
+    iClockPuller = &aClockPuller;
+}
 
-    // Verify the supplied sample rate is supported.
-    snd_pcm_hw_params_t *hwParams;
-    TUint                err;
+ClockPullerAlsa* DriverAlsaInitParams::ClockPuller() const
+{
+    return iClockPuller;
+}
 
-    snd_pcm_hw_params_alloca(&hwParams);
-    err = snd_pcm_hw_params_any(iHandle, hwParams);
-    if (err < 0)
-    {
-        Log::Print("DriverAlsa: Cannot get hardware parameters: %s\n",
-                   snd_strerror(err));
+void DriverAlsaInitParams::SetOutputClock(AlsaOutputClock& aClock)
+{
+    iOutputClock = &aClock;
+}
 
-        THROW(SampleRateUnsupported);
-    }
+AlsaOutputClock* DriverAlsaInitParams::OutputClock() const
+{
+    return iOutputClock;
+}
 
-    if (snd_pcm_hw_params_test_rate(iHandle, hwParams, aSampleRate, 0) < 0)
-    {
-        THROW(SampleRateUnsupported);
-    }
+void DriverAlsaInitParams::SetStore(Configuration::IStoreReadWrite& aStore,
+                                    TBool aCalibrate)
+{
+    iStore     = &aStore;
+    iCalibrate = aCalibrate;
+}
 
-    ret = snd_pcm_delay(iHandle, &dp);
-    if (ret < 0) {
-        Log::Print("DriverAlsa: snd_pcm_delay() error : %s\n",
-                   snd_strerror(ret));
-        return 0;
-    }
+Configuration::IStoreReadWrite* DriverAlsaInitParams::Store() const
+{
+    return iStore;
+}
 
-    Log::Print("DriverAlsa: snd_pcm_delay() : %u\n", dp);
-    return dp * Jiffies::PerSample(aSampleRate);
+TBool DriverAlsaInitParams::Calibrate() const
+{
+    return iCalibrate;
 }
 
 
 // DriverAlsa
 
-const TUint DriverAlsa::kSupportedMsgTypes = PipelineElement::MsgType::eMode
-| PipelineElement::MsgType::eDrain
-| PipelineElement::MsgType::eHalt
-| PipelineElement::MsgType::eDecodedStream
-| PipelineElement::MsgType::ePlayable
-| PipelineElement::MsgType::eQuit;
-
-DriverAlsa::DriverAlsa(IPipeline& aPipeline, TUint aBufferUs)
+DriverAlsa::DriverAlsa(IPipeline& aPipeline, DriverAlsaInitParams* aInitParams)
     : PipelineElement(kSupportedMsgTypes)
-    , iPimpl(new Pimpl("default", aBufferUs))
     , iPipeline(aPipeline)
     , iMutex("alsa")
     , iQuit(false)
+    , iScheduler(aInitParams->Scheduler())
+    , iDecodeScheduled(false)
+    , iStreamValid(false)
+    , iStreamId(0)
+    , iStreamJiffies(0)
+    , iStreamEndJiffies(0)
 {
+    std::unique_ptr<DriverAlsaInitParams> initParams(aInitParams);
+
+    for (TUint i = 0; i < initParams->DeviceCount(); i++)
+    {
+        iPimpls.push_back(new Pimpl(initParams->Device(i), i, *initParams));
+    }
+
     iPipeline.SetAnimator(*this);
 
     iThread = new ThreadFunctor("PipelineAnimator",
@@ -909,11 +3477,22 @@ DriverAlsa::DriverAlsa(IPipeline& aPipeline, TUint aBufferUs)
 DriverAlsa::~DriverAlsa()
 {
     delete iThread;
-    delete iPimpl;
+
+    for (auto pimpl : iPimpls)
+    {
+        delete pimpl;
+    }
 }
 
 void DriverAlsa::AudioThread()
 {
+    if (iScheduler != nullptr)
+    {
+        iScheduler->ApplyToCurrent(ThreadScheduler::Role::Output,
+                                   "PipelineAnimator",
+                                   kPrioritySystemHighest);
+    }
+
     try
     {
         for (;;)
@@ -933,34 +3512,155 @@ void DriverAlsa::AudioThread()
     catch (ThreadKill&) {}
 }
 
+void DriverAlsa::GetRingStats(DriverAlsaRingStats& aStats) const
+{
+    iPimpls[0]->GetRingStats(aStats);
+}
+
+void DriverAlsa::WriteCapabilities(IWriter& aWriter) const
+{
+    for (auto pimpl : iPimpls)
+    {
+        pimpl->WriteCapabilities(aWriter);
+    }
+}
+
+void DriverAlsa::RequestCalibration()
+{
+    for (auto pimpl : iPimpls)
+    {
+        pimpl->RequestCalibration();
+    }
+}
+
+void DriverAlsa::StartAt(TUint64 aMonotonicNs)
+{
+    for (auto pimpl : iPimpls)
+    {
+        pimpl->StartAt(aMonotonicNs);
+    }
+}
+
+void DriverAlsa::WriteStats(IWriter& aWriter) const
+{
+    for (TUint i = 0; i < iPimpls.size(); i++)
+    {
+        if (iPimpls.size() > 1)
+        {
+            Bws<64> line;
+
+            line.AppendPrintf("Device %u:\n", i);
+            aWriter.Write(line);
+        }
+
+        iPimpls[i]->WriteStats(aWriter);
+    }
+}
+
+void DriverAlsa::ResetStats()
+{
+    for (auto pimpl : iPimpls)
+    {
+        pimpl->ResetStats();
+    }
+}
+
+// Link each device to the first earlier one with the same output format,
+// so a stream is converted once per distinct format.
+void DriverAlsa::SetMirrors()
+{
+    for (TUint i = 0; i < iPimpls.size(); i++)
+    {
+        iPimpls[i]->ClearMirrors();
+
+        for (TUint j = 0; j < i; j++)
+        {
+            if (! iPimpls[j]->Mirrored() &&
+                iPimpls[j]->SameOutput(*iPimpls[i]))
+            {
+                iPimpls[j]->AddMirror(*iPimpls[i]);
+                break;
+            }
+        }
+    }
+}
+
+// Whether the audio the devices hold has been left behind, by a seek
+// within the stream (to aNext, if given) or by moving on before the stream
+// reached its end. Such audio is cut short rather than played out.
+// Positions within kFlushToleranceMs of the expected one count as playing
+// on, as track lengths can be estimates. Live streams only ever end.
+TBool DriverAlsa::Flushed(const DecodedStreamInfo* aNext) const
+{
+    if (! iStreamValid)
+    {
+        return false;
+    }
+
+    const TUint64 tolerance =
+        (TUint64)kFlushToleranceMs * (Jiffies::kPerSecond / 1000);
+
+    if ((aNext != nullptr) && (aNext->StreamId() == iStreamId))
+    {
+        const TUint64 start = aNext->SampleStart() *
+                              Jiffies::PerSample(aNext->SampleRate());
+
+        return (start + tolerance < iStreamJiffies) ||
+               (start > iStreamJiffies + tolerance);
+    }
+
+    return (iStreamEndJiffies != 0) &&
+           (iStreamJiffies + tolerance < iStreamEndJiffies);
+}
+
+// Delay, buffering and bit depth are those of the first device, which
+// paces the pipeline.
 TUint DriverAlsa::PipelineAnimatorBufferJiffies() const
 {
-	return 0;
+    return iPimpls[0]->BufferJiffies();
 }
 
 TUint DriverAlsa::PipelineAnimatorDelayJiffies(AudioFormat aFormat,
 											   TUint aSampleRate,
                                                TUint /*aBitDepth*/,
-                                               TUint /*aNumChannels*/) const
+                                               TUint aNumChannels) const
 {
-	if (aFormat == AudioFormat::Dsd) {
-		THROW(FormatUnsupported);
-	}
-    return iPimpl->DriverDelayJiffies(aSampleRate);
+    return iPimpls[0]->DriverDelayJiffies(aFormat, aSampleRate,
+                                          aNumChannels);
 }
 
+// DSD is offered if the first device can play DSD64 one way or another.
 TUint DriverAlsa::PipelineAnimatorDsdBlockSizeWords() const
 {
-	return 0;
+    if (! iPimpls[0]->DsdSupported(kDsd64Rate, 2))
+    {
+        return 0;
+    }
+
+    return DsdPacker::kBlockWords;
 }
 
 TUint DriverAlsa::PipelineAnimatorMaxBitDepth() const
 {
-	return 24;
+    return iPimpls[0]->MaxBitDepth();
 }
 
 Msg* DriverAlsa::ProcessMsg(MsgHalt* aMsg)
 {
+    // After a ramp down, as for a pause or stop, go quiet now rather than
+    // once each device's buffer has played out. Any other halt, e.g. at the
+    // end of a stream, leaves the buffers to play out the last of it. The
+    // devices all play the same audio, so the first speaks for them.
+    const TUint64 halt = MonotonicUs();
+
+    if (iPimpls[0]->EndsQuiet())
+    {
+        for (auto pimpl : iPimpls)
+        {
+            pimpl->Pause(halt);
+        }
+    }
+
     aMsg->ReportHalted();
 
     return aMsg;
@@ -968,18 +3668,53 @@ Msg* DriverAlsa::ProcessMsg(MsgHalt* aMsg)
 
 Msg* DriverAlsa::ProcessMsg(MsgDecodedStream* aMsg)
 {
-    iPimpl->ProcessDecodedStream(aMsg);
+    const DecodedStreamInfo& info  = aMsg->StreamInfo();
+    const TBool              flush = Flushed(&info);
+
+    iStreamValid      = true;
+    iStreamId         = info.StreamId();
+    iStreamJiffies    = info.SampleStart() *
+                        Jiffies::PerSample(info.SampleRate());
+    iStreamEndJiffies = info.Live() ? 0 : info.TrackLength();
+
+    for (auto pimpl : iPimpls)
+    {
+        pimpl->ProcessDecodedStream(aMsg, flush);
+    }
+
+    SetMirrors();
     return aMsg;
 }
 
 Msg* DriverAlsa::ProcessMsg(MsgPlayable* aMsg)
 {
-    iPimpl->ProcessPlayable(aMsg);
+    // Every device restarts before any is fed, as the first device's
+    // conversion also feeds its mirrors.
+    for (auto pimpl : iPimpls)
+    {
+        pimpl->Resume(true);
+    }
+
+    // The first device converts, and may wait for room, before the others.
+    // Reading a MsgPlayable leaves it unchanged, so each device can read it.
+    for (auto pimpl : iPimpls)
+    {
+        pimpl->ProcessPlayable(aMsg);
+    }
+
+    iStreamJiffies += aMsg->Jiffies();
+
     return aMsg;
 }
 
 Msg* DriverAlsa::ProcessMsg(MsgQuit* aMsg)
 {
+    // Don't wait for queued audio to play out.
+    for (auto pimpl : iPimpls)
+    {
+        pimpl->Interrupt();
+    }
+
     AutoMutex am(iMutex);
     iQuit = true;
     return aMsg;
@@ -987,14 +3722,26 @@ Msg* DriverAlsa::ProcessMsg(MsgQuit* aMsg)
 
 Msg* DriverAlsa::ProcessMsg(MsgMode* aMsg)
 {
+    // The pipeline has started its threads by the time a mode reaches it.
+    if ((iScheduler != nullptr) && ! iDecodeScheduled)
+    {
+        iScheduler->ApplyToDecode();
+        iDecodeScheduled = true;
+    }
+
     // TODO
     return aMsg;
 }
 
 Msg* DriverAlsa::ProcessMsg(MsgDrain* aMsg)
 {
+    const TBool flush = Flushed(nullptr);
+
     // Ensure the ALSA audio buffer is emptied.
-    iPimpl->ProcessDrain();
+    for (auto pimpl : iPimpls)
+    {
+        pimpl->ProcessDrain(flush);
+    }
 
     aMsg->ReportDrained();
 
@@ -6,7 +6,18 @@
 #include <OpenHome/Media/Utils/ProcessorAudioUtils.h>
 #include <OpenHome/Private/Thread.h>
 
+#include <string>
+#include <vector>
+
+#include "AlsaOutputClock.h"
+#include "ClockPullerAlsa.h"
+#include "Resampler.h"
+#include "ThreadScheduler.h"
+
 namespace OpenHome {
+namespace Configuration {
+    class IStoreReadWrite;
+}
 namespace Media {
 
 class PriorityArbitratorDriver : public IPriorityArbitrator, private INonCopyable
@@ -23,14 +34,161 @@ private:
 };
 
 
+// Volume applied to PCM by the driver as it converts it, for devices
+// without a hardware mixer. Polled from the pipeline thread, so
+// implementations must not block.
+class IDriverAlsaVolume
+{
+public:
+    // Changes whenever the settings ReadVolume() returns do.
+    virtual TUint VolumeGeneration() const = 0;
+    // aVolume is a linear gain, 1 being unity. aBalance runs from -1 (left
+    // only) to 1 (right only) and aFade from -1 (front only) to 1 (rear
+    // only).
+    virtual void  ReadVolume(TFloat& aVolume, TFloat& aBalance,
+                             TFloat& aFade) const = 0;
+    virtual ~IDriverAlsaVolume() {}
+};
+
+class DriverAlsaInitParams
+{
+public:
+    static DriverAlsaInitParams* New();
+    virtual ~DriverAlsaInitParams();
+    // setters
+    // Add an ALSA device to play to. The first device added paces the
+    // pipeline, each later one mirrors it from its own ring and writer
+    // thread. If none are added "default" is used.
+    void AddDevice(const TChar* aDevice);
+    void SetBufferUs(TUint aBufferUs);
+    void SetMmap(TBool aMmap);  // Try mmap access before read/write access.
+    // Open the hardware behind each device (see AlsaDirectDevice()) with
+    // ALSA's automatic format, rate and channel conversions disabled, for
+    // bit-perfect output without dmix or plug latency.
+    void SetDirect(TBool aDirect);
+    void SetRingMs(TUint aRingMs); // 0 writes to ALSA from the pipeline thread.
+    // Streams at a rate the device lacks are resampled to the nearest rate
+    // it has, at this quality. Off leaves them unplayable.
+    void SetResampleQuality(ResamplerQuality aQuality);
+    // Resample every stream to aSampleRate and play it at aBitDepth (16 or
+    // 24), so the PCM is configured once and keeps running across rate
+    // changes. A rate of 0, the default, follows each stream's format.
+    void SetFixedOutput(TUint aSampleRate, TUint aBitDepth);
+    // Accept DSD streams, playing them as native DSD where the device has
+    // a DSD format and as DoP otherwise. DoP only survives a bit-perfect
+    // path, so leave this off unless the device is opened directly.
+    void SetDsd(TBool aDsd);
+    // Scale PCM by aVolume's settings, ramping to each new one. DSD can't
+    // be scaled and plays unchanged.
+    void SetVolume(IDriverAlsaVolume& aVolume);
+    // Requantise audio narrowed to 16 bits with dither, optionally noise
+    // shaped, rather than truncating it.
+    void SetDither(DitherMode aMode);
+    // Schedule the pipeline animator and ALSA writers as output threads
+    // and, once the pipeline is running, its decode threads, according to
+    // aScheduler. Without one every thread keeps ohNet's scheduling.
+    void SetScheduler(ThreadScheduler& aScheduler);
+    // Report the first device's played audio to aClockPuller and play the
+    // live PCM streams that start while the puller is active through an
+    // adaptive resampler applying its correction. Needs a ResampleQuality
+    // other than Off.
+    void SetClockPuller(ClockPullerAlsa& aClockPuller);
+    // Publish the first device's played audio, with its hardware
+    // timestamps, to aClock for Songcast timestamping.
+    void SetOutputClock(AlsaOutputClock& aClock);
+    // Persist calibrated buffer and period times in aStore. If none are
+    // stored, and no failed calibration either, and aCalibrate is true the
+    // device is calibrated as the driver is constructed. Otherwise
+    // BufferUs() is used.
+    void SetStore(Configuration::IStoreReadWrite& aStore, TBool aCalibrate);
+    // getters
+    TUint DeviceCount() const;
+    const TChar* Device(TUint aIndex) const;
+    TUint BufferUs() const;
+    TBool Mmap() const;
+    TBool Direct() const;
+    TUint RingMs() const;
+    ResamplerQuality ResampleQuality() const;
+    TUint FixedSampleRate() const;
+    TUint FixedBitDepth() const;
+    TBool Dsd() const;
+    IDriverAlsaVolume* Volume() const;
+    DitherMode Dither() const;
+    ThreadScheduler* Scheduler() const;
+    ClockPullerAlsa* ClockPuller() const;
+    AlsaOutputClock* OutputClock() const;
+    Configuration::IStoreReadWrite* Store() const;
+    TBool Calibrate() const;
+private:
+    DriverAlsaInitParams();
+private:
+    static const TUint kBufferUsDefault = 22052;
+    static const TBool kMmapDefault     = true;
+    static const TBool kDirectDefault   = false;
+    static const TUint kRingMsDefault   = 0;
+    static const TBool kDsdDefault      = false;
+    static const DitherMode kDitherDefault = DitherMode::Off;
+    static const ResamplerQuality kResampleQualityDefault =
+        ResamplerQuality::Standard;
+    static const TChar* kDeviceDefault;
+private:
+    std::vector<std::string> iDevices;
+    TUint iBufferUs;
+    TBool iMmap;
+    TBool iDirect;
+    TUint iRingMs;
+    ResamplerQuality iResampleQuality;
+    TUint iFixedSampleRate;
+    TUint iFixedBitDepth;
+    TBool iDsd;
+    IDriverAlsaVolume* iVolume;
+    DitherMode iDither;
+    ThreadScheduler* iScheduler;
+    ClockPullerAlsa* iClockPuller;
+    AlsaOutputClock* iOutputClock;
+    Configuration::IStoreReadWrite* iStore;
+    TBool iCalibrate;
+};
+
+// Time spent blocked at one point in the driver.
+struct DriverAlsaWaitStats
+{
+    TUint iCount;
+    TUint iTotalMs;
+    TUint iMaxUs;
+};
+
+// State of the ring between the pipeline and ALSA writer threads.
+struct DriverAlsaRingStats
+{
+    TUint               iDepthMs;
+    TUint               iCapacityBytes;
+    TUint               iOccupancyBytes;
+    TUint               iPeakBytes;     // Since the last MsgDecodedStream.
+    DriverAlsaWaitStats iPullerWaits;   // Pipeline thread, ring full.
+    DriverAlsaWaitStats iWriterWaits;   // Writer thread, ring empty.
+    DriverAlsaWaitStats iDeviceWaits;   // Writer thread, ALSA buffer full.
+};
+
 class DriverAlsa : public PipelineElement, public IPipelineAnimator, private INonCopyable
 {
     static const TUint kSupportedMsgTypes;
+    static const TUint kFlushToleranceMs = 1000;
 public:
-    DriverAlsa(IPipeline& aPipeline, TUint aBufferUs);
+    DriverAlsa(IPipeline& aPipeline, DriverAlsaInitParams* aInitParams); // takes ownership of aInitParams
     ~DriverAlsa();
 public:
     void AudioThread();
+    void GetRingStats(DriverAlsaRingStats& aStats) const; // First device.
+    // The following cover every device.
+    void WriteCapabilities(IWriter& aWriter) const;
+    void RequestCalibration();  // Runs at the next MsgDecodedStream.
+    // Hold each PCM, once prepared, until CLOCK_MONOTONIC time
+    // aMonotonicNs, filling its buffer with audio meanwhile, then start it.
+    // Applies to the next start, 0 cancels.
+    void StartAt(TUint64 aMonotonicNs);
+    void WriteStats(IWriter& aWriter) const;
+    void ResetStats();          // Ring and device wait times are kept.
 private: // from IMsgProcessor
     Msg* ProcessMsg(MsgMode* aMsg) override;
     Msg* ProcessMsg(MsgDrain* aMsg) override;
@@ -44,12 +202,23 @@ private: // from IPipelineAnimator
 									   TUint aBitDepth, TUint aNumChannels) const override;
     TUint PipelineAnimatorDsdBlockSizeWords() const override;
     TUint PipelineAnimatorMaxBitDepth() const override;
+private:
+    void SetMirrors();
+    TBool Flushed(const DecodedStreamInfo* aNext) const;
 private:
     class Pimpl;
-    Pimpl* iPimpl;
+    std::vector<Pimpl*> iPimpls; // One per device, the first paces playback.
     IPipeline& iPipeline;
     Mutex iMutex;
     TBool iQuit;
+    ThreadScheduler* iScheduler;
+    TBool iDecodeScheduled;  // Decode threads have had their policy.
+    // How far the current stream has played, to tell a seek, skip or stop
+    // from the stream reaching its end.
+    TBool iStreamValid;
+    TUint iStreamId;
+    TUint64 iStreamJiffies;
+    TUint64 iStreamEndJiffies;  // 0 if unknown, as for live streams.
     ThreadFunctor *iThread;
 };
 
@@ -9,6 +9,7 @@
 #include <OpenHome/Av/UpnpAv/UpnpAv.h>
 #include <OpenHome/Media/Debug.h>
 #include <OpenHome/Av/Debug.h>
+#include <OpenHome/Configuration/ConfigManager.h>
 #include <OpenHome/Media/Pipeline/Pipeline.h>
 #include <OpenHome/Media/Utils/AllocatorInfoLogger.h>
 #include <OpenHome/Private/Printer.h>
@@ -39,15 +40,22 @@ using namespace OpenHome::Web;
 // ExampleMediaPlayer
 
 const Brn ExampleMediaPlayer::kIconOpenHomeFileName("OpenHomeIcon");
+const Brn ExampleMediaPlayer::kConfigKeyAlsaDevice("Alsa.Device");
+const Brn ExampleMediaPlayer::kConfigKeyAlsaMixer("Alsa.Mixer");
+const Brn ExampleMediaPlayer::kConfigKeyAlsaDirect("Alsa.Direct");
 
 ExampleMediaPlayer::ExampleMediaPlayer(Net::DvStack& aDvStack,
 									   Net::CpStack& aCpStack,
                                        const Brx& aUdn,
                                        const TChar* aRoom,
                                        const TChar* aProductName,
+                                       const TChar* aMixerCard,
                                        const Brx& aUserAgent)
     : iSemShutdown("TMPS", 0)
     , iDisabled("test", 0)
+    , iVolume(aMixerCard)
+    , iDigitalVolume(NULL)
+    , iClockPuller(NULL)
     , iCpProxy(NULL)
     , iTxTimestamper(NULL)
     , iRxTimestamper(NULL)
@@ -107,9 +115,17 @@ ExampleMediaPlayer::ExampleMediaPlayer(Net::DvStack& aDvStack,
     }
     else
     {
-        Log::Print("Volume Control Unavailable\n");
+        // No mixer, so the driver scales the samples itself.
+        Log::Print("Volume Control Unavailable, using digital volume\n");
+
+        iDigitalVolume = new DigitalVolume(volumeProfile);
+        volumeInit.SetVolume(*iDigitalVolume);
+        volumeInit.SetBalance(*iDigitalVolume);
+        volumeInit.SetFade(*iDigitalVolume);
     }
 
+    iClockPuller = new Media::ClockPullerAlsa();
+
     // Set pipeline thread priority just below the pipeline animator.
     iInitParams = PipelineInitParams::New();
     iInitParams->SetThreadPriorityMax(kPriorityHighest);
@@ -128,6 +144,21 @@ ExampleMediaPlayer::ExampleMediaPlayer(Net::DvStack& aDvStack,
     iMediaPlayer->Pipeline().AddObserver(*iPipelineStateLogger);
 #endif // DEBUG
 
+    // ALSA output settings, applied by MediaPlayerIF at the next start.
+    std::vector<TUint> directChoices;
+    directChoices.push_back(kAlsaDirectOff);
+    directChoices.push_back(kAlsaDirectOn);
+
+    iConfigAlsaDevice = new ConfigText(iMediaPlayer->ConfigInitialiser(),
+                                       kConfigKeyAlsaDevice, 1,
+                                       kMaxAlsaNameBytes, Brn("default"));
+    iConfigAlsaMixer  = new ConfigText(iMediaPlayer->ConfigInitialiser(),
+                                       kConfigKeyAlsaMixer, 0,
+                                       kMaxAlsaNameBytes, Brx::Empty());
+    iConfigAlsaDirect = new ConfigChoice(iMediaPlayer->ConfigInitialiser(),
+                                         kConfigKeyAlsaDirect, directChoices,
+                                         kAlsaDirectOff);
+
     iFnUpdaterStandard = new
         Av::FriendlyNameAttributeUpdater(iMediaPlayer->FriendlyNameObservable(),
 										 iMediaPlayer->ThreadPool(),
@@ -161,7 +192,12 @@ ExampleMediaPlayer::~ExampleMediaPlayer()
 #ifdef DEBUG
     delete iPipelineStateLogger;
 #endif // DEBUG
+    delete iConfigAlsaDevice;
+    delete iConfigAlsaMixer;
+    delete iConfigAlsaDirect;
     delete iMediaPlayer;
+    delete iDigitalVolume;
+    delete iClockPuller;
     delete iInfoLogger;
     delete iShellDebug;
     delete iShell;
@@ -170,6 +206,16 @@ ExampleMediaPlayer::~ExampleMediaPlayer()
     delete iRamStore;
 }
 
+Media::IDriverAlsaVolume* ExampleMediaPlayer::DriverVolume()
+{
+    return iDigitalVolume;
+}
+
+Media::ClockPullerAlsa& ExampleMediaPlayer::ClockPuller()
+{
+    return *iClockPuller;
+}
+
 Environment& ExampleMediaPlayer::Env()
 {
     return iMediaPlayer->Env();
@@ -251,6 +297,11 @@ void ExampleMediaPlayer::RunWithSemaphore(Net::CpStack& aCpStack)
     iSemShutdown.Wait();
 }
 
+Shell& ExampleMediaPlayer::DebugShell()
+{
+    return *iShell;
+}
+
 PipelineManager& ExampleMediaPlayer::Pipeline()
 {
     return iMediaPlayer->Pipeline();
@@ -317,7 +368,7 @@ void ExampleMediaPlayer::RegisterPlugins(Environment& aEnv)
 
     iMediaPlayer->Add(SourceFactory::NewReceiver(
                                   *iMediaPlayer,
-                                   Optional<IClockPuller>(nullptr),
+                                   Optional<IClockPuller>(iClockPuller),
                                    Optional<IOhmTimestamper>(iTxTimestamper),
                                    Optional<IOhmTimestamper>(iRxTimestamper),
                                    Optional<IOhmMsgProcessor>(nullptr)));
@@ -10,6 +10,7 @@
 #include <OpenHome/Web/ConfigUi/FileResourceHandler.h>
 #include <OpenHome/Web/WebAppFramework.h>
 
+#include "ClockPullerAlsa.h"
 #include "Volume.h"
 
 namespace OpenHome {
@@ -30,6 +31,8 @@ namespace Media {
 namespace Configuration {
     class ConfigGTKKeyStore;
     class ConfigManager;
+    class ConfigText;
+    class ConfigChoice;
 }
 namespace Web {
     class ConfigAppMediaPlayer;
@@ -44,14 +47,30 @@ class ExampleMediaPlayer : private Net::IResourceManager
     static const TUint kMaxUiTabs       = 4;
     static const TUint kUiSendQueueSize = kMaxUiTabs * 200;
     static const TUint kShellPort       = 2323;
+public:
+    // ALSA output settings. They are registered with the config manager but
+    // not added to the config app's pages, so are set through the config
+    // store, see GetAlsaConfig() in MediaPlayerIF.cpp. They are read at
+    // start up, so changes apply after a restart.
+    static const Brn   kConfigKeyAlsaDevice; // PCM names, space separated.
+    static const Brn   kConfigKeyAlsaMixer;  // Empty to follow the device.
+    static const Brn   kConfigKeyAlsaDirect;
+    static const TUint kMaxAlsaNameBytes = 256;
+    static const TUint kAlsaDirectOff = 0;
+    static const TUint kAlsaDirectOn  = 1;
 public:
     ExampleMediaPlayer(Net::DvStack& aDvStack, Net::CpStack& aCpStack,
 					   const Brx& aUdn,
                        const TChar* aRoom, const TChar* aProductName,
+                       const TChar* aMixerCard,
                        const Brx& aUserAgent);
     virtual ~ExampleMediaPlayer();
 
     Environment            &Env();
+    // Volume for the driver to apply, or NULL if the card has a mixer.
+    Media::IDriverAlsaVolume *DriverVolume();
+    // Follows the Songcast sender's clock, for the driver to apply.
+    Media::ClockPullerAlsa &ClockPuller();
     void                    StopPipeline();
     TBool                   CanPlay();
     void                    PlayPipeline();
@@ -66,6 +85,7 @@ public:
     Media::PipelineManager &Pipeline();
     Net::DvDeviceStandard  *Device();
     Net::DvDevice          *UpnpAvDevice();
+    OpenHome::Shell        &DebugShell();
 private: // from Net::IResourceManager
     void WriteResource(const Brx& aUriTail, TIpAddress aInterface,
                        std::vector<char*>& aLanguageList,
@@ -96,6 +116,8 @@ protected:
 private:
     Semaphore                  iDisabled;
     Av::VolumeControl          iVolume;
+    Av::DigitalVolume         *iDigitalVolume;
+    Media::ClockPullerAlsa    *iClockPuller;
     ControlPointProxy         *iCpProxy;
     IOhmTimestamper           *iTxTimestamper;
     IOhmTimestamper           *iRxTimestamper;
@@ -107,6 +129,9 @@ private:
     Bws<Uri::kMaxUriBytes+1>   iPresentationUrl;
     Shell* iShell;
     ShellCommandDebug* iShellDebug;
+    Configuration::ConfigText   *iConfigAlsaDevice;
+    Configuration::ConfigText   *iConfigAlsaMixer;
+    Configuration::ConfigChoice *iConfigAlsaDirect;
 };
 
 class ExampleMediaPlayerInit
@@ -10,15 +10,20 @@
 #include <unistd.h>
 
 #include <OpenHome/Net/Private/DviStack.h>
+#include <OpenHome/Private/Converter.h>
 #include <OpenHome/Private/Printer.h>
 #include <OpenHome/Av/Debug.h>
 #include <OpenHome/Media/Debug.h>
 
+#include "AlsaDevices.h"
 #include "ConfigGTKKeyStore.h"
 #include "DriverAlsa.h"
 #include "ExampleMediaPlayer.h"
 #include "OpenHomePlayer.h"
 #include "MediaPlayerIF.h"
+#include "OhmTimestamperAlsa.h"
+#include "ShellCommandAlsa.h"
+#include "ThreadScheduler.h"
 #include "UpdateCheck.h"
 #include "version.h"
 
@@ -37,6 +42,12 @@ static gint                g_tID = 0;
 
 static Media::PriorityArbitratorDriver* g_arbDriver;
 static Media::PriorityArbitratorPipeline* g_arbPipeline;
+static Media::ThreadScheduler* g_scheduler;
+
+// Songcast timestamps from the DAC's timeline, fed by the driver.
+static Media::AlsaOutputClock* g_outputClock;
+static Av::OhmTimestamperAlsa* g_txTimestamper;
+static Av::OhmTimestamperAlsa* g_rxTimestamper;
 
 // Timed callback to initiate application update check.
 static gint tCallback(gpointer data)
@@ -86,6 +97,161 @@ static gint tCallback(gpointer data)
     return true;
 }
 
+// Resolve the ALSA output settings. Command line arguments (--device,
+// --mixer, --direct) take precedence over the config store.
+//
+// The config app doesn't show the ALSA keys. To keep a setting across
+// starts, add it to the [Properties] group of
+// ~/.config/OpenHomePlayer/configStore.conf while the player is stopped.
+// Values are base64 encoded. Alsa.Device and Alsa.Mixer hold the text, so
+// 'Alsa.Device=aHc6MA==' selects hw:0. Alsa.Direct holds a big endian
+// TUint choice, so 'Alsa.Direct=AAAAAQ==' turns direct output on.
+static void GetAlsaConfig(IStoreReadWrite& aStore, const InitArgs& aArgs,
+                          std::vector<std::string>& aDevices,
+                          std::string& aMixer, TBool& aDirect)
+{
+    Bws<ExampleMediaPlayer::kMaxAlsaNameBytes> value;
+
+    aDevices = aArgs.alsaDevices;
+    aMixer   = aArgs.alsaMixer;
+    aDirect  = aArgs.alsaDirect;
+
+    if (aDevices.empty())
+    {
+        try
+        {
+            aStore.Read(ExampleMediaPlayer::kConfigKeyAlsaDevice, value);
+
+            // Several devices are separated by spaces.
+            std::string devices((const char *)value.Ptr(), value.Bytes());
+            size_t      start = 0;
+
+            while (start < devices.size())
+            {
+                size_t end = devices.find(' ', start);
+
+                if (end == std::string::npos)
+                {
+                    end = devices.size();
+                }
+
+                if (end > start)
+                {
+                    aDevices.push_back(devices.substr(start, end - start));
+                }
+
+                start = end + 1;
+            }
+        }
+        catch (StoreReadBufferUndersized)
+        {
+            Log::Print("Error: MediaPlayerIF: 'Alsa.Device' too long\n");
+        }
+        catch (StoreKeyNotFound)
+        {
+        }
+    }
+
+    if (aDevices.empty())
+    {
+        aDevices.push_back("default");
+    }
+
+    if (! aDirect)
+    {
+        Bws<sizeof(TUint)> choice;
+
+        try
+        {
+            aStore.Read(ExampleMediaPlayer::kConfigKeyAlsaDirect, choice);
+
+            aDirect = (choice.Bytes() == sizeof(TUint)) &&
+                      (Converter::BeUint32At(choice, 0) ==
+                       ExampleMediaPlayer::kAlsaDirectOn);
+        }
+        catch (StoreReadBufferUndersized)
+        {
+        }
+        catch (StoreKeyNotFound)
+        {
+        }
+    }
+
+    if (aMixer.empty())
+    {
+        try
+        {
+            aStore.Read(ExampleMediaPlayer::kConfigKeyAlsaMixer, value);
+            aMixer.assign((const char *)value.Ptr(), value.Bytes());
+        }
+        catch (StoreReadBufferUndersized)
+        {
+            Log::Print("Error: MediaPlayerIF: 'Alsa.Mixer' too long\n");
+        }
+        catch (StoreKeyNotFound)
+        {
+        }
+    }
+
+    // Otherwise use the mixer of the card the first device plays to.
+    if (aMixer.empty())
+    {
+        aMixer = AlsaMixerCard(aDirect ? AlsaDirectDevice(aDevices[0])
+                                       : aDevices[0]);
+    }
+}
+
+// Map a --resample argument to a quality, the default if empty or unknown.
+static ResamplerQuality GetResampleQuality(const std::string& aName)
+{
+    if (aName == "off")
+    {
+        return ResamplerQuality::Off;
+    }
+    if (aName == "fast")
+    {
+        return ResamplerQuality::Fast;
+    }
+    if (aName == "high")
+    {
+        return ResamplerQuality::High;
+    }
+
+    if (! aName.empty() && (aName != "standard"))
+    {
+        Log::Print("MediaPlayerIF: Unknown resample quality '%s'\n",
+                   aName.c_str());
+    }
+
+    return ResamplerQuality::Standard;
+}
+
+// Map a --dither argument to a mode, off if empty or unknown.
+static DitherMode GetDitherMode(const std::string& aName)
+{
+    static const DitherMode modes[] =
+    {
+        DitherMode::Tpdf, DitherMode::FirstOrder, DitherMode::SecondOrder,
+        DitherMode::Weighted
+    };
+
+    for (auto mode : modes)
+    {
+        if (aName == SampleDither::ModeName(mode))
+        {
+            return mode;
+        }
+    }
+
+    if (! aName.empty() && (aName != "off"))
+    {
+        Log::Print("MediaPlayerIF: Unknown dither mode '%s'\n",
+                   aName.c_str());
+    }
+
+    return DitherMode::Off;
+}
+
 // Media Player thread entry point.
 void InitAndRunMediaPlayer(gpointer args)
 {
@@ -106,10 +272,14 @@ void InitAndRunMediaPlayer(gpointer args)
     Net::CpStack   *cpStack = NULL;
     Net::DvStack   *dvStack = NULL;
     DriverAlsa     *driver  = NULL;
+    ShellCommandAlsa *shellAlsa = NULL;
     Bws<512>        roomStore;
     Bws<512>        nameStore;
     const TChar    *productRoom = room;
     const TChar    *productName = name;
+    std::vector<std::string> alsaDevices;
+    std::string     alsaMixer;
+    TBool           alsaDirect  = false;
 
     Debug::SetLevel(Debug::kPipeline);
     Debug::SetLevel(Debug::kSongcast);
@@ -131,6 +301,27 @@ void InitAndRunMediaPlayer(gpointer args)
     g_arbPipeline = new Media::PriorityArbitratorPipeline(kPrioritySystemHighest-1);
     priorityArbitrator.Add(*g_arbPipeline);
 
+    // Real-time scheduling and CPU pinning of the audio threads, applied
+    // by the driver as they start.
+    g_scheduler = new Media::ThreadScheduler();
+    g_scheduler->SetRtPriority(iArgs->rtPriority);
+
+    if (! iArgs->outputCpus.empty())
+    {
+        g_scheduler->SetCpus(Media::ThreadScheduler::Role::Output,
+                             iArgs->outputCpus.c_str());
+    }
+
+    if (! iArgs->decodeCpus.empty())
+    {
+        g_scheduler->SetCpus(Media::ThreadScheduler::Role::Decode,
+                             iArgs->decodeCpus.c_str());
+    }
+
+    g_outputClock   = new Media::AlsaOutputClock();
+    g_txTimestamper = new Av::OhmTimestamperAlsa(*g_outputClock);
+    g_rxTimestamper = new Av::OhmTimestamperAlsa(*g_outputClock);
+
     // Get the current network adapter.
     adapter = g_lib->CurrentSubnetAdapter(cookie);
     if (adapter == NULL)
@@ -181,22 +372,91 @@ void InitAndRunMediaPlayer(gpointer args)
         configStore->Write(Brn("Product.Name"), Brn(productName));
     }
 
+    // Select the ALSA devices to play to and the mixer to control.
+    GetAlsaConfig(*configStore, *iArgs, alsaDevices, alsaMixer, alsaDirect);
+
+    for (auto& device : alsaDevices)
+    {
+        Log::Print("MediaPlayerIF: ALSA device '%s'%s\n", device.c_str(),
+                   alsaDirect ? " (direct)" : "");
+    }
+
+    Log::Print("MediaPlayerIF: ALSA mixer '%s'\n", alsaMixer.c_str());
+
     // Create the ExampleMediaPlayer instance.
     g_emp = new ExampleMediaPlayer(*dvStack, *cpStack, Brn(udn), productRoom, productName,
+                                   alsaMixer.c_str(),
                                    Brx::Empty()/*aUserAgent*/);
 
-    // Add the audio driver to the pipeline.
+    // Before the Songcast receiver is created, when the player runs.
+    g_emp->SetSongcastTimestampers(*g_txTimestamper, *g_rxTimestamper);
+
+    // Add the audio driver to the pipeline, playing to the devices
+    // selected above.
+    //
+    // The buffer and period times are calibrated for the device on first
+    // use, as the driver is created, and kept in the config store. The
+    // 22052us value, which gets things going for the Hifiberry Digi+ card,
+    // is the fallback should calibration fail. A failure is kept too;
+    // "alsa calibrate" from the shell tries again.
+    //
+    // Samples are converted straight into the device's mmap buffer where
+    // the device supports it. A 100ms ring between the pipeline and a
+    // dedicated ALSA writer thread absorbs decode and network jitter.
     //
-    // The 22052ms value a is a bit of a magic number which get's
-    // things going for the Hifiberry Digi+ card.
+    // Streams at rates the device lacks are resampled. With --fixed-rate
+    // every stream is, so the device is never reconfigured between tracks.
     //
-    // FIXME This should be calculated.
-    driver = new DriverAlsa(g_emp->Pipeline(), 22052);
+    // Cards without a mixer get their volume applied by the driver.
+    // --dither requantises audio the device takes as 16 bit.
+    //
+    // The output and decode threads run SCHED_FIFO where permitted, see
+    // --rt-priority, --output-cpus and --decode-cpus.
+    //
+    // The first device's hardware timestamps drive the Songcast receiver's
+    // clock puller and timestampers.
+    {
+        DriverAlsaInitParams *driverParams = DriverAlsaInitParams::New();
+
+        for (auto& device : alsaDevices)
+        {
+            driverParams->AddDevice(device.c_str());
+        }
+
+        driverParams->SetDirect(alsaDirect);
+        driverParams->SetDsd(alsaDirect || iArgs->alsaDsd);
+        driverParams->SetResampleQuality(GetResampleQuality(iArgs->alsaResample));
+        driverParams->SetDither(GetDitherMode(iArgs->alsaDither));
+        driverParams->SetScheduler(*g_scheduler);
+        driverParams->SetClockPuller(g_emp->ClockPuller());
+        driverParams->SetOutputClock(*g_outputClock);
+
+        if (iArgs->alsaFixedRate != 0)
+        {
+            driverParams->SetFixedOutput(iArgs->alsaFixedRate,
+                                         iArgs->alsaFixedDepth);
+        }
+
+        driverParams->SetBufferUs(22052);
+        driverParams->SetMmap(true);
+        driverParams->SetRingMs(100);
+        driverParams->SetStore(*configStore, true);
+
+        if (g_emp->DriverVolume() != NULL)
+        {
+            driverParams->SetVolume(*g_emp->DriverVolume());
+        }
+
+        driver = new DriverAlsa(g_emp->Pipeline(), driverParams);
+    }
     if (driver == NULL)
     {
         goto cleanup;
     }
 
+    // Add the 'alsa' debug shell command.
+    shellAlsa = new ShellCommandAlsa(g_emp->DebugShell(), *driver);
+
     // Create the timeout for update checking.
     if (restarted)
     {
@@ -233,6 +493,11 @@ cleanup:
         g_tID = 0;
     }
 
+    if (shellAlsa != NULL)
+    {
+        delete shellAlsa;
+    }
+
     if (driver != NULL)
     {
         delete driver;
@@ -250,6 +515,10 @@ cleanup:
 
     delete g_arbDriver;
     delete g_arbPipeline;
+    delete g_scheduler;
+    delete g_txTimestamper;
+    delete g_rxTimestamper;
+    delete g_outputClock;
 
     // Terminate the thread.
     g_thread_exit(NULL);
@@ -19,6 +19,28 @@ typedef struct InitArgsStruct
 
     TIpAddress      subnet;              // Requested subnet
     OpenHome::TBool restarted;           // Has the MediaPlayer been restarted.
+
+    // ALSA output from the command line. Empty values, and alsaDirect when
+    // false, fall back to the config store.
+    std::vector<std::string> alsaDevices;
+    std::string              alsaMixer;
+    OpenHome::TBool          alsaDirect;
+
+    // Resampling. alsaFixedRate 0 follows each stream's rate.
+    std::string              alsaResample;     // Quality, empty for default.
+    OpenHome::TUint          alsaFixedRate;
+    OpenHome::TUint          alsaFixedDepth;
+
+    // Play DSD streams natively or as DoP. Implied by alsaDirect.
+    OpenHome::TBool          alsaDsd;
+
+    // Requantisation of audio narrowed to 16 bits, empty for default.
+    std::string              alsaDither;
+
+    // Scheduling of the audio threads. Empty CPU lists leave them unpinned.
+    OpenHome::TUint          rtPriority;       // 0 for SCHED_OTHER.
+    std::string              outputCpus;
+    std::string              decodeCpus;
 } InitArgs;
 
 void InitAndRunMediaPlayer(gpointer args);
@@ -0,0 +1,75 @@
+#include "OhmTimestamperAlsa.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Av;
+using namespace OpenHome::Media;
+
+static const TUint64 kNsPerSecond        = 1000000000;
+static const TUint   kMediaClockMultiple = 256;
+
+OhmTimestamperAlsa::OhmTimestamperAlsa(const AlsaOutputClock& aClock)
+    : iClock(aClock)
+    , iMediaClock(MediaClock(44100))
+{
+}
+
+// The pipeline's 44.1kHz family rates, 7350Hz up, are all multiples of
+// 3675, and its 48kHz family rates, 8000Hz up, all multiples of 4000. A
+// rate that is a multiple of both (588000Hz, say) belongs to neither.
+TUint OhmTimestamperAlsa::MediaClock(TUint aSampleRate)
+{
+    if (aSampleRate == 0)
+    {
+        return 0;
+    }
+
+    const TBool family44k = (aSampleRate % 3675 == 0);
+    const TBool family48k = (aSampleRate % 4000 == 0);
+
+    if (family44k && ! family48k)
+    {
+        return 44100 * kMediaClockMultiple;
+    }
+
+    if (family48k && ! family44k)
+    {
+        return 48000 * kMediaClockMultiple;
+    }
+
+    return 0;
+}
+
+// Split, so the product can't overflow however long the host has run.
+TUint OhmTimestamperAlsa::Ticks(TUint64 aNs, TUint aMediaClock)
+{
+    return (TUint)(((aNs / kNsPerSecond) * aMediaClock) +
+                   (((aNs % kNsPerSecond) * aMediaClock) / kNsPerSecond));
+}
+
+TUint OhmTimestamperAlsa::Timestamp(TUint /*aFrame*/)
+{
+    return Ticks(iClock.TimeAt(AlsaOutputClock::MonotonicNs()),
+                 iMediaClock.load(std::memory_order_relaxed));
+}
+
+TBool OhmTimestamperAlsa::SetSampleRate(TUint aSampleRate)
+{
+    const TUint mediaClock = MediaClock(aSampleRate);
+
+    if (mediaClock == 0)
+    {
+        return false;
+    }
+
+    iMediaClock.store(mediaClock, std::memory_order_relaxed);
+    return true;
+}
+
+// The DAC's timeline runs whether or not a session does.
+void OhmTimestamperAlsa::Start(const Endpoint& /*aDst*/)
+{
+}
+
+void OhmTimestamperAlsa::Stop()
+{
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <OpenHome/Av/Songcast/OhmTimestamp.h>
+#include <OpenHome/Types.h>
+
+#include <atomic>
+
+#include "AlsaOutputClock.h"
+
+// Songcast timestamps from the DAC's timeline (see AlsaOutputClock).
+//
+// Songcast timestamps count a media clock of 256 times the base rate of
+// the stream's family, 44.1kHz or 48kHz, and wrap at 32 bits.
+//
+// OhmTimestamperAlsa stamps each audio frame with the DAC's time as it is
+// handed over, without taking a lock.
+
+namespace OpenHome {
+namespace Av {
+
+class OhmTimestamperAlsa : public IOhmTimestamper
+{
+public:
+    OhmTimestamperAlsa(const Media::AlsaOutputClock& aClock);
+    // Media clock ticks for aSampleRate, 0 for a rate outside both
+    // families.
+    static TUint   MediaClock(TUint aSampleRate);
+    static TUint   Ticks(TUint64 aNs, TUint aMediaClock);
+public: // from IOhmTimestamper
+    TUint Timestamp(TUint aFrame) override;
+    TBool SetSampleRate(TUint aSampleRate) override;
+    void  Start(const Endpoint& aDst) override;
+    void  Stop() override;
+private:
+    const Media::AlsaOutputClock& iClock;
+    std::atomic<TUint>            iMediaClock;
+};
+
+} // namespace Av
+} // namespace OpenHome
@@ -9,10 +9,13 @@
 #include <glib.h>
 #endif // USE_GTK
 #include <gio/gio.h>
+#include <getopt.h>
 #include <vector>
 
+#include "AlsaDevices.h"
 #include "CustomMessages.h"
 #include "MediaPlayerIF.h"
+#include "ThreadScheduler.h"
 #include "version.h"
 
 #ifdef DEBUG
@@ -442,26 +445,162 @@ gboolean updatesAvailable(gpointer data)
     return false;
 }
 
+// Print the playback devices ALSA knows of, for --list-devices.
+static void listAlsaDevices()
+{
+    std::vector<OpenHome::Media::AlsaDeviceHint> devices;
+
+    OpenHome::Media::AlsaListDevices(devices);
+
+    for (auto& device : devices)
+    {
+        printf("%s\n", device.iName.c_str());
+
+        // Descriptions may span lines, indent each one.
+        std::string line;
+
+        for (auto c : device.iDescription + "\n")
+        {
+            if (c == '\n')
+            {
+                printf("    %s\n", line.c_str());
+                line.clear();
+            }
+            else
+            {
+                line += c;
+            }
+        }
+    }
+}
+
 int main(int argc, char **argv)
 {
-    const gchar* usage = "openhome-player [subnet address]";
+    const gchar* usage =
+        "openhome-player [--device <pcm>]... [--mixer <card>] [--direct]\n"
+        "                [--resample <quality>] [--fixed-rate <Hz>]\n"
+        "                [--fixed-depth <bits>] [--dsd] [--dither <mode>]\n"
+        "                [--rt-priority <n>] [--output-cpus <list>]\n"
+        "                [--decode-cpus <list>] [--list-devices]\n"
+        "                [subnet address]\n"
+        "\n"
+        "  --device <pcm>       ALSA device to play to. Repeat to play to\n"
+        "                       several devices, the first sets the pace.\n"
+        "  --mixer <card>       ALSA mixer for volume control.\n"
+        "  --direct             Bit-perfect output straight to the hardware.\n"
+        "  --resample <quality> Resampler quality: fast, standard (default),\n"
+        "                       high or off.\n"
+        "  --fixed-rate <Hz>    Resample everything to one rate so the device\n"
+        "                       is never reconfigured between tracks.\n"
+        "  --fixed-depth <bits> Bit depth with --fixed-rate, 16 or 24\n"
+        "                       (default).\n"
+        "  --dsd                Play DSD natively or as DoP. Implied by\n"
+        "                       --direct.\n"
+        "  --dither <mode>      Requantise audio narrowed to 16 bits: off\n"
+        "                       (default), tpdf, shaped1, shaped2 or\n"
+        "                       weighted.\n"
+        "  --rt-priority <n>    SCHED_FIFO priority of the output threads,\n"
+        "                       decode threads running 10 lower. 0 leaves\n"
+        "                       them SCHED_OTHER. Default 70.\n"
+        "  --output-cpus <list> Cores for the output threads, as in 2,3 or\n"
+        "                       2-3.\n"
+        "  --decode-cpus <list> Cores for the decode threads.\n"
+        "  --list-devices       List ALSA playback devices and exit.";
+
+    static const struct option options[] =
+    {
+        {"device",       required_argument, NULL, 'd'},
+        {"mixer",        required_argument, NULL, 'm'},
+        {"direct",       no_argument,       NULL, 'D'},
+        {"resample",     required_argument, NULL, 'r'},
+        {"fixed-rate",   required_argument, NULL, 'f'},
+        {"fixed-depth",  required_argument, NULL, 'b'},
+        {"dsd",          no_argument,       NULL, 'S'},
+        {"dither",       required_argument, NULL, 't'},
+        {"rt-priority",  required_argument, NULL, 'p'},
+        {"output-cpus",  required_argument, NULL, 'o'},
+        {"decode-cpus",  required_argument, NULL, 'c'},
+        {"list-devices", no_argument,       NULL, 'l'},
+        {NULL,           0,                 NULL, 0}
+    };
+
+    g_mPlayerArgs.restarted      = false;
+    g_mPlayerArgs.subnet         = InitArgs::NO_SUBNET;
+    g_mPlayerArgs.alsaDirect     = false;
+    g_mPlayerArgs.alsaFixedRate  = 0;
+    g_mPlayerArgs.alsaFixedDepth = 24;
+    g_mPlayerArgs.alsaDsd        = false;
+    g_mPlayerArgs.rtPriority     =
+        OpenHome::Media::ThreadScheduler::kRtPriorityDefault;
+
+    int option;
+
+    while ((option = getopt_long(argc, argv, "", options, NULL)) != -1)
+    {
+        switch (option)
+        {
+            case 'd':
+                g_mPlayerArgs.alsaDevices.push_back(optarg);
+                break;
+            case 'm':
+                g_mPlayerArgs.alsaMixer = optarg;
+                break;
+            case 'D':
+                g_mPlayerArgs.alsaDirect = true;
+                break;
+            case 'r':
+                g_mPlayerArgs.alsaResample = optarg;
+                break;
+            case 'f':
+                g_mPlayerArgs.alsaFixedRate = (guint)strtoul(optarg, NULL, 10);
+                break;
+            case 'b':
+                g_mPlayerArgs.alsaFixedDepth = (guint)strtoul(optarg, NULL, 10);
+
+                if ((g_mPlayerArgs.alsaFixedDepth != 16) &&
+                    (g_mPlayerArgs.alsaFixedDepth != 24))
+                {
+                    fprintf(stderr, "%s\n", usage);
+                    exit(1);
+                }
+                break;
+            case 'S':
+                g_mPlayerArgs.alsaDsd = true;
+                break;
+            case 't':
+                g_mPlayerArgs.alsaDither = optarg;
+                break;
+            case 'p':
+                g_mPlayerArgs.rtPriority = (guint)strtoul(optarg, NULL, 10);
+                break;
+            case 'o':
+                g_mPlayerArgs.outputCpus = optarg;
+                break;
+            case 'c':
+                g_mPlayerArgs.decodeCpus = optarg;
+                break;
+            case 'l':
+                listAlsaDevices();
+                exit(0);
+            default:
+                fprintf(stderr, "%s\n", usage);
+                exit(1);
+        }
+    }
 
     // Verify command line options.
-    if (argc > 2)
+    if (argc - optind > 1)
     {
         fprintf(stderr, "%s\n", usage);
         exit(1);
     }
 
-    g_mPlayerArgs.restarted = false;
-    g_mPlayerArgs.subnet    = InitArgs::NO_SUBNET;
-
     // Validate the format of any supplied subnet.
-    if (argc == 2)
+    if (argc - optind == 1)
     {
         guint byte1, byte2, byte3, byte4 = 0;
 
-        if (sscanf(argv[1], "%u.%u.%u.%u", &byte1, &byte2, &byte3, &byte4) == 4)
+        if (sscanf(argv[optind], "%u.%u.%u.%u", &byte1, &byte2, &byte3, &byte4) == 4)
         {
             if ((byte1 > 0xFF) || (byte2 > 0xFF) ||
                 (byte3 > 0xFF) || (byte4 > 0xFF))
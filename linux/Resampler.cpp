@@ -0,0 +1,578 @@
+#include <OpenHome/Private/Standard.h>
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "Resampler.h"
+#include "SampleConvert.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// Dot product kernels
+//
+// Coefficients and history are both contiguous, so these are plain dot
+// products over a multiple of 8 floats. The x86 kernels are compiled for
+// their target regardless of the build flags and only called once the CPU
+// has been checked, as for the sample conversion kernels.
+
+static TFloat ResamplerDotScalar(const TFloat* aA, const TFloat* aB,
+                                 TUint aCount)
+{
+    // Four partial sums keep the compiler free to pipeline the adds.
+    TFloat sum0 = 0;
+    TFloat sum1 = 0;
+    TFloat sum2 = 0;
+    TFloat sum3 = 0;
+
+    for (TUint i = 0; i < aCount; i += 4)
+    {
+        sum0 += aA[i]     * aB[i];
+        sum1 += aA[i + 1] * aB[i + 1];
+        sum2 += aA[i + 2] * aB[i + 2];
+        sum3 += aA[i + 3] * aB[i + 3];
+    }
+
+    return (sum0 + sum1) + (sum2 + sum3);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse")))
+TFloat OpenHome::Media::ResamplerDotSse(const TFloat* aA, const TFloat* aB,
+                                        TUint aCount)
+{
+    __m128 sum0 = _mm_setzero_ps();
+    __m128 sum1 = _mm_setzero_ps();
+
+    for (TUint i = 0; i < aCount; i += 8)
+    {
+        sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(aA + i),
+                                           _mm_loadu_ps(aB + i)));
+        sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(aA + i + 4),
+                                           _mm_loadu_ps(aB + i + 4)));
+    }
+
+    TFloat lanes[4];
+
+    _mm_storeu_ps(lanes, _mm_add_ps(sum0, sum1));
+
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+// Multiply and add are kept separate as AVX2 doesn't imply FMA.
+__attribute__((target("avx2")))
+TFloat OpenHome::Media::ResamplerDotAvx2(const TFloat* aA, const TFloat* aB,
+                                         TUint aCount)
+{
+    __m256 sum = _mm256_setzero_ps();
+
+    for (TUint i = 0; i < aCount; i += 8)
+    {
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(aA + i),
+                                               _mm256_loadu_ps(aB + i)));
+    }
+
+    const __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum),
+                                   _mm256_extractf128_ps(sum, 1));
+    TFloat       lanes[4];
+
+    _mm_storeu_ps(lanes, half);
+
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+#endif // __x86_64__ || __i386__
+
+static ResamplerDotKernel SelectDotKernel()
+{
+    switch (SampleConverter::SelectedIsa())
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        case SampleConverter::Isa::Avx2:
+            return ResamplerDotAvx2;
+        case SampleConverter::Isa::Ssse3:
+            return ResamplerDotSse;
+#endif // __x86_64__ || __i386__
+#if defined(__arm__) || defined(__aarch64__)
+        case SampleConverter::Isa::Neon:
+            return ResamplerDotNeon;
+#endif // __arm__ || __aarch64__
+        default:
+            return ResamplerDotScalar;
+    }
+}
+
+
+// Filter design
+
+static const double kPi = 3.14159265358979323846;
+
+static TUint Gcd(TUint aA, TUint aB)
+{
+    while (aB != 0)
+    {
+        const TUint r = aA % aB;
+
+        aA = aB;
+        aB = r;
+    }
+
+    return aA;
+}
+
+// Zeroth order modified Bessel function of the first kind, by its power
+// series.
+static double BesselI0(double aX)
+{
+    const double q    = (aX * aX) / 4.0;
+    double       sum  = 1.0;
+    double       term = 1.0;
+
+    for (TUint k = 1; k < 64; k++)
+    {
+        term *= q / ((double)k * (double)k);
+        sum  += term;
+
+        if (term < sum * 1e-17)
+        {
+            break;
+        }
+    }
+
+    return sum;
+}
+
+struct QualityParams
+{
+    TUint  iTaps;
+    double iBeta;     // Kaiser window shape.
+    double iRolloff;  // Cutoff as a fraction of the lower Nyquist.
+};
+
+static QualityParams GetQualityParams(ResamplerQuality aQuality)
+{
+    switch (aQuality)
+    {
+        case ResamplerQuality::Fast:
+            return { 16, 5.7, 0.85 };
+        case ResamplerQuality::High:
+            return { 64, 12.3, 0.94 };
+        default:
+            return { 32, 8.6, 0.90 };
+    }
+}
+
+
+// Resampler
+
+Resampler::Resampler()
+: iInRate(0)
+, iOutRate(0)
+, iChannels(0)
+, iL(1)
+, iM(1)
+, iTaps(0)
+, iQuality(ResamplerQuality::Off)
+, iAdaptive(false)
+, iCapacity(0)
+, iFill(0)
+, iPos(0)
+, iPhase(0)
+, iFrac(0)
+, iStep(0)
+, iDrift(0)
+, iDot(SelectDotKernel())
+{
+}
+
+const TChar* Resampler::QualityName(ResamplerQuality aQuality)
+{
+    switch (aQuality)
+    {
+        case ResamplerQuality::Off:
+            return "off";
+        case ResamplerQuality::Fast:
+            return "fast";
+        case ResamplerQuality::Standard:
+            return "standard";
+        case ResamplerQuality::High:
+            return "high";
+    }
+
+    return "unknown";
+}
+
+TBool Resampler::Configure(TUint aInRate, TUint aOutRate, TUint aChannels,
+                           ResamplerQuality aQuality, TBool aAdaptive)
+{
+    if ((aInRate == 0) || (aOutRate == 0) || (aChannels == 0) ||
+        (aChannels > kMaxChannels) || (aQuality == ResamplerQuality::Off))
+    {
+        return false;
+    }
+
+    const TUint gcd = Gcd(aInRate, aOutRate);
+    const TUint l   = aAdaptive ? kAdaptivePhases : aOutRate / gcd;
+    const TUint m   = aAdaptive ? 0 : aInRate / gcd;
+
+    if (l > kMaxPhases)
+    {
+        return false;
+    }
+
+    const QualityParams q = GetQualityParams(aQuality);
+
+    // When reducing the rate the cutoff falls with the ratio, so the filter
+    // must span proportionally more input samples for the same transition
+    // band. Round up to the kernels' multiple of 8.
+    TUint taps = q.iTaps;
+
+    if (aInRate > aOutRate)
+    {
+        taps = (TUint)ceil(((double)q.iTaps * aInRate) / aOutRate);
+        taps = (taps + 7) & ~7u;
+    }
+
+    // Allocate only if the shape changes, so a gapless run of streams at
+    // the same rates reuses everything.
+    const TBool same = (aInRate  == iInRate)  && (aOutRate == iOutRate) &&
+                       (aChannels == iChannels) && (aQuality == iQuality) &&
+                       (aAdaptive == iAdaptive);
+
+    iInRate   = aInRate;
+    iOutRate  = aOutRate;
+    iChannels = aChannels;
+    iL        = l;
+    iM        = m;
+    iTaps     = taps;
+    iQuality  = aQuality;
+    iAdaptive = aAdaptive;
+
+    if (! same)
+    {
+        // The extra adaptive phase, a whole input sample on, is the far end
+        // of the interpolation from the last.
+        const TUint phases = iL + (iAdaptive ? 1 : 0);
+
+        iCoefs.resize(phases * iTaps);
+
+        // Cutoff in cycles per input sample.
+        const double cutoff = 0.5 * q.iRolloff *
+                              ((aOutRate < aInRate) ?
+                               ((double)aOutRate / aInRate) : 1.0);
+        const double centre = (iTaps / 2) - 1;
+        const double half   = iTaps / 2;
+        const double norm   = BesselI0(q.iBeta);
+
+        // Phase p interpolates at p/L input samples past the window centre.
+        // Each phase is normalised to unity gain so DC passes unchanged
+        // whichever phase is used.
+        for (TUint p = 0; p < phases; p++)
+        {
+            TFloat* coefs = &iCoefs[p * iTaps];
+            double  sum   = 0.0;
+
+            for (TUint j = 0; j < iTaps; j++)
+            {
+                const double x = (double)j - centre - ((double)p / iL);
+                const double r = x / half;
+                double       h = 2.0 * cutoff;
+
+                if (x != 0.0)
+                {
+                    const double a = 2.0 * kPi * cutoff * x;
+
+                    h = sin(a) / (kPi * x);
+                }
+
+                if (fabs(r) >= 1.0)
+                {
+                    h = 0.0;
+                }
+                else
+                {
+                    h *= BesselI0(q.iBeta * sqrt(1.0 - (r * r))) / norm;
+                }
+
+                coefs[j] = (TFloat)h;
+                sum     += h;
+            }
+
+            for (TUint j = 0; j < iTaps; j++)
+            {
+                coefs[j] = (TFloat)(coefs[j] / sum);
+            }
+        }
+
+        iCapacity = iTaps + kBlockFrames;
+        iHistory.resize(iChannels * iCapacity);
+    }
+
+    SetDrift(0);
+    Reset();
+
+    return true;
+}
+
+void Resampler::Reset()
+{
+    iFill  = 0;
+    iPos   = 0;
+    iPhase = 0;
+    iFrac  = 0;
+
+    if (iTaps == 0)
+    {
+        return;
+    }
+
+    // Half a window of silence puts the first output on the first input.
+    const TUint prime = (iTaps / 2) - 1;
+
+    for (TUint c = 0; c < iChannels; c++)
+    {
+        memset(Channel(c), 0, prime * sizeof(TFloat));
+    }
+
+    iFill = prime;
+}
+
+TUint Resampler::InRate() const
+{
+    return iInRate;
+}
+
+TUint Resampler::OutRate() const
+{
+    return iOutRate;
+}
+
+TUint Resampler::Channels() const
+{
+    return iChannels;
+}
+
+TUint Resampler::Taps() const
+{
+    return iTaps;
+}
+
+TBool Resampler::Adaptive() const
+{
+    return iAdaptive;
+}
+
+void Resampler::SetDrift(TInt aPpb)
+{
+    if (! iAdaptive)
+    {
+        return;
+    }
+
+    const double step = ((double)iInRate / iOutRate) *
+                        (1.0 + (aPpb * 1e-9)) * 4294967296.0;
+
+    iStep  = (TUint64)llround(step);
+    iDrift = aPpb;
+}
+
+TInt Resampler::Drift() const
+{
+    return iDrift;
+}
+
+TFloat* Resampler::Channel(TUint aChannel)
+{
+    return &iHistory[aChannel * iCapacity];
+}
+
+void Resampler::Compact()
+{
+    if (iPos == 0)
+    {
+        return;
+    }
+
+    const TUint keep = iFill - iPos;
+
+    for (TUint c = 0; c < iChannels; c++)
+    {
+        TFloat* plane = Channel(c);
+
+        memmove(plane, plane + iPos, keep * sizeof(TFloat));
+    }
+
+    iFill = keep;
+    iPos  = 0;
+}
+
+TUint Resampler::Write(const TByte* aSrc, TUint aFrames, TUint aInBytes)
+{
+    ASSERT((aInBytes >= 1) && (aInBytes <= 4));
+
+    if (iFill + aFrames > iCapacity)
+    {
+        Compact();
+    }
+
+    TUint frames = iCapacity - iFill;
+
+    if (frames > aFrames)
+    {
+        frames = aFrames;
+    }
+
+    // Scale full range to [-1, 1).
+    const TFloat scale = 1.0f / 2147483648.0f;
+
+    for (TUint c = 0; c < iChannels; c++)
+    {
+        const TByte* src   = aSrc + (c * aInBytes);
+        TFloat*      plane = Channel(c) + iFill;
+
+        for (TUint i = 0; i < frames; i++)
+        {
+            TUint32 v = 0;
+
+            for (TUint k = 0; k < aInBytes; k++)
+            {
+                v |= (TUint32)src[k] << (24 - (8 * k));
+            }
+
+            // 8 bit samples are unsigned.
+            if (aInBytes == 1)
+            {
+                v ^= 0x80000000;
+            }
+
+            plane[i] = (TFloat)(TInt32)v * scale;
+            src     += iChannels * aInBytes;
+        }
+    }
+
+    iFill += frames;
+
+    return frames;
+}
+
+TUint Resampler::Available() const
+{
+    if (iFill < iPos + iTaps)
+    {
+        return 0;
+    }
+
+    if (iAdaptive)
+    {
+        return AvailableAdaptive();
+    }
+
+    // Output k reads from iPos + (iPhase + k * M) / L, which must leave a
+    // whole window within the history.
+    const TUint spare = iFill - iTaps - iPos;
+
+    return (TUint)((((TUint64)(spare + 1) * iL) - iPhase + iM - 1) / iM);
+}
+
+// Scale a filtered sample to full range and store it big endian.
+static inline void StoreSample(TFloat aSample, TByte*& aDst)
+{
+    const TFloat s = aSample * 2147483648.0f;
+    TInt32       v;
+
+    // Filter overshoot can exceed full scale.
+    if (s >= 2147483647.0f)
+    {
+        v = 0x7fffffff;
+    }
+    else if (s <= -2147483648.0f)
+    {
+        v = (TInt32)0x80000000;
+    }
+    else
+    {
+        v = (TInt32)lrintf(s);
+    }
+
+    *aDst++ = (TByte)(v >> 24);
+    *aDst++ = (TByte)(v >> 16);
+    *aDst++ = (TByte)(v >> 8);
+    *aDst++ = (TByte)v;
+}
+
+TUint Resampler::Read(TByte* aDst, TUint aFrames)
+{
+    const TUint available = Available();
+
+    if (aFrames > available)
+    {
+        aFrames = available;
+    }
+
+    if (iAdaptive)
+    {
+        return ReadAdaptive(aDst, aFrames);
+    }
+
+    for (TUint i = 0; i < aFrames; i++)
+    {
+        const TFloat* coefs = &iCoefs[iPhase * iTaps];
+
+        for (TUint c = 0; c < iChannels; c++)
+        {
+            StoreSample(iDot(coefs, Channel(c) + iPos, iTaps), aDst);
+        }
+
+        iPhase += iM;
+        iPos   += iPhase / iL;
+        iPhase %= iL;
+    }
+
+    return aFrames;
+}
+
+// As Available(), with output k reading from iPos plus the whole part of
+// iFrac + k * iStep.
+TUint Resampler::AvailableAdaptive() const
+{
+    const TUint64 spare = iFill - iTaps - iPos;
+    const TUint64 limit = ((spare + 1) << 32) - 1 - iFrac;
+
+    return (TUint)((limit / iStep) + 1);
+}
+
+// The top bits of iFrac pick a phase and the rest weight the
+// interpolation towards the next one.
+TUint Resampler::ReadAdaptive(TByte* aDst, TUint aFrames)
+{
+    static const TUint  kPhaseShift = 32 - __builtin_ctz(kAdaptivePhases);
+    static const TFloat kWeight     = 1.0f / (1 << kPhaseShift);
+
+    for (TUint i = 0; i < aFrames; i++)
+    {
+        const TFloat* coefs0 = &iCoefs[(iFrac >> kPhaseShift) * iTaps];
+        const TFloat* coefs1 = coefs0 + iTaps;
+        const TFloat  weight = (iFrac & ((1u << kPhaseShift) - 1)) * kWeight;
+
+        for (TUint c = 0; c < iChannels; c++)
+        {
+            const TFloat* history = Channel(c) + iPos;
+            const TFloat  s0      = iDot(coefs0, history, iTaps);
+            const TFloat  s1      = iDot(coefs1, history, iTaps);
+
+            StoreSample(s0 + ((s1 - s0) * weight), aDst);
+        }
+
+        const TUint64 next = (TUint64)iFrac + iStep;
+
+        iPos  += (TUint)(next >> 32);
+        iFrac  = (TUint32)next;
+    }
+
+    return aFrames;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <OpenHome/Types.h>
+
+#include <vector>
+
+#include "SampleConvert.h"
+
+// Sample rate converter for the ALSA driver.
+//
+// A polyphase filter bank built from a Kaiser windowed sinc converts
+// between any two rates whose ratio reduces to L/M with at most kMaxPhases
+// phases, which covers every pair of standard rates. Audio is filtered as
+// planar floats, so each output sample is one contiguous dot product, run
+// by a vector kernel where the CPU has one.
+//
+// An adaptive resampler instead steps through a bank of kAdaptivePhases
+// phases by a 32.32 fixed point increment, interpolating between adjacent
+// phases, so its ratio can be trimmed by parts per billion while it runs,
+// as a clock puller needs, even between equal rates. Each output takes
+// two dot products.
+//
+// Input is big endian PCM as the pipeline delivers it, output is big
+// endian 32 bit PCM ready for SampleConverter. All memory is allocated by
+// Configure(), so streaming never allocates.
+//
+// NOTE: This header is included by ResamplerNeon.cpp, which is built with
+//       NEON enabled. Keep it free of inline code so no NEON instructions
+//       leak into functions shared with the rest of the application.
+
+namespace OpenHome {
+namespace Media {
+
+// Quality tiers, trading stop band attenuation and pass band width for
+// CPU. Taps are per output sample at unity or higher ratios and scale up
+// with the decimation ratio when reducing the rate.
+enum class ResamplerQuality
+{
+    Off,       // Never resample.
+    Fast,      // 16 taps, ~60dB, pass band to 85% of Nyquist.
+    Standard,  // 32 taps, ~90dB, pass band to 90% of Nyquist.
+    High       // 64 taps, ~120dB, pass band to 94% of Nyquist.
+};
+
+// Return the sum of aA[i] * aB[i] for i in [0, aCount). aCount is a
+// multiple of 8.
+typedef TFloat (*ResamplerDotKernel)(const TFloat* aA, const TFloat* aB,
+                                     TUint aCount);
+
+class Resampler
+{
+public:
+    static const TUint kMaxPhases      = 2048;
+    static const TUint kMaxChannels    = 8;
+    static const TUint kAdaptivePhases = 512;
+public:
+    Resampler();
+
+    // Prepare for a stream, clearing any history. Returns false if the
+    // rates can't be converted between. aAdaptive allows SetDrift().
+    TBool Configure(TUint aInRate, TUint aOutRate, TUint aChannels,
+                    ResamplerQuality aQuality, TBool aAdaptive);
+    void  Reset();           // Discard history, e.g. after a drain.
+    TUint InRate() const;
+    TUint OutRate() const;
+    TUint Channels() const;
+    TUint Taps() const;
+    TBool Adaptive() const;
+    // Consume input faster than the nominal ratio by aPpb parts per
+    // billion, or slower if negative. Adaptive resamplers only.
+    void  SetDrift(TInt aPpb);
+    TInt  Drift() const;
+
+    // Take up to aFrames frames of aInBytes bytes per sample, returning
+    // the number taken. Frames are only refused once enough are held to
+    // produce output, so alternate with Read() until all are taken.
+    TUint Write(const TByte* aSrc, TUint aFrames, TUint aInBytes);
+    // Output frames that can be read now.
+    TUint Available() const;
+    // Produce up to aFrames frames of big endian 32 bit samples, returning
+    // the number produced.
+    TUint Read(TByte* aDst, TUint aFrames);
+public:
+    static const TChar* QualityName(ResamplerQuality aQuality);
+private:
+    void  Compact();
+    TFloat* Channel(TUint aChannel);
+    TUint AvailableAdaptive() const;
+    TUint ReadAdaptive(TByte* aDst, TUint aFrames);
+private:
+    static const TUint kBlockFrames = 1024;  // Input frames held at once.
+private:
+    TUint               iInRate;
+    TUint               iOutRate;
+    TUint               iChannels;
+    TUint               iL;          // Phases (interpolation factor).
+    TUint               iM;          // Decimation factor.
+    TUint               iTaps;       // Per phase, a multiple of 8.
+    ResamplerQuality    iQuality;
+    TBool               iAdaptive;
+    std::vector<TFloat> iCoefs;      // iL phases of iTaps, plus one more
+                                     // when adaptive.
+    std::vector<TFloat> iHistory;    // iChannels planes of iCapacity.
+    TUint               iCapacity;
+    TUint               iFill;       // Frames held.
+    TUint               iPos;        // First frame of the next window.
+    TUint               iPhase;      // Phase of the next output.
+    TUint32             iFrac;       // Adaptive: iPos's fraction.
+    TUint64             iStep;       // Adaptive: input per output, 32.32.
+    TInt                iDrift;      // Adaptive: ppb iStep includes.
+    ResamplerDotKernel  iDot;
+};
+
+// Architecture specific kernels.
+#if defined(__x86_64__) || defined(__i386__)
+TFloat ResamplerDotSse(const TFloat* aA, const TFloat* aB, TUint aCount);
+TFloat ResamplerDotAvx2(const TFloat* aA, const TFloat* aB, TUint aCount);
+#endif // __x86_64__ || __i386__
+
+#if defined(__arm__) || defined(__aarch64__)
+TFloat ResamplerDotNeon(const TFloat* aA, const TFloat* aB, TUint aCount);
+#endif // __arm__ || __aarch64__
+
+} // namespace Media
+} // namespace OpenHome
@@ -0,0 +1,56 @@
+// NEON resampler kernels.
+//
+// On armhf this file is built with NEON enabled (see the Makefiles).
+// Resampler checks the CPU before calling in here.
+
+#include <OpenHome/Types.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+#include "Resampler.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+TFloat OpenHome::Media::ResamplerDotNeon(const TFloat* aA, const TFloat* aB,
+                                         TUint aCount)
+{
+    float32x4_t sum0 = vdupq_n_f32(0.0f);
+    float32x4_t sum1 = vdupq_n_f32(0.0f);
+
+    for (TUint i = 0; i < aCount; i += 8)
+    {
+        sum0 = vmlaq_f32(sum0, vld1q_f32(aA + i),     vld1q_f32(aB + i));
+        sum1 = vmlaq_f32(sum1, vld1q_f32(aA + i + 4), vld1q_f32(aB + i + 4));
+    }
+
+    const float32x4_t sum  = vaddq_f32(sum0, sum1);
+    const float32x2_t half = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+
+    return vget_lane_f32(vpadd_f32(half, half), 0);
+}
+
+#elif defined(__arm__) || defined(__aarch64__)
+
+#include "Resampler.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// Built without NEON. Never selected, but keep the reference result.
+TFloat OpenHome::Media::ResamplerDotNeon(const TFloat* aA, const TFloat* aB,
+                                         TUint aCount)
+{
+    TFloat sum = 0;
+
+    for (TUint i = 0; i < aCount; i++)
+    {
+        sum += aA[i] * aB[i];
+    }
+
+    return sum;
+}
+
+#endif // __ARM_NEON || __ARM_NEON__
@@ -0,0 +1,1803 @@
+#include <OpenHome/Private/Standard.h>
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__arm__)
+#include <sys/auxv.h>
+#endif
+
+#include "SampleConvert.h"
+
+#if defined(__arm__) && !defined(HWCAP_ARM_NEON)
+#define HWCAP_ARM_NEON (1 << 12)
+#endif
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// Scalar kernels
+//
+// These are the reference implementation. Output byte k of each little
+// endian sample takes byte (kOutBytes - 1 - k) of the big endian input
+// sample, or zero where the input is narrower than the output. Narrowing
+// therefore drops the least significant bytes.
+//
+// 8 bit input is unsigned so the most significant output byte has its
+// sign bit flipped.
+//
+// kPad adds a sign extension byte above the kOutBytes of sample data, for
+// 24 bit samples in 32 bit containers.
+
+template <TUint kInBytes, TUint kOutBytes, TBool kPad, TBool kDuplicate>
+static void ConvertScalar(const TByte* aSrc, TByte* aDst, TUint aSamples)
+{
+    const TUint copies = kDuplicate ? 2 : 1;
+
+    for (TUint i = 0; i < aSamples; i++)
+    {
+        for (TUint copy = 0; copy < copies; copy++)
+        {
+            for (TUint k = 0; k < kOutBytes; k++)
+            {
+                const TUint j = kOutBytes - 1 - k;
+
+                *aDst++ = (j < kInBytes) ? aSrc[j] : 0;
+            }
+
+            if (kInBytes == 1)
+            {
+                *(aDst - 1) ^= 0x80;
+            }
+
+            if (kPad)
+            {
+                *aDst = ((*(aDst - 1) & 0x80) != 0) ? 0xff : 0x00;
+                aDst++;
+            }
+        }
+
+        aSrc += kInBytes;
+    }
+}
+
+#define SCALAR_KERNELS(in, out, pad) \
+    { ConvertScalar<in, out, pad, false>, ConvertScalar<in, out, pad, true> }
+
+#define SCALAR_LAYOUTS(in)          \
+    { SCALAR_KERNELS(in, 2, false), \
+      SCALAR_KERNELS(in, 4, false), \
+      SCALAR_KERNELS(in, 3, false), \
+      SCALAR_KERNELS(in, 3, true) }
+
+// Indexed by [input bytes - 1][SampleLayout][duplicate].
+static const SampleScalarKernel kScalarKernels[4][4][2] =
+{
+    SCALAR_LAYOUTS(1),
+    SCALAR_LAYOUTS(2),
+    SCALAR_LAYOUTS(3),
+    SCALAR_LAYOUTS(4),
+};
+
+#undef SCALAR_LAYOUTS
+
+#undef SCALAR_KERNELS
+
+// Routing converts each output sample as ConvertScalar does, from the
+// input channel the route names. Silent outputs are zero.
+template <TUint kInBytes, TUint kOutBytes, TBool kPad>
+static void RouteScalar(const TByte* aSrc, TByte* aDst, TUint aFrames,
+                        const TByte* aRoute, TUint aInChannels,
+                        TUint aOutChannels)
+{
+    const TUint outBytes = kOutBytes + (kPad ? 1 : 0);
+
+    for (TUint i = 0; i < aFrames; i++)
+    {
+        for (TUint o = 0; o < aOutChannels; o++)
+        {
+            if (aRoute[o] == SampleConverter::kSilent)
+            {
+                memset(aDst, 0, outBytes);
+            }
+            else
+            {
+                ConvertScalar<kInBytes, kOutBytes, kPad, false>(
+                    aSrc + (aRoute[o] * kInBytes), aDst, 1);
+            }
+
+            aDst += outBytes;
+        }
+
+        aSrc += aInChannels * kInBytes;
+    }
+}
+
+#define ROUTE_LAYOUTS(in)          \
+    { RouteScalar<in, 2, false>, \
+      RouteScalar<in, 4, false>, \
+      RouteScalar<in, 3, false>, \
+      RouteScalar<in, 3, true> }
+
+// Indexed by [input bytes - 1][SampleLayout].
+static const SampleRouteKernel kRouteKernels[4][4] =
+{
+    ROUTE_LAYOUTS(1),
+    ROUTE_LAYOUTS(2),
+    ROUTE_LAYOUTS(3),
+    ROUTE_LAYOUTS(4),
+};
+
+#undef ROUTE_LAYOUTS
+
+// Mixing decodes samples to floats at the scale of 32 bit PCM, and
+// encodes the mix back by the same rule ConvertScalar uses for 32 bit
+// input, after clipping it to full scale.
+template <TUint kInBytes>
+static void DecodeScalar(const TByte* aSrc, TFloat* aDst, TUint aFrames,
+                         TUint aChannels)
+{
+    for (TUint i = 0; i < aFrames; i++)
+    {
+        for (TUint c = 0; c < aChannels; c++)
+        {
+            TUint value = 0;
+
+            for (TUint j = 0; j < kInBytes; j++)
+            {
+                value = (value << 8) | aSrc[j];
+            }
+
+            value <<= 32 - (8 * kInBytes);
+
+            if (kInBytes == 1)
+            {
+                value ^= 0x80000000;
+            }
+
+            aDst[c] = (TFloat)(TInt)value;
+            aSrc   += kInBytes;
+        }
+
+        aDst += ChannelMatrix::kMaxChannels;
+    }
+}
+
+template <TUint kOutBytes, TBool kPad>
+static void EncodeScalar(const TFloat* aSrc, TByte* aDst, TUint aFrames,
+                         TUint aChannels)
+{
+    static const TFloat kMax = 2147483520.0f;  // Largest float below 2^31.
+    static const TFloat kMin = -2147483648.0f;
+
+    for (TUint i = 0; i < aFrames; i++)
+    {
+        for (TUint o = 0; o < aChannels; o++)
+        {
+            TFloat sample = aSrc[o];
+
+            if (sample > kMax)
+            {
+                sample = kMax;
+            }
+            else if (sample < kMin)
+            {
+                sample = kMin;
+            }
+
+            const TUint value = (TUint)(TInt)sample;
+
+            for (TUint k = 0; k < kOutBytes; k++)
+            {
+                *aDst++ = (TByte)(value >> (8 * (4 - kOutBytes + k)));
+            }
+
+            if (kPad)
+            {
+                *aDst++ = ((value & 0x80000000) != 0) ? 0xff : 0x00;
+            }
+        }
+
+        aSrc += ChannelMatrix::kMaxChannels;
+    }
+}
+
+// Indexed by [input bytes - 1].
+static const SampleDecodeKernel kDecodeKernels[4] =
+{
+    DecodeScalar<1>, DecodeScalar<2>, DecodeScalar<3>, DecodeScalar<4>
+};
+
+// Indexed by [SampleLayout].
+static const SampleEncodeKernel kEncodeKernels[4] =
+{
+    EncodeScalar<2, false>, EncodeScalar<4, false>,
+    EncodeScalar<3, false>, EncodeScalar<3, true>
+};
+
+static void ChannelMixScalar(const TFloat* aColumns, TUint aInChannels,
+                             const TFloat* aIn, TFloat* aOut, TUint aFrames,
+                             TFloat* aGain, const TFloat* aStep)
+{
+    const TUint n = ChannelMatrix::kMaxChannels;
+
+    for (TUint i = 0; i < aFrames; i++)
+    {
+        for (TUint o = 0; o < n; o++)
+        {
+            TFloat sum = 0;
+
+            for (TUint c = 0; c < aInChannels; c++)
+            {
+                sum += aIn[c] * aColumns[(c * n) + o];
+            }
+
+            aOut[o]   = sum * aGain[o];
+            aGain[o] += aStep[o];
+        }
+
+        aIn  += n;
+        aOut += n;
+    }
+}
+
+// Requantisation. Each lane scales its sample to lsbs, takes its filtered
+// error history from it, adds triangular dither of up to +/-1 lsb made
+// from the two halves of a xorshift32 output and rounds to the nearest
+// lsb. The error fed back includes the dither. Vector kernels follow the
+// same order of operations so all give the same result.
+//
+// Each sample's error feeds the next, so the taps are summed oldest first,
+// leaving the newest error to the last add.
+static void SampleDitherScalar(DitherState& aState, TFloat* aSamples,
+                               TUint aFrames, TUint aChannels, TFloat aLsb)
+{
+    const TUint  n      = ChannelMatrix::kMaxChannels;
+    const TUint  taps   = DitherState::kMaxTaps;
+    const TFloat scale  = 1.0f / aLsb;
+    const TFloat dither = 1.0f / 65536;  // Two 16 bit halves to lsbs.
+
+    for (TUint i = 0; i < aFrames; i++)
+    {
+        for (TUint c = 0; c < aChannels; c++)
+        {
+            TFloat feedback = 0;
+
+            for (TUint k = taps; k > 0; k--)
+            {
+                feedback += aState.iTaps[k - 1] * aState.iErrors[k - 1][c];
+            }
+
+            TUint seed = aState.iSeeds[c];
+
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            aState.iSeeds[c] = seed;
+
+            const TInt   sum    = ((TInt)(seed << 16) >> 16) +
+                                  ((TInt)seed >> 16);
+            const TFloat target = (aSamples[c] * scale) - feedback;
+            const TFloat level  = (TFloat)lrintf(target +
+                                                 ((TFloat)sum * dither));
+
+            for (TUint k = taps - 1; k > 0; k--)
+            {
+                aState.iErrors[k][c] = aState.iErrors[k - 1][c];
+            }
+
+            aState.iErrors[0][c] = level - target;
+            aSamples[c]          = level * aLsb;
+        }
+
+        aSamples += n;
+    }
+}
+
+
+// x86 kernels
+//
+// SSE2 has no byte shuffle, so SSSE3 (pshufb) is the baseline vector
+// kernel. Both are compiled for their target regardless of the build
+// flags and only called once the CPU has been checked.
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("ssse3")))
+TUint OpenHome::Media::SampleConvertSsse3(const SamplePermute& aPermute,
+                                          const TByte* aSrc, TByte* aDst,
+                                          TUint aSamples)
+{
+    const __m128i mask  = _mm_loadu_si128((const __m128i*)aPermute.iMask[0]);
+    const __m128i flip  = _mm_loadu_si128((const __m128i*)aPermute.iXor[0]);
+    const __m128i shift = _mm_cvtsi32_si128((int)aPermute.iShift);
+    TUint         done  = 0;
+
+    if (aPermute.iSteps > 1)
+    {
+        while (((aSamples - done) * aPermute.iInBytes  >= aPermute.iInReach) &&
+               ((aSamples - done) * aPermute.iOutBytes >= aPermute.iOutReach))
+        {
+            for (TUint s = 0; s < aPermute.iSteps; s++)
+            {
+                const __m128i m = _mm_loadu_si128((const __m128i*)aPermute.iMask[s]);
+                const __m128i x = _mm_loadu_si128((const __m128i*)aPermute.iXor[s]);
+                __m128i       v = _mm_loadu_si128(
+                    (const __m128i*)(aSrc + aPermute.iInOffset[s]));
+
+                v = _mm_xor_si128(_mm_shuffle_epi8(v, m), x);
+                v = _mm_sra_epi32(v, shift);
+                _mm_storeu_si128((__m128i*)(aDst + aPermute.iOutOffset[s]), v);
+            }
+
+            aSrc += aPermute.iInStep;
+            aDst += aPermute.iOutStep;
+            done += aPermute.iSamples;
+        }
+
+        return done;
+    }
+
+    // Every step reads and writes a full 16 bytes.
+    while (((aSamples - done) * aPermute.iInBytes  >= aPermute.iInReach) &&
+           ((aSamples - done) * aPermute.iOutBytes >= aPermute.iOutReach))
+    {
+        __m128i v = _mm_loadu_si128(
+            (const __m128i*)(aSrc + aPermute.iInOffset[0]));
+
+        v = _mm_xor_si128(_mm_shuffle_epi8(v, mask), flip);
+        v = _mm_sra_epi32(v, shift);
+        _mm_storeu_si128((__m128i*)aDst, v);
+
+        aSrc += aPermute.iInStep;
+        aDst += aPermute.iOutStep;
+        done += aPermute.iSamples;
+    }
+
+    return done;
+}
+
+__attribute__((target("avx2")))
+TUint OpenHome::Media::SampleConvertAvx2(const SamplePermute& aPermute,
+                                         const TByte* aSrc, TByte* aDst,
+                                         TUint aSamples)
+{
+    // vpshufb shuffles within each 128 bit lane, so each lane handles one
+    // step of the permutation.
+    const __m128i mask128 = _mm_loadu_si128((const __m128i*)aPermute.iMask[0]);
+    const __m128i flip128 = _mm_loadu_si128((const __m128i*)aPermute.iXor[0]);
+    const __m256i mask    = _mm256_broadcastsi128_si256(mask128);
+    const __m256i flip    = _mm256_broadcastsi128_si256(flip128);
+    const __m128i shift   = _mm_cvtsi32_si128((int)aPermute.iShift);
+    const TUint   inStep  = aPermute.iInStep;
+    const TUint   outStep = aPermute.iOutStep;
+    TUint         done    = 0;
+
+    // Programs of several steps run a pair of steps at a time instead, the
+    // masks of neighbouring steps loading as one 256 bit mask.
+    if (aPermute.iSteps > 1)
+    {
+        while (((aSamples - done) * aPermute.iInBytes  >= aPermute.iInReach) &&
+               ((aSamples - done) * aPermute.iOutBytes >= aPermute.iOutReach))
+        {
+            TUint s = 0;
+
+            for (; s + 1 < aPermute.iSteps; s += 2)
+            {
+                const __m256i m = _mm256_loadu_si256(
+                                      (const __m256i*)aPermute.iMask[s]);
+                const __m256i x = _mm256_loadu_si256(
+                                      (const __m256i*)aPermute.iXor[s]);
+                __m256i v = _mm256_inserti128_si256(
+                                _mm256_castsi128_si256(
+                                    _mm_loadu_si128((const __m128i*)
+                                        (aSrc + aPermute.iInOffset[s]))),
+                                _mm_loadu_si128((const __m128i*)
+                                    (aSrc + aPermute.iInOffset[s + 1])),
+                                1);
+
+                v = _mm256_xor_si256(_mm256_shuffle_epi8(v, m), x);
+                v = _mm256_sra_epi32(v, shift);
+
+                // In order, the second store overwrites the tail of the
+                // first.
+                _mm_storeu_si128((__m128i*)(aDst + aPermute.iOutOffset[s]),
+                                 _mm256_castsi256_si128(v));
+                _mm_storeu_si128((__m128i*)(aDst + aPermute.iOutOffset[s + 1]),
+                                 _mm256_extracti128_si256(v, 1));
+            }
+
+            if (s < aPermute.iSteps)
+            {
+                const __m128i m = _mm_loadu_si128((const __m128i*)aPermute.iMask[s]);
+                const __m128i x = _mm_loadu_si128((const __m128i*)aPermute.iXor[s]);
+                __m128i       v = _mm_loadu_si128(
+                    (const __m128i*)(aSrc + aPermute.iInOffset[s]));
+
+                v = _mm_xor_si128(_mm_shuffle_epi8(v, m), x);
+                v = _mm_sra_epi32(v, shift);
+                _mm_storeu_si128((__m128i*)(aDst + aPermute.iOutOffset[s]), v);
+            }
+
+            aSrc += inStep;
+            aDst += outStep;
+            done += aPermute.iSamples;
+        }
+
+        return done;
+    }
+
+    while (((aSamples - done) * aPermute.iInBytes  >=
+            inStep  + aPermute.iInReach) &&
+           ((aSamples - done) * aPermute.iOutBytes >=
+            outStep + aPermute.iOutReach))
+    {
+        const TByte* src = aSrc + aPermute.iInOffset[0];
+        __m256i      v   = _mm256_inserti128_si256(
+                               _mm256_castsi128_si256(
+                                   _mm_loadu_si128((const __m128i*)src)),
+                               _mm_loadu_si128((const __m128i*)(src + inStep)),
+                               1);
+
+        v = _mm256_xor_si256(_mm256_shuffle_epi8(v, mask), flip);
+        v = _mm256_sra_epi32(v, shift);
+
+        if (outStep == 16)
+        {
+            _mm256_storeu_si256((__m256i*)aDst, v);
+        }
+        else
+        {
+            _mm_storeu_si128((__m128i*)aDst, _mm256_castsi256_si128(v));
+            _mm_storeu_si128((__m128i*)(aDst + outStep),
+                             _mm256_extracti128_si256(v, 1));
+        }
+
+        aSrc += 2 * inStep;
+        aDst += 2 * outStep;
+        done += 2 * aPermute.iSamples;
+    }
+
+    // Finish off with a single lane step if there is room.
+    done += SampleConvertSsse3(aPermute, aSrc, aDst, aSamples - done);
+
+    return done;
+}
+
+// Mixing kernels keep a frame's outputs in registers and add in each input
+// channel's column in turn.
+
+__attribute__((target("sse")))
+void OpenHome::Media::ChannelMixSse(const TFloat* aColumns,
+                                    TUint aInChannels, const TFloat* aIn,
+                                    TFloat* aOut, TUint aFrames,
+                                    TFloat* aGain, const TFloat* aStep)
+{
+    const TUint  n      = ChannelMatrix::kMaxChannels;
+    const __m128 stepLo = _mm_loadu_ps(aStep);
+    const __m128 stepHi = _mm_loadu_ps(aStep + 4);
+    __m128       gainLo = _mm_loadu_ps(aGain);
+    __m128       gainHi = _mm_loadu_ps(aGain + 4);
+
+    for (TUint i = 0; i < aFrames; i++)
+    {
+        __m128 lo = _mm_setzero_ps();
+        __m128 hi = _mm_setzero_ps();
+
+        for (TUint c = 0; c < aInChannels; c++)
+        {
+            const __m128  x      = _mm_set1_ps(aIn[c]);
+            const TFloat* column = aColumns + (c * n);
+
+            lo = _mm_add_ps(lo, _mm_mul_ps(x, _mm_loadu_ps(column)));
+            hi = _mm_add_ps(hi, _mm_mul_ps(x, _mm_loadu_ps(column + 4)));
+        }
+
+        _mm_storeu_ps(aOut, _mm_mul_ps(lo, gainLo));
+        _mm_storeu_ps(aOut + 4, _mm_mul_ps(hi, gainHi));
+
+        gainLo = _mm_add_ps(gainLo, stepLo);
+        gainHi = _mm_add_ps(gainHi, stepHi);
+
+        aIn  += n;
+        aOut += n;
+    }
+
+    _mm_storeu_ps(aGain, gainLo);
+    _mm_storeu_ps(aGain + 4, gainHi);
+}
+
+__attribute__((target("avx2")))
+void OpenHome::Media::ChannelMixAvx2(const TFloat* aColumns,
+                                     TUint aInChannels, const TFloat* aIn,
+                                     TFloat* aOut, TUint aFrames,
+                                     TFloat* aGain, const TFloat* aStep)
+{
+    const TUint  n    = ChannelMatrix::kMaxChannels;
+    const __m256 step = _mm256_loadu_ps(aStep);
+    __m256       gain = _mm256_loadu_ps(aGain);
+
+    for (TUint i = 0; i < aFrames; i++)
+    {
+        __m256 sum = _mm256_setzero_ps();
+
+        for (TUint c = 0; c < aInChannels; c++)
+        {
+            sum = _mm256_add_ps(sum,
+                                _mm256_mul_ps(_mm256_set1_ps(aIn[c]),
+                                              _mm256_loadu_ps(aColumns +
+                                                              (c * n))));
+        }
+
+        _mm256_storeu_ps(aOut, _mm256_mul_ps(sum, gain));
+
+        gain = _mm256_add_ps(gain, step);
+
+        aIn  += n;
+        aOut += n;
+    }
+
+    _mm256_storeu_ps(aGain, gain);
+}
+
+// Dither kernels run each group of lanes through every frame in turn,
+// keeping its generators and error history in registers. SSE2 has no
+// shuffles to worry about, so it serves every x86 CPU without AVX2.
+
+__attribute__((target("sse2")))
+void OpenHome::Media::SampleDitherSse2(DitherState& aState,
+                                       TFloat* aSamples, TUint aFrames,
+                                       TUint aChannels, TFloat aLsb)
+{
+    const TUint  n      = ChannelMatrix::kMaxChannels;
+    const TUint  taps   = DitherState::kMaxTaps;
+    const __m128 scale  = _mm_set1_ps(1.0f / aLsb);
+    const __m128 lsb    = _mm_set1_ps(aLsb);
+    const __m128 dither = _mm_set1_ps(1.0f / 65536);
+    __m128       coeffs[taps];
+
+    for (TUint k = 0; k < taps; k++)
+    {
+        coeffs[k] = _mm_set1_ps(aState.iTaps[k]);
+    }
+
+    for (TUint lane = 0; lane < aChannels; lane += 4)
+    {
+        __m128i seed = _mm_loadu_si128((const __m128i*)&aState.iSeeds[lane]);
+        __m128  errors[taps];
+
+        for (TUint k = 0; k < taps; k++)
+        {
+            errors[k] = _mm_loadu_ps(&aState.iErrors[k][lane]);
+        }
+
+        TFloat* samples = aSamples + lane;
+
+        for (TUint i = 0; i < aFrames; i++)
+        {
+            __m128 feedback = _mm_setzero_ps();
+
+            for (TUint k = taps; k > 0; k--)
+            {
+                feedback = _mm_add_ps(feedback,
+                                      _mm_mul_ps(coeffs[k - 1],
+                                                 errors[k - 1]));
+            }
+
+            seed = _mm_xor_si128(seed, _mm_slli_epi32(seed, 13));
+            seed = _mm_xor_si128(seed, _mm_srli_epi32(seed, 17));
+            seed = _mm_xor_si128(seed, _mm_slli_epi32(seed, 5));
+
+            const __m128i sum    =
+                _mm_add_epi32(_mm_srai_epi32(_mm_slli_epi32(seed, 16), 16),
+                              _mm_srai_epi32(seed, 16));
+            const __m128  target =
+                _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(samples), scale),
+                           feedback);
+            const __m128  level  = _mm_cvtepi32_ps(_mm_cvtps_epi32(
+                _mm_add_ps(target,
+                           _mm_mul_ps(_mm_cvtepi32_ps(sum), dither))));
+
+            for (TUint k = taps - 1; k > 0; k--)
+            {
+                errors[k] = errors[k - 1];
+            }
+
+            errors[0] = _mm_sub_ps(level, target);
+            _mm_storeu_ps(samples, _mm_mul_ps(level, lsb));
+
+            samples += n;
+        }
+
+        _mm_storeu_si128((__m128i*)&aState.iSeeds[lane], seed);
+
+        for (TUint k = 0; k < taps; k++)
+        {
+            _mm_storeu_ps(&aState.iErrors[k][lane], errors[k]);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+void OpenHome::Media::SampleDitherAvx2(DitherState& aState,
+                                       TFloat* aSamples, TUint aFrames,
+                                       TUint /*aChannels*/, TFloat aLsb)
+{
+    const TUint  n      = ChannelMatrix::kMaxChannels;
+    const TUint  taps   = DitherState::kMaxTaps;
+    const __m256 scale  = _mm256_set1_ps(1.0f / aLsb);
+    const __m256 lsb    = _mm256_set1_ps(aLsb);
+    const __m256 dither = _mm256_set1_ps(1.0f / 65536);
+    __m256       coeffs[taps];
+    __m256       errors[taps];
+    __m256i      seed   =
+        _mm256_loadu_si256((const __m256i*)aState.iSeeds);
+
+    for (TUint k = 0; k < taps; k++)
+    {
+        coeffs[k] = _mm256_set1_ps(aState.iTaps[k]);
+        errors[k] = _mm256_loadu_ps(aState.iErrors[k]);
+    }
+
+    for (TUint i = 0; i < aFrames; i++)
+    {
+        __m256 feedback = _mm256_setzero_ps();
+
+        for (TUint k = taps; k > 0; k--)
+        {
+            feedback = _mm256_add_ps(feedback,
+                                     _mm256_mul_ps(coeffs[k - 1],
+                                                   errors[k - 1]));
+        }
+
+        seed = _mm256_xor_si256(seed, _mm256_slli_epi32(seed, 13));
+        seed = _mm256_xor_si256(seed, _mm256_srli_epi32(seed, 17));
+        seed = _mm256_xor_si256(seed, _mm256_slli_epi32(seed, 5));
+
+        const __m256i sum    =
+            _mm256_add_epi32(_mm256_srai_epi32(_mm256_slli_epi32(seed, 16),
+                                               16),
+                             _mm256_srai_epi32(seed, 16));
+        const __m256  target =
+            _mm256_sub_ps(_mm256_mul_ps(_mm256_loadu_ps(aSamples), scale),
+                          feedback);
+        const __m256  level  = _mm256_cvtepi32_ps(_mm256_cvtps_epi32(
+            _mm256_add_ps(target,
+                          _mm256_mul_ps(_mm256_cvtepi32_ps(sum), dither))));
+
+        for (TUint k = taps - 1; k > 0; k--)
+        {
+            errors[k] = errors[k - 1];
+        }
+
+        errors[0] = _mm256_sub_ps(level, target);
+        _mm256_storeu_ps(aSamples, _mm256_mul_ps(level, lsb));
+
+        aSamples += n;
+    }
+
+    _mm256_storeu_si256((__m256i*)aState.iSeeds, seed);
+
+    for (TUint k = 0; k < taps; k++)
+    {
+        _mm256_storeu_ps(aState.iErrors[k], errors[k]);
+    }
+}
+
+#endif // __x86_64__ || __i386__
+
+
+// SampleConverter
+
+static SampleConverter::Isa DetectIsa()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return SampleConverter::Isa::Avx2;
+    }
+
+    if (__builtin_cpu_supports("ssse3"))
+    {
+        return SampleConverter::Isa::Ssse3;
+    }
+#elif defined(__aarch64__)
+    return SampleConverter::Isa::Neon;
+#elif defined(__arm__)
+    // Older Raspberry Pi boards (ARMv6) have no NEON unit.
+    if ((getauxval(AT_HWCAP) & HWCAP_ARM_NEON) != 0)
+    {
+        return SampleConverter::Isa::Neon;
+    }
+#endif
+
+    return SampleConverter::Isa::Scalar;
+}
+
+static SampleVectorKernel SelectVectorKernel()
+{
+    switch (SampleConverter::SelectedIsa())
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        case SampleConverter::Isa::Avx2:
+            return SampleConvertAvx2;
+        case SampleConverter::Isa::Ssse3:
+            return SampleConvertSsse3;
+#endif // __x86_64__ || __i386__
+#if defined(__arm__) || defined(__aarch64__)
+        case SampleConverter::Isa::Neon:
+            return SampleConvertNeon;
+#endif // __arm__ || __aarch64__
+        default:
+            return nullptr;
+    }
+}
+
+static ChannelMixKernel SelectMixKernel()
+{
+    switch (SampleConverter::SelectedIsa())
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        case SampleConverter::Isa::Avx2:
+            return ChannelMixAvx2;
+        case SampleConverter::Isa::Ssse3:
+            return ChannelMixSse;
+#endif // __x86_64__ || __i386__
+#if defined(__arm__) || defined(__aarch64__)
+        case SampleConverter::Isa::Neon:
+            return ChannelMixNeon;
+#endif // __arm__ || __aarch64__
+        default:
+            return ChannelMixScalar;
+    }
+}
+
+static SampleDitherKernel SelectDitherKernel()
+{
+    switch (SampleConverter::SelectedIsa())
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        case SampleConverter::Isa::Avx2:
+            return SampleDitherAvx2;
+        case SampleConverter::Isa::Ssse3:
+            return SampleDitherSse2;
+#endif // __x86_64__ || __i386__
+#if defined(__arm__) || defined(__aarch64__)
+        case SampleConverter::Isa::Neon:
+            return SampleDitherNeon;
+#endif // __arm__ || __aarch64__
+        default:
+            return SampleDitherScalar;
+    }
+}
+
+// Start a single step permutation that produces zeros.
+static void ClearPermute(SamplePermute& aPermute)
+{
+    memset(aPermute.iMask, 0x80, sizeof(aPermute.iMask));
+    memset(aPermute.iXor, 0x00, sizeof(aPermute.iXor));
+    memset(aPermute.iInOffset, 0, sizeof(aPermute.iInOffset));
+    memset(aPermute.iOutOffset, 0, sizeof(aPermute.iOutOffset));
+
+    aPermute.iSteps    = 1;
+    aPermute.iInReach  = 16;
+    aPermute.iOutReach = 16;
+    aPermute.iShift    = 0;
+}
+
+
+// ChannelMatrix
+
+ChannelMatrix::ChannelMatrix()
+{
+    SetIdentity(1);
+}
+
+void ChannelMatrix::SetIdentity(TUint aChannels)
+{
+    SetSilent(aChannels, aChannels);
+
+    for (TUint i = 0; i < aChannels; i++)
+    {
+        iGain[i][i] = 1;
+    }
+}
+
+void ChannelMatrix::SetSilent(TUint aInChannels, TUint aOutChannels)
+{
+    ASSERT((aInChannels  >= 1) && (aInChannels  <= kMaxChannels));
+    ASSERT((aOutChannels >= 1) && (aOutChannels <= kMaxChannels));
+
+    iInChannels  = aInChannels;
+    iOutChannels = aOutChannels;
+
+    for (TUint o = 0; o < kMaxChannels; o++)
+    {
+        for (TUint c = 0; c < kMaxChannels; c++)
+        {
+            iGain[o][c] = 0;
+        }
+    }
+}
+
+void ChannelMatrix::SetGain(TUint aOut, TUint aIn, TFloat aGain)
+{
+    ASSERT((aOut < iOutChannels) && (aIn < iInChannels));
+
+    iGain[aOut][aIn] = aGain;
+}
+
+void ChannelMatrix::Normalise()
+{
+    TFloat peak = 0;
+
+    for (TUint o = 0; o < iOutChannels; o++)
+    {
+        TFloat sum = 0;
+
+        for (TUint c = 0; c < iInChannels; c++)
+        {
+            sum += (iGain[o][c] < 0) ? -iGain[o][c] : iGain[o][c];
+        }
+
+        if (sum > peak)
+        {
+            peak = sum;
+        }
+    }
+
+    // Scale every output alike so the balance between them is kept.
+    if (peak > 1)
+    {
+        for (TUint o = 0; o < iOutChannels; o++)
+        {
+            for (TUint c = 0; c < iInChannels; c++)
+            {
+                iGain[o][c] /= peak;
+            }
+        }
+    }
+}
+
+TUint ChannelMatrix::InChannels() const
+{
+    return iInChannels;
+}
+
+TUint ChannelMatrix::OutChannels() const
+{
+    return iOutChannels;
+}
+
+TFloat ChannelMatrix::Gain(TUint aOut, TUint aIn) const
+{
+    ASSERT((aOut < iOutChannels) && (aIn < iInChannels));
+
+    return iGain[aOut][aIn];
+}
+
+TBool ChannelMatrix::IsIdentity() const
+{
+    TInt source[kMaxChannels];
+
+    if ((iInChannels != iOutChannels) || ! IsRoute(source))
+    {
+        return false;
+    }
+
+    for (TUint o = 0; o < iOutChannels; o++)
+    {
+        if (source[o] != (TInt)o)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+TBool ChannelMatrix::IsRoute(TInt* aSource) const
+{
+    for (TUint o = 0; o < iOutChannels; o++)
+    {
+        aSource[o] = -1;
+
+        for (TUint c = 0; c < iInChannels; c++)
+        {
+            if (iGain[o][c] == 0)
+            {
+                continue;
+            }
+
+            if ((iGain[o][c] != 1) || (aSource[o] != -1))
+            {
+                return false;
+            }
+
+            aSource[o] = (TInt)c;
+        }
+    }
+
+    return true;
+}
+
+TBool ChannelMatrix::operator==(const ChannelMatrix& aOther) const
+{
+    if ((iInChannels  != aOther.iInChannels) ||
+        (iOutChannels != aOther.iOutChannels))
+    {
+        return false;
+    }
+
+    for (TUint o = 0; o < iOutChannels; o++)
+    {
+        for (TUint c = 0; c < iInChannels; c++)
+        {
+            if (iGain[o][c] != aOther.iGain[o][c])
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+
+// SampleGain
+
+SampleGain::SampleGain()
+: iRampFrames(0)
+, iUnity(true)
+{
+    for (TUint o = 0; o < ChannelMatrix::kMaxChannels; o++)
+    {
+        iGains[o]   = 1;
+        iSteps[o]   = 0;
+        iTargets[o] = 1;
+    }
+}
+
+void SampleGain::Set(const TFloat* aGains, TUint aChannels,
+                     TUint aRampFrames)
+{
+    ASSERT(aChannels <= ChannelMatrix::kMaxChannels);
+
+    for (TUint o = 0; o < ChannelMatrix::kMaxChannels; o++)
+    {
+        iTargets[o] = (o < aChannels) ? aGains[o] : 1;
+    }
+
+    if (aRampFrames == 0)
+    {
+        iRampFrames = 1;
+        Advance(1);
+        return;
+    }
+
+    iRampFrames = aRampFrames;
+    iUnity      = false;
+
+    for (TUint o = 0; o < ChannelMatrix::kMaxChannels; o++)
+    {
+        iSteps[o] = (iTargets[o] - iGains[o]) / (TFloat)aRampFrames;
+    }
+}
+
+TBool SampleGain::IsUnity() const
+{
+    return iUnity;
+}
+
+TUint SampleGain::Span(TUint aFrames) const
+{
+    if ((iRampFrames > 0) && (iRampFrames < aFrames))
+    {
+        return iRampFrames;
+    }
+
+    return aFrames;
+}
+
+TFloat* SampleGain::Gains()
+{
+    return iGains;
+}
+
+const TFloat* SampleGain::Steps() const
+{
+    return iSteps;
+}
+
+void SampleGain::Advance(TUint aFrames)
+{
+    if (iRampFrames == 0)
+    {
+        return;
+    }
+
+    ASSERT(aFrames <= iRampFrames);
+    iRampFrames -= aFrames;
+
+    if (iRampFrames > 0)
+    {
+        return;
+    }
+
+    // Settle exactly on the targets, whatever rounding the steps added.
+    iUnity = true;
+
+    for (TUint o = 0; o < ChannelMatrix::kMaxChannels; o++)
+    {
+        iGains[o] = iTargets[o];
+        iSteps[o] = 0;
+
+        if (iGains[o] != 1)
+        {
+            iUnity = false;
+        }
+    }
+}
+
+
+// SampleDither
+
+// Error feedback filters, by DitherMode.
+static const TFloat kDitherTaps[5][DitherState::kMaxTaps] =
+{
+    { 0,       0,       0,      0,       0       },  // Off
+    { 0,       0,       0,      0,       0       },  // Tpdf
+    { 1,       0,       0,      0,       0       },  // FirstOrder
+    { 2,      -1,       0,      0,       0       },  // SecondOrder
+    { 2.033f, -2.165f,  1.959f, -1.590f, 0.6149f }  // Weighted
+};
+
+SampleDither::SampleDither()
+: iMode(DitherMode::Off)
+, iKernel(SelectDitherKernel())
+{
+    // Any distinct non-zero seeds will do.
+    for (TUint c = 0; c < ChannelMatrix::kMaxChannels; c++)
+    {
+        iState.iSeeds[c] = 0x9e3779b9u * (c + 1);
+    }
+
+    SetMode(DitherMode::Off);
+}
+
+void SampleDither::SetMode(DitherMode aMode)
+{
+    iMode = aMode;
+
+    for (TUint k = 0; k < DitherState::kMaxTaps; k++)
+    {
+        iState.iTaps[k] = kDitherTaps[(TUint)aMode][k];
+    }
+
+    Reset();
+}
+
+DitherMode SampleDither::Mode() const
+{
+    return iMode;
+}
+
+TBool SampleDither::IsOn() const
+{
+    return iMode != DitherMode::Off;
+}
+
+void SampleDither::Reset()
+{
+    memset(iState.iErrors, 0, sizeof(iState.iErrors));
+}
+
+void SampleDither::Apply(TFloat* aSamples, TUint aFrames, TUint aChannels,
+                         TUint aBits)
+{
+    ASSERT((aBits >= 8) && (aBits < 32));
+
+    if (iMode != DitherMode::Off)
+    {
+        iKernel(iState, aSamples, aFrames, aChannels,
+                (TFloat)(1u << (32 - aBits)));
+    }
+}
+
+const TChar* SampleDither::ModeName(DitherMode aMode)
+{
+    switch (aMode)
+    {
+        case DitherMode::Off:
+            return "off";
+        case DitherMode::Tpdf:
+            return "tpdf";
+        case DitherMode::FirstOrder:
+            return "shaped1";
+        case DitherMode::SecondOrder:
+            return "shaped2";
+        case DitherMode::Weighted:
+            return "weighted";
+    }
+
+    return "unknown";
+}
+
+
+// SampleConverter
+
+SampleConverter::SampleConverter()
+: iVector(nullptr)
+, iScalar(nullptr)
+, iRouteScalar(nullptr)
+, iDecode(nullptr)
+, iEncode(nullptr)
+, iMix(nullptr)
+{
+    Set(2, SampleLayout::S16Le, ChannelMatrix());
+}
+
+TUint SampleConverter::LayoutBytes(SampleLayout aLayout)
+{
+    switch (aLayout)
+    {
+        case SampleLayout::S16Le:
+            return 2;
+        case SampleLayout::S32Le:
+            return 4;
+        case SampleLayout::S24_3Le:
+            return 3;
+        case SampleLayout::S24Le:
+            return 4;
+    }
+
+    ASSERTS();
+    return 0;
+}
+
+// Only ever run over the few milliseconds a flush fades, so scalar code
+// does. Gains are 16 bit fixed point, which is exact for 32 bit samples
+// where a float isn't.
+void SampleConverter::FadeOut(TByte* aData, TUint aFrames, TUint aChannels,
+                              SampleLayout aLayout)
+{
+    const TUint bytes = LayoutBytes(aLayout);
+    const TUint width = (aLayout == SampleLayout::S24Le) ? 3 : bytes;
+    const TUint shift = 32 - (width * 8);
+
+    for (TUint f = 0; f < aFrames; f++)
+    {
+        const TInt64 gain = ((TInt64)(aFrames - 1 - f) << 16) / aFrames;
+
+        for (TUint c = 0; c < aChannels; c++)
+        {
+            TUint raw = 0;
+
+            for (TUint k = 0; k < width; k++)
+            {
+                raw |= (TUint)aData[k] << (8 * k);
+            }
+
+            // Sign extend through the top of a 32 bit word.
+            const TInt sample = (TInt)(raw << shift) >> shift;
+            const TInt faded  = (TInt)(((TInt64)sample * gain) >> 16);
+
+            for (TUint k = 0; k < width; k++)
+            {
+                aData[k] = (TByte)((TUint)faded >> (8 * k));
+            }
+
+            if (width < bytes)
+            {
+                aData[width] = (faded < 0) ? 0xff : 0x00;
+            }
+
+            aData += bytes;
+        }
+    }
+}
+
+// Like FadeOut(), only run over a few milliseconds at a time.
+TUint SampleConverter::Peak(const TByte* aData, TUint aFrames,
+                            TUint aChannels, SampleLayout aLayout)
+{
+    const TUint bytes = LayoutBytes(aLayout);
+    const TUint width = (aLayout == SampleLayout::S24Le) ? 3 : bytes;
+    TUint       peak  = 0;
+
+    for (TUint i = 0; i < aFrames * aChannels; i++)
+    {
+        TUint raw = 0;
+
+        for (TUint k = 0; k < width; k++)
+        {
+            raw |= (TUint)aData[k] << (8 * k);
+        }
+
+        // Left justified, so every layout shares a scale.
+        const TInt  sample    = (TInt)(raw << (32 - (width * 8)));
+        const TUint magnitude = (sample < 0) ? (TUint)-(TInt64)sample
+                                             : (TUint)sample;
+
+        peak   = (magnitude > peak) ? magnitude : peak;
+        aData += bytes;
+    }
+
+    return peak;
+}
+
+SampleConverter::Isa SampleConverter::SelectedIsa()
+{
+    static const Isa isa = DetectIsa();
+
+    return isa;
+}
+
+const TChar* SampleConverter::IsaName(Isa aIsa)
+{
+    switch (aIsa)
+    {
+        case Isa::Scalar:
+            return "scalar";
+        case Isa::Ssse3:
+            return "ssse3";
+        case Isa::Avx2:
+            return "avx2";
+        case Isa::Neon:
+            return "neon";
+    }
+
+    return "unknown";
+}
+
+void SampleConverter::Set(TUint aInBytes, SampleLayout aLayout,
+                          const ChannelMatrix& aMatrix)
+{
+    ASSERT((aInBytes >= 1) && (aInBytes <= 4));
+
+    TInt source[ChannelMatrix::kMaxChannels];
+
+    iInChannels    = aMatrix.InChannels();
+    iOutChannels   = aMatrix.OutChannels();
+    iInFrameBytes  = iInChannels * aInBytes;
+    iOutFrameBytes = iOutChannels * LayoutBytes(aLayout);
+    iOutBits       = (aLayout == SampleLayout::S16Le) ? 16 : 0;
+    iNarrowing     = (iOutBits != 0) && (aInBytes > 2);
+
+    // Gain is applied by the mixer whatever the matrix, so it is always
+    // made ready.
+    SetMixer(aInBytes, aLayout, aMatrix);
+
+    if (aMatrix.IsIdentity())
+    {
+        SetPermute(aInBytes, aLayout, false);
+        iFrameSamples = iInChannels;
+    }
+    else if (! aMatrix.IsRoute(source))
+    {
+        iMode = Mode::Mix;
+    }
+    else if ((iInChannels == 1) && (iOutChannels == 2) &&
+             (source[0] == 0) && (source[1] == 0))
+    {
+        // Mono played as stereo keeps its sample by sample kernels.
+        SetPermute(aInBytes, aLayout, true);
+        iFrameSamples = 1;
+    }
+    else
+    {
+        SetRoute(aInBytes, aLayout, source);
+    }
+}
+
+void SampleConverter::SetPermute(TUint aInBytes, SampleLayout aLayout,
+                                 TBool aDuplicate)
+{
+    const TUint outSampleBytes = LayoutBytes(aLayout);
+    const TUint copies         = aDuplicate ? 2 : 1;
+
+    // S24Le is built as S32Le then shifted down a byte, which also sign
+    // extends it.
+    const TBool shifted        = (aLayout == SampleLayout::S24Le);
+
+    iMode   = Mode::Permute;
+    iScalar = kScalarKernels[aInBytes - 1][(TUint)aLayout][copies - 1];
+
+    // Build the shuffle that mirrors the scalar kernel for as many samples
+    // as fit in 16 bytes of both input and output.
+    SamplePermute& p = iPermute;
+
+    ClearPermute(p);
+
+    p.iInBytes  = aInBytes;
+    p.iOutBytes = outSampleBytes * copies;
+    p.iSamples  = 16 / aInBytes;
+
+    if (p.iSamples > 16 / p.iOutBytes)
+    {
+        p.iSamples = 16 / p.iOutBytes;
+    }
+
+    p.iInStep  = p.iSamples * p.iInBytes;
+    p.iOutStep = p.iSamples * p.iOutBytes;
+    p.iShift   = shifted ? 8 : 0;
+
+    for (TUint s = 0; s < p.iSamples; s++)
+    {
+        for (TUint copy = 0; copy < copies; copy++)
+        {
+            for (TUint k = 0; k < outSampleBytes; k++)
+            {
+                const TUint j = outSampleBytes - 1 - k;
+                const TUint o = (s * p.iOutBytes) +
+                                (copy * outSampleBytes) + k;
+
+                if (j < aInBytes)
+                {
+                    p.iMask[0][o] = (TByte)((s * aInBytes) + j);
+                }
+
+                if ((aInBytes == 1) && (j == 0))
+                {
+                    p.iXor[0][o] = 0x80;
+                }
+            }
+        }
+    }
+
+    iVector = SelectVectorKernel();
+}
+
+// A route is permuted a frame at a time, or several frames where they fit
+// in 16 bytes. Output is cut into steps of whole samples, so each 32 bit
+// lane holds one sample for the S24Le shift, and a step ends early where
+// its samples come from further apart in the input than one 16 byte load.
+void SampleConverter::SetRoute(TUint aInBytes, SampleLayout aLayout,
+                               const TInt* aSource)
+{
+    const TUint outSampleBytes = LayoutBytes(aLayout);
+    const TUint stepSamples    = 16 / outSampleBytes;
+
+    iMode        = Mode::Route;
+    iRouteScalar = kRouteKernels[aInBytes - 1][(TUint)aLayout];
+
+    for (TUint o = 0; o < iOutChannels; o++)
+    {
+        iRoute[o] = (aSource[o] < 0) ? kSilent : (TByte)aSource[o];
+    }
+
+    SamplePermute& p = iPermute;
+
+    ClearPermute(p);
+
+    p.iInBytes  = iInFrameBytes;
+    p.iOutBytes = iOutFrameBytes;
+    p.iSamples  = 16 / iInFrameBytes;
+
+    if (p.iSamples > 16 / iOutFrameBytes)
+    {
+        p.iSamples = 16 / iOutFrameBytes;
+    }
+
+    if (p.iSamples == 0)
+    {
+        p.iSamples = 1;
+    }
+
+    p.iInStep   = p.iSamples * p.iInBytes;
+    p.iOutStep  = p.iSamples * p.iOutBytes;
+    p.iShift    = (aLayout == SampleLayout::S24Le) ? 8 : 0;
+    p.iSteps    = 0;
+    p.iInReach  = 0;
+    p.iOutReach = 0;
+
+    const TUint samples = p.iSamples * iOutChannels;  // Output, per pass.
+    TUint       n       = 0;
+
+    while (n < samples)
+    {
+        // Take samples while their input spans no more than 16 bytes.
+        TUint lo    = p.iInStep;
+        TUint hi    = 0;
+        TUint count = 0;
+
+        while ((n + count < samples) && (count < stepSamples))
+        {
+            const TUint frame  = (n + count) / iOutChannels;
+            const TInt  source = aSource[(n + count) % iOutChannels];
+
+            if (source >= 0)
+            {
+                const TUint start = (frame * iInFrameBytes) +
+                                    ((TUint)source * aInBytes);
+                const TUint newLo = (start < lo) ? start : lo;
+                const TUint newHi = (start + aInBytes > hi) ? start + aInBytes
+                                                            : hi;
+
+                if (newHi - newLo > 16)
+                {
+                    break;
+                }
+
+                lo = newLo;
+                hi = newHi;
+            }
+
+            count++;
+        }
+
+        ASSERT(p.iSteps < SamplePermute::kMaxSteps);
+
+        const TUint step = p.iSteps++;
+
+        // Keep the load within the pass where the pass allows.
+        const TUint last = (p.iInStep > 16) ? (p.iInStep - 16) : 0;
+        const TUint in   = (hi == 0) ? 0 : ((lo < last) ? lo : last);
+
+        p.iInOffset[step]  = in;
+        p.iOutOffset[step] = n * outSampleBytes;
+
+        for (TUint i = 0; i < count; i++)
+        {
+            const TUint frame  = (n + i) / iOutChannels;
+            const TInt  source = aSource[(n + i) % iOutChannels];
+
+            if (source < 0)
+            {
+                continue;
+            }
+
+            const TUint base = (frame * iInFrameBytes) +
+                               ((TUint)source * aInBytes);
+
+            for (TUint k = 0; k < outSampleBytes; k++)
+            {
+                const TUint j = outSampleBytes - 1 - k;
+                const TUint o = (i * outSampleBytes) + k;
+
+                if (j < aInBytes)
+                {
+                    p.iMask[step][o] = (TByte)(base + j - in);
+                }
+
+                if ((aInBytes == 1) && (j == 0))
+                {
+                    p.iXor[step][o] = 0x80;
+                }
+            }
+        }
+
+        if (in + 16 > p.iInReach)
+        {
+            p.iInReach = in + 16;
+        }
+
+        if (p.iOutOffset[step] + 16 > p.iOutReach)
+        {
+            p.iOutReach = p.iOutOffset[step] + 16;
+        }
+
+        n += count;
+    }
+
+    iVector = SelectVectorKernel();
+}
+
+void SampleConverter::SetMixer(TUint aInBytes, SampleLayout aLayout,
+                               const ChannelMatrix& aMatrix)
+{
+    iDecode = kDecodeKernels[aInBytes - 1];
+    iEncode = kEncodeKernels[(TUint)aLayout];
+    iMix    = SelectMixKernel();
+
+    for (TUint c = 0; c < ChannelMatrix::kMaxChannels; c++)
+    {
+        for (TUint o = 0; o < ChannelMatrix::kMaxChannels; o++)
+        {
+            iColumns[c][o] = ((c < iInChannels) && (o < iOutChannels)) ?
+                             aMatrix.Gain(o, c) : 0;
+        }
+    }
+}
+
+void SampleConverter::Convert(const TByte* aSrc, TByte* aDst,
+                              TUint aFrames, SampleGain& aGain,
+                              SampleDither& aDither) const
+{
+    TUint done = 0;
+
+    if (! aGain.IsUnity() || (iNarrowing && aDither.IsOn()))
+    {
+        Mix(aSrc, aDst, aFrames, aGain, aDither);
+        return;
+    }
+
+    switch (iMode)
+    {
+        case Mode::Permute:
+        {
+            const TUint samples = aFrames * iFrameSamples;
+
+            if (iVector != nullptr)
+            {
+                done = iVector(iPermute, aSrc, aDst, samples);
+            }
+
+            if (done < samples)
+            {
+                iScalar(aSrc + (done * iPermute.iInBytes),
+                        aDst + (done * iPermute.iOutBytes),
+                        samples - done);
+            }
+            break;
+        }
+        case Mode::Route:
+        {
+            if (iVector != nullptr)
+            {
+                done = iVector(iPermute, aSrc, aDst, aFrames);
+            }
+
+            if (done < aFrames)
+            {
+                iRouteScalar(aSrc + (done * iInFrameBytes),
+                             aDst + (done * iOutFrameBytes),
+                             aFrames - done, iRoute, iInChannels,
+                             iOutChannels);
+            }
+            break;
+        }
+        case Mode::Mix:
+            Mix(aSrc, aDst, aFrames, aGain, aDither);
+            break;
+    }
+}
+
+// Mix a block at a time through buffers small enough to stay in cache.
+// Blocks are cut where a gain ramp ends, so the gains land exactly on
+// their targets. The mix has fractional bits, so 16 bit output is dithered
+// whenever dither is on.
+void SampleConverter::Mix(const TByte* aSrc, TByte* aDst, TUint aFrames,
+                          SampleGain& aGain, SampleDither& aDither) const
+{
+    TFloat in[kMixFrames * ChannelMatrix::kMaxChannels];
+    TFloat out[kMixFrames * ChannelMatrix::kMaxChannels];
+
+    while (aFrames > 0)
+    {
+        const TUint frames =
+            aGain.Span((aFrames < kMixFrames) ? aFrames : kMixFrames);
+
+        iDecode(aSrc, in, frames, iInChannels);
+        iMix(&iColumns[0][0], iInChannels, in, out, frames, aGain.Gains(),
+             aGain.Steps());
+        aGain.Advance(frames);
+
+        if (iOutBits != 0)
+        {
+            aDither.Apply(out, frames, iOutChannels, iOutBits);
+        }
+
+        iEncode(out, aDst, frames, iOutChannels);
+
+        aSrc    += frames * iInFrameBytes;
+        aDst    += frames * iOutFrameBytes;
+        aFrames -= frames;
+    }
+}
+
+TUint SampleConverter::OutBytes() const
+{
+    return iOutFrameBytes;
+}
+
+
+// DsdPacker
+//
+// DoP samples carry the marker in bits 23-16, the older DSD byte in bits
+// 15-8 and the newer in bits 7-0. Markers alternate 0x05, 0xFA from frame
+// to frame, so each vector step packs an even number of frames with both
+// markers baked into iXor. A run that starts on the second marker packs
+// its first frame with the scalar code.
+
+static const TByte kDopMarkers[2] = { 0x05, 0xFA };
+
+DsdPacker::DsdPacker()
+: iVector(nullptr)
+, iLayout(DsdLayout::DopS32Le)
+, iOddMarker(false)
+{
+    Set(DsdLayout::DopS32Le);
+}
+
+const TChar* DsdPacker::LayoutName(DsdLayout aLayout)
+{
+    switch (aLayout)
+    {
+        case DsdLayout::DopS32Le:
+            return "DoP S32_LE";
+        case DsdLayout::DopS24_3Le:
+            return "DoP S24_3LE";
+        case DsdLayout::DopS24Le:
+            return "DoP S24_LE";
+        case DsdLayout::U32Be:
+            return "DSD_U32_BE";
+        case DsdLayout::U32Le:
+            return "DSD_U32_LE";
+    }
+
+    return "unknown";
+}
+
+void DsdPacker::Set(DsdLayout aLayout)
+{
+    SamplePermute& p = iPermute;
+
+    iLayout = aLayout;
+
+    ClearPermute(p);
+
+    p.iSamples = 2;
+
+    switch (aLayout)
+    {
+        case DsdLayout::U32Be:
+        case DsdLayout::U32Le:
+        {
+            // Two words make a frame: L0 L1 R0 R1 L2 L3 R2 R3.
+            static const TByte kBe[8] = { 0, 1, 4, 5, 2, 3, 6, 7 };
+            static const TByte kLe[8] = { 5, 4, 1, 0, 7, 6, 3, 2 };
+            const TByte* order = (aLayout == DsdLayout::U32Be) ? kBe : kLe;
+
+            p.iInBytes  = 8;
+            p.iOutBytes = 8;
+
+            for (TUint f = 0; f < p.iSamples; f++)
+            {
+                for (TUint k = 0; k < 8; k++)
+                {
+                    p.iMask[0][(f * 8) + k] = (TByte)((f * 8) + order[k]);
+                }
+            }
+            break;
+        }
+        default:
+        {
+            // S24Le is built as S32Le then shifted down a byte, which
+            // also sign extends the marker.
+            const TUint sampleBytes =
+                (aLayout == DsdLayout::DopS24_3Le) ? 3 : 4;
+            const TUint top = sampleBytes - 1;
+
+            p.iInBytes  = 4;
+            p.iOutBytes = 2 * sampleBytes;
+            p.iShift    = (aLayout == DsdLayout::DopS24Le) ? 8 : 0;
+
+            for (TUint f = 0; f < p.iSamples; f++)
+            {
+                for (TUint c = 0; c < 2; c++)
+                {
+                    const TUint in  = (f * 4) + (c * 2);
+                    const TUint out = (f * p.iOutBytes) + (c * sampleBytes);
+
+                    p.iMask[0][out + top - 2] = (TByte)(in + 1);  // Newer.
+                    p.iMask[0][out + top - 1] = (TByte)in;        // Older.
+                    p.iXor[0][out + top]      = kDopMarkers[f];
+                }
+            }
+            break;
+        }
+    }
+
+    p.iInStep  = p.iSamples * p.iInBytes;
+    p.iOutStep = p.iSamples * p.iOutBytes;
+
+    iVector = SelectVectorKernel();
+
+    Reset();
+}
+
+void DsdPacker::Reset()
+{
+    iOddMarker = false;
+}
+
+TUint DsdPacker::InBytes() const
+{
+    return iPermute.iInBytes;
+}
+
+TUint DsdPacker::OutBytes() const
+{
+    return iPermute.iOutBytes;
+}
+
+TUint DsdPacker::RateDivisor() const
+{
+    return 4 * iPermute.iInBytes;
+}
+
+void DsdPacker::Pack(const TByte* aSrc, TByte* aDst, TUint aFrames)
+{
+    const TBool dop  = (iPermute.iInBytes == 4);
+    TUint       done = 0;
+
+    if (dop && iOddMarker && (aFrames > 0))
+    {
+        PackScalar(aSrc, aDst, 1);
+        done = 1;
+    }
+
+    // Whole steps keep the marker sequence in place.
+    if (iVector != nullptr)
+    {
+        done += iVector(iPermute, aSrc + (done * iPermute.iInBytes),
+                        aDst + (done * iPermute.iOutBytes), aFrames - done);
+    }
+
+    if (done < aFrames)
+    {
+        PackScalar(aSrc + (done * iPermute.iInBytes),
+                   aDst + (done * iPermute.iOutBytes), aFrames - done);
+    }
+}
+
+void DsdPacker::PackScalar(const TByte* aSrc, TByte* aDst, TUint aFrames)
+{
+    for (TUint i = 0; i < aFrames; i++)
+    {
+        switch (iLayout)
+        {
+            case DsdLayout::U32Be:
+                *aDst++ = aSrc[0];
+                *aDst++ = aSrc[1];
+                *aDst++ = aSrc[4];
+                *aDst++ = aSrc[5];
+                *aDst++ = aSrc[2];
+                *aDst++ = aSrc[3];
+                *aDst++ = aSrc[6];
+                *aDst++ = aSrc[7];
+                break;
+            case DsdLayout::U32Le:
+                *aDst++ = aSrc[5];
+                *aDst++ = aSrc[4];
+                *aDst++ = aSrc[1];
+                *aDst++ = aSrc[0];
+                *aDst++ = aSrc[7];
+                *aDst++ = aSrc[6];
+                *aDst++ = aSrc[3];
+                *aDst++ = aSrc[2];
+                break;
+            default:
+            {
+                const TByte marker = kDopMarkers[iOddMarker ? 1 : 0];
+
+                for (TUint c = 0; c < 2; c++)
+                {
+                    if (iLayout == DsdLayout::DopS32Le)
+                    {
+                        *aDst++ = 0;
+                    }
+
+                    *aDst++ = aSrc[(c * 2) + 1];
+                    *aDst++ = aSrc[c * 2];
+                    *aDst++ = marker;
+
+                    if (iLayout == DsdLayout::DopS24Le)
+                    {
+                        *aDst++ = ((marker & 0x80) != 0) ? 0xff : 0x00;
+                    }
+                }
+
+                iOddMarker = ! iOddMarker;
+                break;
+            }
+        }
+
+        aSrc += iPermute.iInBytes;
+    }
+}
@@ -0,0 +1,348 @@
+#pragma once
+
+#include <OpenHome/Types.h>
+
+// Sample conversion kernels for the ALSA driver.
+//
+// The pipeline delivers big endian PCM (unsigned for 8 bit audio). ALSA is
+// fed little endian signed samples in one of the SampleLayout formats, with
+// the stream's channels arranged for the device by a ChannelMatrix in the
+// same pass.
+//
+// NOTE: This header is included by SampleConvertNeon.cpp, which is built
+//       with NEON enabled. Keep it free of inline code so no NEON
+//       instructions leak into functions shared with the rest of the
+//       application.
+
+namespace OpenHome {
+namespace Media {
+
+typedef float TFloat;
+
+// Little endian output sample layouts.
+enum class SampleLayout
+{
+    S16Le,
+    S32Le,
+    S24_3Le,  // Packed, 3 bytes per sample.
+    S24Le     // Low 3 bytes of 4, sign extended.
+};
+
+// Byte permutation applied by the vector kernels.
+//
+// A permutation is a program of iSteps steps, run once per pass. Step s
+// loads 16 input bytes from iInOffset[s], shuffles them through iMask[s]
+// (an index with the top bit set produces a zero byte), flips the bits set
+// in iXor[s], arithmetic shifts each 32 bit lane right by iShift and
+// stores 16 bytes at iOutOffset[s]. Only the bytes up to the next step's
+// output are valid, the remainder is overwritten by the next step.
+//
+// Most permutations are a single step. Rearranging the channels of wide
+// frames takes several, each fed from one 16 byte window of the frame.
+struct SamplePermute
+{
+    static const TUint kMaxSteps = 8;
+
+    TByte iMask[kMaxSteps][16];  // Contiguous, so steps load in pairs.
+    TByte iXor[kMaxSteps][16];
+    TUint iInOffset[kMaxSteps];
+    TUint iOutOffset[kMaxSteps];
+    TUint iSteps;
+    TUint iInReach;   // Input bytes a pass may load.
+    TUint iOutReach;  // Output bytes a pass may store.
+    TUint iShift;     // 0, or 8 to move S32 samples into S24 containers.
+    TUint iSamples;   // Input samples (or frames) consumed per pass.
+    TUint iInStep;    // Input bytes consumed per pass.
+    TUint iOutStep;   // Output bytes produced per pass.
+    TUint iInBytes;   // Bytes per input sample.
+    TUint iOutBytes;  // Bytes produced per input sample.
+};
+
+// How output channels are made from input channels.
+//
+// Each output channel is a weighted sum of the input channels. A matrix
+// whose outputs each copy at most one input at unity gain is a route,
+// which reorders, duplicates or drops channels, or adds silent ones, by
+// moving bytes. Anything else is a mix, done in floating point.
+class ChannelMatrix
+{
+public:
+    static const TUint kMaxChannels = 8;
+public:
+    ChannelMatrix();  // One channel passed through.
+    void   SetIdentity(TUint aChannels);
+    void   SetSilent(TUint aInChannels, TUint aOutChannels);
+    void   SetGain(TUint aOut, TUint aIn, TFloat aGain);
+    // Scale every gain down so no output can exceed full scale.
+    void   Normalise();
+    TUint  InChannels() const;
+    TUint  OutChannels() const;
+    TFloat Gain(TUint aOut, TUint aIn) const;
+    TBool  IsIdentity() const;
+    // If the matrix is a route, set aSource[o] to the input copied to
+    // output o, or -1 where it is silent.
+    TBool  IsRoute(TInt* aSource) const;
+    TBool  operator==(const ChannelMatrix& aOther) const;
+private:
+    TUint  iInChannels;
+    TUint  iOutChannels;
+    TFloat iGain[kMaxChannels][kMaxChannels];  // [output][input]
+};
+
+// Vector kernels convert as many whole passes as fit within aSamples and
+// return the number of samples converted.
+typedef TUint (*SampleVectorKernel)(const SamplePermute& aPermute,
+                                    const TByte* aSrc, TByte* aDst,
+                                    TUint aSamples);
+typedef void  (*SampleScalarKernel)(const TByte* aSrc, TByte* aDst,
+                                    TUint aSamples);
+// Scalar routing, aRoute[o] being the input for output o or kSilent.
+typedef void  (*SampleRouteKernel)(const TByte* aSrc, TByte* aDst,
+                                   TUint aFrames, const TByte* aRoute,
+                                   TUint aInChannels, TUint aOutChannels);
+// Mixing goes through floats: interleaved frames of kMaxChannels, with
+// samples at the scale of 32 bit PCM.
+typedef void  (*SampleDecodeKernel)(const TByte* aSrc, TFloat* aDst,
+                                    TUint aFrames, TUint aChannels);
+typedef void  (*SampleEncodeKernel)(const TFloat* aSrc, TByte* aDst,
+                                    TUint aFrames, TUint aChannels);
+// aOut[f][o] = aGain[o] * (sum over c of aIn[f][c] * aColumns[c][o]), for
+// all kMaxChannels outputs, with aStep[o] added to aGain[o] after each
+// frame. aGain is left holding the gains for the next frame.
+typedef void  (*ChannelMixKernel)(const TFloat* aColumns, TUint aInChannels,
+                                  const TFloat* aIn, TFloat* aOut,
+                                  TUint aFrames, TFloat* aGain,
+                                  const TFloat* aStep);
+
+// Per output channel gain, for digital volume.
+//
+// A new setting is reached by a linear ramp, stepped every frame, so
+// changes don't click. One SampleGain is shared by all the converters
+// of a stream so a ramp carries on across fragments of any width. Once
+// settled at unity converters leave samples untouched, keeping
+// bit-perfect output bit-perfect.
+class SampleGain
+{
+public:
+    SampleGain();  // Unity on every channel.
+    // Ramp output channel c to aGains[c] over aRampFrames frames, or jump
+    // there if aRampFrames is 0. Channels from aChannels on play at unity.
+    void    Set(const TFloat* aGains, TUint aChannels, TUint aRampFrames);
+    TBool   IsUnity() const;
+    // The frames of aFrames that can be processed before the ramp ends.
+    TUint   Span(TUint aFrames) const;
+    // Gains and per frame steps for kMaxChannels outputs, advanced by the
+    // mixing kernels.
+    TFloat* Gains();
+    const TFloat* Steps() const;
+    // Account for aFrames frames mixed with Gains() and Steps().
+    void    Advance(TUint aFrames);
+private:
+    TFloat iGains[ChannelMatrix::kMaxChannels];
+    TFloat iSteps[ChannelMatrix::kMaxChannels];
+    TFloat iTargets[ChannelMatrix::kMaxChannels];
+    TUint  iRampFrames;  // Left until iGains reaches iTargets.
+    TBool  iUnity;
+};
+
+// Requantisation of samples narrowed to 16 bits.
+enum class DitherMode
+{
+    Off,          // Truncate, dropping the low bits.
+    Tpdf,         // Triangular dither, leaving the noise flat.
+    FirstOrder,   // Triangular dither with the noise shaped by 1 - z^-1,
+    SecondOrder,  // (1 - z^-1)^2
+    Weighted      // or Lipshitz's five tap filter, which moves the noise
+                  // to where the ear is least sensitive at 44.1kHz.
+};
+
+// Requantiser state, in kMaxChannels lanes so kernels dither whole frames
+// at once. Each channel has its own xorshift32 generator, whose halves
+// give the two uniform values summed for triangular dither, and history
+// of the error fed back by noise shaping.
+struct DitherState
+{
+    static const TUint kMaxTaps = 5;
+
+    TUint  iSeeds[ChannelMatrix::kMaxChannels];  // Never zero.
+    TFloat iErrors[kMaxTaps][ChannelMatrix::kMaxChannels];  // Newest first.
+    TFloat iTaps[kMaxTaps];  // Feedback filter, unused taps zero.
+};
+
+// Round aFrames frames of floats at the scale of 32 bit PCM, interleaved
+// in kMaxChannels lanes, to multiples of aLsb. Lanes from aChannels on
+// may be left as they are.
+typedef void (*SampleDitherKernel)(DitherState& aState, TFloat* aSamples,
+                                   TUint aFrames, TUint aChannels,
+                                   TFloat aLsb);
+
+// Dither and noise shaping for one stream, shared by its converters like
+// SampleGain.
+//
+// Samples are requantised by the mixer, so only 16 bit output is dithered:
+// 24 bit samples have little more resolution than a float.
+class SampleDither
+{
+public:
+    SampleDither();  // Off.
+    void       SetMode(DitherMode aMode);
+    DitherMode Mode() const;
+    TBool      IsOn() const;
+    void       Reset();  // Clear the error history, for a new stream.
+    // Requantise aFrames mixed frames of aChannels to aBits bits.
+    void       Apply(TFloat* aSamples, TUint aFrames, TUint aChannels,
+                     TUint aBits);
+public:
+    static const TChar* ModeName(DitherMode aMode);
+private:
+    DitherMode         iMode;
+    DitherState        iState;
+    SampleDitherKernel iKernel;
+};
+
+class SampleConverter
+{
+public:
+    enum class Isa
+    {
+        Scalar,
+        Ssse3,
+        Avx2,
+        Neon
+    };
+public:
+    SampleConverter();
+
+    // Select the kernels for a given input sample width, output layout and
+    // channel matrix.
+    //
+    // This is done once per stream. Convert() then only dispatches on the
+    // kind of matrix, never on the formats involved.
+    void  Set(TUint aInBytes, SampleLayout aLayout,
+              const ChannelMatrix& aMatrix);
+    // Convert aFrames frames of the matrix's input channels, applying
+    // aGain and requantising with aDither. Any gain other than unity, or
+    // dither of samples being narrowed, goes through the mixer.
+    void  Convert(const TByte* aSrc, TByte* aDst, TUint aFrames,
+                  SampleGain& aGain, SampleDither& aDither) const;
+    TUint OutBytes() const;  // Output bytes per frame.
+public:
+    static TUint        LayoutBytes(SampleLayout aLayout);
+    // Fade aFrames converted frames of aChannels in place, linearly from
+    // full level to silence at the last frame.
+    static void         FadeOut(TByte* aData, TUint aFrames, TUint aChannels,
+                                SampleLayout aLayout);
+    // Largest magnitude among aFrames converted frames of aChannels, at
+    // the scale of 32 bit PCM.
+    static TUint        Peak(const TByte* aData, TUint aFrames,
+                             TUint aChannels, SampleLayout aLayout);
+    static Isa          SelectedIsa();
+    static const TChar* IsaName(Isa aIsa);
+    static const TByte  kSilent = 0xff;  // Route entry for a silent output.
+private:
+    enum class Mode
+    {
+        Permute,  // Samples in order, or mono duplicated.
+        Route,    // Whole frames rearranged.
+        Mix
+    };
+private:
+    void SetPermute(TUint aInBytes, SampleLayout aLayout, TBool aDuplicate);
+    void SetRoute(TUint aInBytes, SampleLayout aLayout, const TInt* aSource);
+    void SetMixer(TUint aInBytes, SampleLayout aLayout,
+                  const ChannelMatrix& aMatrix);
+    void Mix(const TByte* aSrc, TByte* aDst, TUint aFrames,
+             SampleGain& aGain, SampleDither& aDither) const;
+private:
+    static const TUint kMixFrames = 32;  // Frames mixed at once.
+private:
+    Mode               iMode;
+    TUint              iInChannels;
+    TUint              iOutChannels;
+    TUint              iFrameSamples;  // Permute mode samples per frame.
+    TUint              iInFrameBytes;
+    TUint              iOutFrameBytes;
+    TUint              iOutBits;       // 16 if the mixer may dither.
+    TBool              iNarrowing;     // Input wider than iOutBits.
+    SamplePermute      iPermute;
+    SampleVectorKernel iVector;
+    SampleScalarKernel iScalar;
+    SampleRouteKernel  iRouteScalar;
+    TByte              iRoute[ChannelMatrix::kMaxChannels];
+    SampleDecodeKernel iDecode;
+    SampleEncodeKernel iEncode;
+    ChannelMixKernel   iMix;
+    // [input][output], padded to kMaxChannels outputs for the kernels.
+    TFloat             iColumns[ChannelMatrix::kMaxChannels]
+                               [ChannelMatrix::kMaxChannels];
+};
+
+// DSD output layouts.
+enum class DsdLayout
+{
+    DopS32Le,    // DSD over PCM: 16 DSD bits and a marker byte per sample,
+    DopS24_3Le,  // in any 24 bit PCM format, at 1/16 of the DSD rate.
+    DopS24Le,
+    U32Be,       // Native DSD, 32 bits per channel, at 1/32 of the DSD
+    U32Le        // rate.
+};
+
+// Packs pipeline DSD for ALSA, using the sample conversion kernels.
+//
+// The pipeline delivers stereo DSD as sample blocks of kBlockWords words.
+// Each word holds two bytes of the left channel then two of the right,
+// oldest bit first (most significant). A block therefore makes two DoP
+// frames, with both markers of a pair, or one native frame.
+class DsdPacker
+{
+public:
+    static const TUint kBlockWords = 2;
+public:
+    DsdPacker();
+    void  Set(DsdLayout aLayout);
+    void  Reset();               // The next DoP frame takes the first marker.
+    TUint InBytes() const;       // Input bytes per output frame.
+    TUint OutBytes() const;      // Bytes per output frame.
+    TUint RateDivisor() const;   // DSD rate / PCM rate.
+    void  Pack(const TByte* aSrc, TByte* aDst, TUint aFrames);
+public:
+    static const TChar* LayoutName(DsdLayout aLayout);
+private:
+    void  PackScalar(const TByte* aSrc, TByte* aDst, TUint aFrames);
+private:
+    SamplePermute      iPermute;  // One sample per output frame.
+    SampleVectorKernel iVector;
+    DsdLayout          iLayout;
+    TBool              iOddMarker;
+};
+
+// Architecture specific kernels.
+#if defined(__x86_64__) || defined(__i386__)
+TUint SampleConvertSsse3(const SamplePermute& aPermute, const TByte* aSrc,
+                         TByte* aDst, TUint aSamples);
+TUint SampleConvertAvx2(const SamplePermute& aPermute, const TByte* aSrc,
+                        TByte* aDst, TUint aSamples);
+void  ChannelMixSse(const TFloat* aColumns, TUint aInChannels,
+                    const TFloat* aIn, TFloat* aOut, TUint aFrames,
+                    TFloat* aGain, const TFloat* aStep);
+void  ChannelMixAvx2(const TFloat* aColumns, TUint aInChannels,
+                     const TFloat* aIn, TFloat* aOut, TUint aFrames,
+                     TFloat* aGain, const TFloat* aStep);
+void  SampleDitherSse2(DitherState& aState, TFloat* aSamples, TUint aFrames,
+                       TUint aChannels, TFloat aLsb);
+void  SampleDitherAvx2(DitherState& aState, TFloat* aSamples, TUint aFrames,
+                       TUint aChannels, TFloat aLsb);
+#endif // __x86_64__ || __i386__
+
+#if defined(__arm__) || defined(__aarch64__)
+TUint SampleConvertNeon(const SamplePermute& aPermute, const TByte* aSrc,
+                        TByte* aDst, TUint aSamples);
+void  ChannelMixNeon(const TFloat* aColumns, TUint aInChannels,
+                     const TFloat* aIn, TFloat* aOut, TUint aFrames,
+                     TFloat* aGain, const TFloat* aStep);
+void  SampleDitherNeon(DitherState& aState, TFloat* aSamples, TUint aFrames,
+                       TUint aChannels, TFloat aLsb);
+#endif // __arm__ || __aarch64__
+
+} // namespace Media
+} // namespace OpenHome
@@ -0,0 +1,298 @@
+// NEON sample conversion kernels.
+//
+// On armhf this file is the only one built with NEON enabled (see the
+// Makefiles). SampleConverter checks the CPU before calling in here.
+
+#include <OpenHome/Types.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+#include "SampleConvert.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// One step of a permutation. Table indices of 0x80 are out of range, so
+// both vtbl and vqtbl produce a zero byte.
+static inline void PermuteStep(const TByte* aSrc, TByte* aDst,
+                               uint8x16_t aMask, uint8x16_t aFlip,
+                               int32x4_t aShift)
+{
+    const uint8x16_t v = vld1q_u8(aSrc);
+    uint8x16_t       r;
+
+#if defined(__aarch64__)
+    r = vqtbl1q_u8(v, aMask);
+#else // __aarch64__
+    uint8x8x2_t table;
+
+    table.val[0] = vget_low_u8(v);
+    table.val[1] = vget_high_u8(v);
+
+    r = vcombine_u8(vtbl2_u8(table, vget_low_u8(aMask)),
+                    vtbl2_u8(table, vget_high_u8(aMask)));
+#endif // __aarch64__
+
+    // A negative shift count shifts right, arithmetically for signed
+    // lanes.
+    r = vreinterpretq_u8_s32(vshlq_s32(vreinterpretq_s32_u8(
+                                veorq_u8(r, aFlip)), aShift));
+
+    vst1q_u8(aDst, r);
+}
+
+TUint OpenHome::Media::SampleConvertNeon(const SamplePermute& aPermute,
+                                         const TByte* aSrc, TByte* aDst,
+                                         TUint aSamples)
+{
+    const uint8x16_t mask  = vld1q_u8(aPermute.iMask[0]);
+    const uint8x16_t flip  = vld1q_u8(aPermute.iXor[0]);
+    const int32x4_t  shift = vdupq_n_s32(-(int32_t)aPermute.iShift);
+    TUint            done  = 0;
+
+    if (aPermute.iSteps > 1)
+    {
+        while (((aSamples - done) * aPermute.iInBytes  >= aPermute.iInReach) &&
+               ((aSamples - done) * aPermute.iOutBytes >= aPermute.iOutReach))
+        {
+            for (TUint s = 0; s < aPermute.iSteps; s++)
+            {
+                PermuteStep(aSrc + aPermute.iInOffset[s],
+                            aDst + aPermute.iOutOffset[s],
+                            vld1q_u8(aPermute.iMask[s]),
+                            vld1q_u8(aPermute.iXor[s]), shift);
+            }
+
+            aSrc += aPermute.iInStep;
+            aDst += aPermute.iOutStep;
+            done += aPermute.iSamples;
+        }
+
+        return done;
+    }
+
+    // Every step reads and writes a full 16 bytes.
+    while (((aSamples - done) * aPermute.iInBytes  >= aPermute.iInReach) &&
+           ((aSamples - done) * aPermute.iOutBytes >= aPermute.iOutReach))
+    {
+        PermuteStep(aSrc + aPermute.iInOffset[0], aDst, mask, flip, shift);
+
+        aSrc += aPermute.iInStep;
+        aDst += aPermute.iOutStep;
+        done += aPermute.iSamples;
+    }
+
+    return done;
+}
+
+void OpenHome::Media::ChannelMixNeon(const TFloat* aColumns,
+                                     TUint aInChannels, const TFloat* aIn,
+                                     TFloat* aOut, TUint aFrames,
+                                     TFloat* aGain, const TFloat* aStep)
+{
+    const TUint       n      = ChannelMatrix::kMaxChannels;
+    const float32x4_t stepLo = vld1q_f32(aStep);
+    const float32x4_t stepHi = vld1q_f32(aStep + 4);
+    float32x4_t       gainLo = vld1q_f32(aGain);
+    float32x4_t       gainHi = vld1q_f32(aGain + 4);
+
+    for (TUint i = 0; i < aFrames; i++)
+    {
+        float32x4_t lo = vdupq_n_f32(0.0f);
+        float32x4_t hi = vdupq_n_f32(0.0f);
+
+        for (TUint c = 0; c < aInChannels; c++)
+        {
+            const TFloat* column = aColumns + (c * n);
+
+            lo = vmlaq_n_f32(lo, vld1q_f32(column),     aIn[c]);
+            hi = vmlaq_n_f32(hi, vld1q_f32(column + 4), aIn[c]);
+        }
+
+        vst1q_f32(aOut,     vmulq_f32(lo, gainLo));
+        vst1q_f32(aOut + 4, vmulq_f32(hi, gainHi));
+
+        gainLo = vaddq_f32(gainLo, stepLo);
+        gainHi = vaddq_f32(gainHi, stepHi);
+
+        aIn  += n;
+        aOut += n;
+    }
+
+    vst1q_f32(aGain,     gainLo);
+    vst1q_f32(aGain + 4, gainHi);
+}
+
+// ARMv7 has no round to nearest conversion, so levels are rounded by
+// adding and removing 1.5 * 2^23, which leaves no fractional bits for
+// magnitudes below 2^22. Levels are at most a little over 2^15.
+void OpenHome::Media::SampleDitherNeon(DitherState& aState, TFloat* aSamples,
+                                       TUint aFrames, TUint aChannels,
+                                       TFloat aLsb)
+{
+    const TUint       n      = ChannelMatrix::kMaxChannels;
+    const TUint       taps   = DitherState::kMaxTaps;
+    const float32x4_t scale  = vdupq_n_f32(1.0f / aLsb);
+    const float32x4_t lsb    = vdupq_n_f32(aLsb);
+    const float32x4_t dither = vdupq_n_f32(1.0f / 65536);
+    const float32x4_t round  = vdupq_n_f32(12582912.0f);
+    float32x4_t       coeffs[taps];
+
+    for (TUint k = 0; k < taps; k++)
+    {
+        coeffs[k] = vdupq_n_f32(aState.iTaps[k]);
+    }
+
+    for (TUint lane = 0; lane < aChannels; lane += 4)
+    {
+        uint32x4_t  seed = vld1q_u32(&aState.iSeeds[lane]);
+        float32x4_t errors[taps];
+
+        for (TUint k = 0; k < taps; k++)
+        {
+            errors[k] = vld1q_f32(&aState.iErrors[k][lane]);
+        }
+
+        TFloat* samples = aSamples + lane;
+
+        for (TUint i = 0; i < aFrames; i++)
+        {
+            float32x4_t feedback = vdupq_n_f32(0.0f);
+
+            for (TUint k = taps; k > 0; k--)
+            {
+                feedback = vaddq_f32(feedback,
+                                     vmulq_f32(coeffs[k - 1], errors[k - 1]));
+            }
+
+            seed = veorq_u32(seed, vshlq_n_u32(seed, 13));
+            seed = veorq_u32(seed, vshrq_n_u32(seed, 17));
+            seed = veorq_u32(seed, vshlq_n_u32(seed, 5));
+
+            const int32x4_t   bits   = vreinterpretq_s32_u32(seed);
+            const int32x4_t   sum    =
+                vaddq_s32(vshrq_n_s32(vshlq_n_s32(bits, 16), 16),
+                          vshrq_n_s32(bits, 16));
+            const float32x4_t target =
+                vsubq_f32(vmulq_f32(vld1q_f32(samples), scale), feedback);
+            const float32x4_t dithered =
+                vaddq_f32(target, vmulq_f32(vcvtq_f32_s32(sum), dither));
+            const float32x4_t level  =
+                vsubq_f32(vaddq_f32(dithered, round), round);
+
+            for (TUint k = taps - 1; k > 0; k--)
+            {
+                errors[k] = errors[k - 1];
+            }
+
+            errors[0] = vsubq_f32(level, target);
+            vst1q_f32(samples, vmulq_f32(level, lsb));
+
+            samples += n;
+        }
+
+        vst1q_u32(&aState.iSeeds[lane], seed);
+
+        for (TUint k = 0; k < taps; k++)
+        {
+            vst1q_f32(&aState.iErrors[k][lane], errors[k]);
+        }
+    }
+}
+
+#elif defined(__arm__) || defined(__aarch64__)
+
+#include <math.h>
+
+#include "SampleConvert.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// Built without NEON. Convert nothing and leave it to the scalar kernels.
+TUint OpenHome::Media::SampleConvertNeon(const SamplePermute& /*aPermute*/,
+                                         const TByte* /*aSrc*/,
+                                         TByte* /*aDst*/,
+                                         TUint /*aSamples*/)
+{
+    return 0;
+}
+
+// Built without NEON. Never selected, but keep the reference result.
+void OpenHome::Media::ChannelMixNeon(const TFloat* aColumns,
+                                     TUint aInChannels, const TFloat* aIn,
+                                     TFloat* aOut, TUint aFrames,
+                                     TFloat* aGain, const TFloat* aStep)
+{
+    const TUint n = ChannelMatrix::kMaxChannels;
+
+    for (TUint i = 0; i < aFrames; i++)
+    {
+        for (TUint o = 0; o < n; o++)
+        {
+            TFloat sum = 0;
+
+            for (TUint c = 0; c < aInChannels; c++)
+            {
+                sum += aIn[c] * aColumns[(c * n) + o];
+            }
+
+            aOut[o]   = sum * aGain[o];
+            aGain[o] += aStep[o];
+        }
+
+        aIn  += n;
+        aOut += n;
+    }
+}
+
+// Built without NEON. Never selected, but keep the reference result.
+void OpenHome::Media::SampleDitherNeon(DitherState& aState, TFloat* aSamples,
+                                       TUint aFrames, TUint aChannels,
+                                       TFloat aLsb)
+{
+    const TUint  n      = ChannelMatrix::kMaxChannels;
+    const TUint  taps   = DitherState::kMaxTaps;
+    const TFloat scale  = 1.0f / aLsb;
+    const TFloat dither = 1.0f / 65536;
+
+    for (TUint i = 0; i < aFrames; i++)
+    {
+        for (TUint c = 0; c < aChannels; c++)
+        {
+            TFloat feedback = 0;
+
+            for (TUint k = taps; k > 0; k--)
+            {
+                feedback += aState.iTaps[k - 1] * aState.iErrors[k - 1][c];
+            }
+
+            TUint seed = aState.iSeeds[c];
+
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            aState.iSeeds[c] = seed;
+
+            const TInt   sum    = ((TInt)(seed << 16) >> 16) +
+                                  ((TInt)seed >> 16);
+            const TFloat target = (aSamples[c] * scale) - feedback;
+            const TFloat level  = (TFloat)lrintf(target +
+                                                 ((TFloat)sum * dither));
+
+            for (TUint k = taps - 1; k > 0; k--)
+            {
+                aState.iErrors[k][c] = aState.iErrors[k - 1][c];
+            }
+
+            aState.iErrors[0][c] = level - target;
+            aSamples[c]          = level * aLsb;
+        }
+
+        aSamples += n;
+    }
+}
+
+#endif // __ARM_NEON || __ARM_NEON__
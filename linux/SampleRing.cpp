@@ -0,0 +1,137 @@
+#include <OpenHome/Private/Standard.h>
+
+#include "SampleRing.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+SampleRing::SampleRing()
+: iCapacity(0)
+, iWrite(0)
+, iRead(0)
+, iPeak(0)
+{
+}
+
+void SampleRing::Configure(TUint aBytes, TUint aFrameBytes)
+{
+    ASSERT(aFrameBytes != 0);
+    ASSERT(Empty());
+
+    TUint bytes = aBytes - (aBytes % aFrameBytes);
+
+    if (bytes == 0)
+    {
+        bytes = aFrameBytes;
+    }
+
+    // The storage only ever grows, streams switching between formats
+    // reuse it.
+    if (bytes > iBuffer.MaxBytes())
+    {
+        iBuffer.Grow(bytes);
+    }
+
+    iCapacity = bytes;
+
+    iWrite.store(0, std::memory_order_relaxed);
+    iRead.store(0, std::memory_order_relaxed);
+    iPeak.store(0, std::memory_order_relaxed);
+}
+
+TUint SampleRing::CapacityBytes() const
+{
+    return iCapacity;
+}
+
+TUint SampleRing::OccupancyBytes() const
+{
+    return Fill(iWrite.load(std::memory_order_acquire),
+                iRead.load(std::memory_order_acquire));
+}
+
+TUint SampleRing::PeakBytes() const
+{
+    return iPeak.load(std::memory_order_relaxed);
+}
+
+TBool SampleRing::Empty() const
+{
+    return OccupancyBytes() == 0;
+}
+
+TByte* SampleRing::WriteSpace(TUint& aBytes)
+{
+    const TUint write = iWrite.load(std::memory_order_relaxed);
+    const TUint read  = iRead.load(std::memory_order_acquire);
+    const TUint pos   = write % iCapacity;
+    TUint       space = iCapacity - Fill(write, read);
+
+    if (space > iCapacity - pos)
+    {
+        space = iCapacity - pos;
+    }
+
+    if (aBytes > space)
+    {
+        aBytes = space;
+    }
+
+    return const_cast<TByte*>(iBuffer.Ptr()) + pos;
+}
+
+void SampleRing::Produce(TUint aBytes)
+{
+    const TUint write = Advance(iWrite.load(std::memory_order_relaxed),
+                                aBytes);
+
+    iWrite.store(write, std::memory_order_release);
+
+    const TUint fill = Fill(write, iRead.load(std::memory_order_relaxed));
+
+    if (fill > iPeak.load(std::memory_order_relaxed))
+    {
+        iPeak.store(fill, std::memory_order_relaxed);
+    }
+}
+
+const TByte* SampleRing::ReadData(TUint& aBytes) const
+{
+    const TUint read  = iRead.load(std::memory_order_relaxed);
+    const TUint write = iWrite.load(std::memory_order_acquire);
+    const TUint pos   = read % iCapacity;
+    TUint       fill  = Fill(write, read);
+
+    if (fill > iCapacity - pos)
+    {
+        fill = iCapacity - pos;
+    }
+
+    aBytes = fill;
+
+    return iBuffer.Ptr() + pos;
+}
+
+void SampleRing::Consume(TUint aBytes)
+{
+    iRead.store(Advance(iRead.load(std::memory_order_relaxed), aBytes),
+                std::memory_order_release);
+}
+
+TUint SampleRing::Fill(TUint aWrite, TUint aRead) const
+{
+    return (aWrite >= aRead) ? (aWrite - aRead)
+                             : ((2 * iCapacity) - aRead + aWrite);
+}
+
+TUint SampleRing::Advance(TUint aIndex, TUint aBytes) const
+{
+    aIndex += aBytes;
+
+    if (aIndex >= 2 * iCapacity)
+    {
+        aIndex -= 2 * iCapacity;
+    }
+
+    return aIndex;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Types.h>
+
+#include <atomic>
+
+// Single producer, single consumer ring of converted audio.
+//
+// The pipeline thread converts into the ring and the ALSA writer thread
+// drains it. Neither side takes a lock: each owns one index and publishes
+// it with release semantics. Waiting, when the ring is full or empty, is
+// left to the caller.
+//
+// Space and data are handed out as contiguous runs. The capacity is a
+// whole number of frames so a run never splits a frame.
+
+namespace OpenHome {
+namespace Media {
+
+class SampleRing
+{
+public:
+    SampleRing();
+
+    // Resize for a new stream. Must only be called while the ring is
+    // empty and the consumer is idle.
+    void  Configure(TUint aBytes, TUint aFrameBytes);
+    TUint CapacityBytes() const;
+    TUint OccupancyBytes() const;
+    TUint PeakBytes() const;        // Highest occupancy since Configure().
+    TBool Empty() const;
+public: // Producer
+    // Return contiguous free space. aBytes holds the number of bytes
+    // wanted on entry and the number available, in whole frames, on exit.
+    TByte*       WriteSpace(TUint& aBytes);
+    void         Produce(TUint aBytes);
+public: // Consumer
+    // Return contiguous queued data, in whole frames, in aBytes.
+    const TByte* ReadData(TUint& aBytes) const;
+    void         Consume(TUint aBytes);
+private:
+    // Indices run over [0, 2 * capacity) so a full ring can be told apart
+    // from an empty one.
+    TUint Fill(TUint aWrite, TUint aRead) const;
+    TUint Advance(TUint aIndex, TUint aBytes) const;
+private:
+    Bwh                iBuffer;
+    TUint              iCapacity;
+    std::atomic<TUint> iWrite;
+    std::atomic<TUint> iRead;
+    std::atomic<TUint> iPeak;
+};
+
+} // namespace Media
+} // namespace OpenHome
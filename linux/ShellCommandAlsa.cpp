@@ -0,0 +1,114 @@
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Private/Ascii.h>
+
+#include <time.h>
+
+#include "AlsaDevices.h"
+#include "DriverAlsa.h"
+#include "ShellCommandAlsa.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+static const TChar* kShellCommandAlsa = "alsa";
+
+static TUint64 MonotonicNs()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((TUint64)now.tv_sec * 1000000000) + now.tv_nsec;
+}
+
+ShellCommandAlsa::ShellCommandAlsa(Shell& aShell, DriverAlsa& aDriver)
+    : iShell(aShell)
+    , iDriver(aDriver)
+{
+    iShell.AddCommandHandler(kShellCommandAlsa, *this);
+}
+
+ShellCommandAlsa::~ShellCommandAlsa()
+{
+    iShell.RemoveCommandHandler(kShellCommandAlsa);
+}
+
+void ShellCommandAlsa::HandleShellCommand(Brn /*aCommand*/,
+                                          const std::vector<Brn>& aArgs,
+                                          IWriter& aResponse)
+{
+    if ((aArgs.size() == 2) && (aArgs[0] == Brn("start")))
+    {
+        TUint ms;
+
+        try
+        {
+            ms = Ascii::Uint(aArgs[1]);
+        }
+        catch (AsciiError&)
+        {
+            DisplayHelp(aResponse);
+            return;
+        }
+
+        iDriver.StartAt((ms == 0) ? 0 : MonotonicNs() + (TUint64)ms * 1000000);
+        aResponse.Write((ms == 0) ? Brn("Scheduled start cancelled\n")
+                                  : Brn("Scheduled the next stream's start\n"));
+        return;
+    }
+
+    if (aArgs.size() != 1)
+    {
+        DisplayHelp(aResponse);
+        return;
+    }
+
+    if (aArgs[0] == Brn("caps"))
+    {
+        iDriver.WriteCapabilities(aResponse);
+    }
+    else if (aArgs[0] == Brn("devices"))
+    {
+        std::vector<AlsaDeviceHint> devices;
+
+        AlsaListDevices(devices);
+
+        for (auto& device : devices)
+        {
+            aResponse.Write(Brn(device.iName.c_str()));
+            aResponse.Write(Brn("\n"));
+        }
+    }
+    else if (aArgs[0] == Brn("calibrate"))
+    {
+        iDriver.RequestCalibration();
+        aResponse.Write(Brn("Calibration will run at the next stream\n"));
+    }
+    else if (aArgs[0] == Brn("stats"))
+    {
+        iDriver.WriteStats(aResponse);
+    }
+    else if (aArgs[0] == Brn("reset"))
+    {
+        iDriver.ResetStats();
+        aResponse.Write(Brn("Statistics reset\n"));
+    }
+    else
+    {
+        DisplayHelp(aResponse);
+    }
+}
+
+void ShellCommandAlsa::DisplayHelp(IWriter& aResponse)
+{
+    aResponse.Write(Brn("ALSA audio driver\n"));
+    aResponse.Write(Brn("  caps       device capabilities and the format "
+                        "chosen for the last stream\n"));
+    aResponse.Write(Brn("  devices    ALSA playback devices\n"));
+    aResponse.Write(Brn("  calibrate  find the lowest stable buffer and "
+                        "period times at the next stream\n"));
+    aResponse.Write(Brn("  stats      xrun, write and drain telemetry\n"));
+    aResponse.Write(Brn("  reset      clear the telemetry\n"));
+    aResponse.Write(Brn("  start <ms> start the next stream <ms> "
+                        "milliseconds from now, 0 to cancel\n"));
+}
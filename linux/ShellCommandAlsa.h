@@ -0,0 +1,36 @@
+#pragma once
+
+#include <OpenHome/Private/Shell.h>
+
+namespace OpenHome {
+namespace Media {
+    class DriverAlsa;
+}
+
+// Debug shell access to the ALSA driver.
+//
+//   alsa caps       Device capabilities and how the last stream's format
+//                   was chosen.
+//   alsa devices    ALSA playback devices, as 'aplay -L' lists them.
+//   alsa calibrate  Recalibrate buffer and period times at the next
+//                   stream.
+//   alsa stats      Xrun, write and drain telemetry.
+//   alsa reset      Clear the telemetry.
+//   alsa start <ms> Start the next stream <ms> milliseconds from now, 0 to
+//                   cancel.
+
+class ShellCommandAlsa : private IShellCommandHandler
+{
+public:
+    ShellCommandAlsa(Shell& aShell, Media::DriverAlsa& aDriver);
+    ~ShellCommandAlsa();
+private: // from IShellCommandHandler
+    void HandleShellCommand(Brn aCommand, const std::vector<Brn>& aArgs,
+                            IWriter& aResponse) override;
+    void DisplayHelp(IWriter& aResponse) override;
+private:
+    Shell&             iShell;
+    Media::DriverAlsa& iDriver;
+};
+
+} // namespace OpenHome
@@ -0,0 +1,368 @@
+#include <OpenHome/Private/Printer.h>
+#include <OpenHome/Private/Thread.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "ThreadScheduler.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// RT priorities between the top of the output band and the top of the
+// decode band, so decoding never preempts output.
+static const TUint kBandGap = 10;
+
+ThreadScheduler::ThreadScheduler()
+    : iRtRequested(0)
+    , iRtPriority(0)
+    , iRtReason("disabled")
+{
+    for (auto& cpus : iCpus)
+    {
+        CPU_ZERO(&cpus.iSet);
+        cpus.iPinned = false;
+    }
+
+    // The decoder thread of the pipeline's codec controller.
+    iDecodeThreads.push_back("CodecController");
+}
+
+void ThreadScheduler::SetRtPriority(TUint aPriority)
+{
+    iRtRequested = aPriority;
+    iRtPriority  = 0;
+    iRtReason    = "disabled";
+
+    if (aPriority == 0)
+    {
+        return;
+    }
+
+    TUint wanted = aPriority;
+    const int max = sched_get_priority_max(SCHED_FIFO);
+
+    if ((max > 0) && (wanted > (TUint)max))
+    {
+        wanted = max;
+    }
+
+    // Root may take any RT priority. Others are held to RLIMIT_RTPRIO,
+    // which the soft limit can be raised towards.
+    struct rlimit limit;
+
+    if ((geteuid() != 0) && (getrlimit(RLIMIT_RTPRIO, &limit) == 0))
+    {
+        if ((limit.rlim_cur < wanted) && (limit.rlim_max > limit.rlim_cur))
+        {
+            struct rlimit raised = limit;
+
+            raised.rlim_cur = (limit.rlim_max < wanted) ? limit.rlim_max
+                                                        : wanted;
+
+            if (setrlimit(RLIMIT_RTPRIO, &raised) == 0)
+            {
+                limit = raised;
+            }
+        }
+
+        if (limit.rlim_cur < wanted)
+        {
+            char reason[64];
+
+            snprintf(reason, sizeof(reason), "RLIMIT_RTPRIO %u",
+                     (TUint)limit.rlim_cur);
+
+            wanted    = (TUint)limit.rlim_cur;
+            iRtReason = reason;
+        }
+    }
+
+    iRtPriority = wanted;
+
+    if (iRtPriority == iRtRequested)
+    {
+        iRtReason.clear();
+    }
+    else if (iRtPriority != 0)
+    {
+        Log::Print("ThreadScheduler: RT priority %u capped at %u by %s\n",
+                   iRtRequested, iRtPriority, iRtReason.c_str());
+    }
+}
+
+TBool ThreadScheduler::SetCpus(Role aRole, const TChar* aList)
+{
+    Cpus& cpus = iCpus[(TUint)aRole];
+
+    cpus.iPinned = ParseCpus(aList, cpus.iSet);
+
+    if (! cpus.iPinned)
+    {
+        Log::Print("ThreadScheduler: Ignoring CPU list '%s'\n", aList);
+    }
+
+    return cpus.iPinned;
+}
+
+void ThreadScheduler::AddDecodeThread(const TChar* aName)
+{
+    iDecodeThreads.push_back(aName);
+}
+
+TUint ThreadScheduler::RtPriority() const
+{
+    return iRtPriority;
+}
+
+void ThreadScheduler::ApplyToCurrent(Role aRole, const TChar* aName,
+                                     TUint aPriority) const
+{
+    Apply((pid_t)syscall(SYS_gettid), aRole, aName, aPriority);
+}
+
+void ThreadScheduler::ApplyToDecode() const
+{
+    DIR* dir = opendir("/proc/self/task");
+
+    if (dir == NULL)
+    {
+        Log::Print("ThreadScheduler: Can't list threads (%s)\n",
+                   strerror(errno));
+        return;
+    }
+
+    std::vector<TBool> found(iDecodeThreads.size(), false);
+    struct dirent*     entry;
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        const pid_t tid = (pid_t)strtol(entry->d_name, NULL, 10);
+
+        if (tid <= 0)
+        {
+            continue;
+        }
+
+        char  path[64];
+        char  comm[32] = "";
+        FILE* file;
+
+        snprintf(path, sizeof(path), "/proc/self/task/%d/comm", (int)tid);
+
+        if ((file = fopen(path, "r")) == NULL)
+        {
+            continue;  // The thread has exited.
+        }
+
+        if (fgets(comm, sizeof(comm), file) != NULL)
+        {
+            comm[strcspn(comm, "\n")] = '\0';
+        }
+
+        fclose(file);
+
+        // The kernel keeps the first 15 characters of a thread's name.
+        for (TUint i = 0; i < iDecodeThreads.size(); i++)
+        {
+            if (iDecodeThreads[i].compare(0, 15, comm) == 0)
+            {
+                Apply(tid, Role::Decode, iDecodeThreads[i].c_str(),
+                      kPriorityHighest);
+                found[i] = true;
+            }
+        }
+    }
+
+    closedir(dir);
+
+    for (TUint i = 0; i < iDecodeThreads.size(); i++)
+    {
+        if (! found[i])
+        {
+            Log::Print("ThreadScheduler: No thread named %s\n",
+                       iDecodeThreads[i].c_str());
+        }
+    }
+}
+
+// The output band takes kPrioritySystemHighest down to just above
+// kPriorityHighest. The decode band starts kBandGap lower, at
+// kPriorityHighest, and ends above kPriorityHigh.
+TUint ThreadScheduler::RtPriorityFor(TUint aPriority) const
+{
+    TUint drop;
+
+    if ((iRtPriority == 0) || (aPriority <= kPriorityHigh))
+    {
+        return 0;
+    }
+
+    if (aPriority > kPriorityHighest)
+    {
+        drop = kPrioritySystemHighest -
+               std::min(aPriority, kPrioritySystemHighest);
+        drop = std::min(drop, kBandGap - 1);
+    }
+    else
+    {
+        drop = kBandGap + (kPriorityHighest - aPriority);
+    }
+
+    return (iRtPriority > drop) ? iRtPriority - drop : 1;
+}
+
+void ThreadScheduler::Apply(pid_t aTid, Role aRole, const char* aName,
+                            TUint aPriority) const
+{
+    const Cpus& cpus     = iCpus[(TUint)aRole];
+    std::string affinity = "any cpu";
+
+    if (cpus.iPinned)
+    {
+        if (sched_setaffinity(aTid, sizeof(cpus.iSet), &cpus.iSet) == 0)
+        {
+            affinity = "cpus " + CpuList(cpus.iSet);
+        }
+        else
+        {
+            affinity += " (";
+            affinity += strerror(errno);
+            affinity += ")";
+        }
+    }
+
+    const TUint rtPriority = RtPriorityFor(aPriority);
+    std::string reason     = iRtReason;
+
+    if (rtPriority != 0)
+    {
+        struct sched_param param;
+
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = rtPriority;
+
+        // Children of an RT thread, such as a shell command, don't
+        // inherit its policy.
+        if (sched_setscheduler(aTid, SCHED_FIFO | SCHED_RESET_ON_FORK,
+                               &param) == 0)
+        {
+            Log::Print("ThreadScheduler: %s SCHED_FIFO %u, %s\n", aName,
+                       rtPriority, affinity.c_str());
+            return;
+        }
+
+        reason = strerror(errno);
+    }
+    else if (iRtPriority != 0)
+    {
+        reason = "below the audio band";
+    }
+
+    Log::Print("ThreadScheduler: %s SCHED_OTHER (%s), %s\n", aName,
+               reason.c_str(), affinity.c_str());
+}
+
+TBool ThreadScheduler::ParseCpus(const TChar* aList, cpu_set_t& aSet)
+{
+    const long  cpus = sysconf(_SC_NPROCESSORS_CONF);
+    const char* ptr  = aList;
+
+    CPU_ZERO(&aSet);
+
+    for (;;)
+    {
+        char*         end;
+        unsigned long first = strtoul(ptr, &end, 10);
+        unsigned long last  = first;
+
+        if (end == ptr)
+        {
+            return false;
+        }
+
+        if (*end == '-')
+        {
+            ptr  = end + 1;
+            last = strtoul(ptr, &end, 10);
+
+            if ((end == ptr) || (last < first))
+            {
+                return false;
+            }
+        }
+
+        if ((last >= CPU_SETSIZE) ||
+            ((cpus > 0) && (last >= (unsigned long)cpus)))
+        {
+            return false;
+        }
+
+        for (unsigned long cpu = first; cpu <= last; cpu++)
+        {
+            CPU_SET(cpu, &aSet);
+        }
+
+        if (*end == '\0')
+        {
+            return true;
+        }
+
+        if (*end != ',')
+        {
+            return false;
+        }
+
+        ptr = end + 1;
+    }
+}
+
+// Format aSet as a list of ranges, "0,2-3".
+std::string ThreadScheduler::CpuList(const cpu_set_t& aSet)
+{
+    std::string list;
+
+    for (TUint cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (! CPU_ISSET(cpu, &aSet))
+        {
+            continue;
+        }
+
+        TUint last = cpu;
+
+        while ((last + 1 < CPU_SETSIZE) && CPU_ISSET(last + 1, &aSet))
+        {
+            last++;
+        }
+
+        char range[24];
+
+        if (last == cpu)
+        {
+            snprintf(range, sizeof(range), "%u", cpu);
+        }
+        else
+        {
+            snprintf(range, sizeof(range), "%u-%u", cpu, last);
+        }
+
+        if (! list.empty())
+        {
+            list += ",";
+        }
+
+        list += range;
+        cpu   = last;
+    }
+
+    return list;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <OpenHome/Types.h>
+
+#include <sched.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+// Real-time scheduling of the player's audio threads.
+//
+// Left to ohNet the pipeline animator and decode threads share every core
+// with GTK, the web UI and ohNet's own threads. Threads are placed in one
+// of two roles: output (the pipeline animator and ALSA writers) and decode.
+// Each role may be pinned to a set of cores.
+//
+// OpenHome priorities map to SCHED_FIFO in two bands. Those above
+// kPriorityHighest, the output threads', take the configured RT priority
+// at kPrioritySystemHighest and one less for each step below it. Those
+// from kPriorityHighest down to just above kPriorityHigh, the pipeline's,
+// start 10 lower. Lower priorities keep SCHED_OTHER.
+//
+// Unless running as root the RT priority is capped by RLIMIT_RTPRIO, whose
+// soft limit is raised as far as the hard limit allows. Where no RT
+// priority is permitted threads keep SCHED_OTHER and are still pinned.
+// Every thread the policy touches is logged with what was applied.
+
+namespace OpenHome {
+namespace Media {
+
+class ThreadScheduler
+{
+public:
+    enum class Role { Output, Decode };
+    static const TUint kRtPriorityDefault = 70;
+public:
+    ThreadScheduler();
+    // Configure before any thread is started. 0 disables RT scheduling.
+    void  SetRtPriority(TUint aPriority);
+    // CPU lists, as in "2,3" or "2-3". Return false, leaving the role
+    // unpinned, for a malformed list or cores this host lacks.
+    TBool SetCpus(Role aRole, const TChar* aList);
+    // Decode threads, named as ohMediaPlayer names them.
+    void  AddDecodeThread(const TChar* aName);
+    // The RT priority in use once RLIMIT_RTPRIO has been applied, 0 if
+    // threads keep SCHED_OTHER.
+    TUint RtPriority() const;
+    // Apply the policy to the calling thread, which runs at OpenHome
+    // priority aPriority.
+    void  ApplyToCurrent(Role aRole, const TChar* aName,
+                         TUint aPriority) const;
+    // Apply the decode policy to the decode threads, found by name among
+    // the process's threads. Call once the pipeline has started them.
+    void  ApplyToDecode() const;
+private:
+    struct Cpus
+    {
+        cpu_set_t iSet;
+        TBool     iPinned;
+    };
+private:
+    TUint RtPriorityFor(TUint aPriority) const;
+    void  Apply(pid_t aTid, Role aRole, const char* aName,
+                TUint aPriority) const;
+    static TBool       ParseCpus(const TChar* aList, cpu_set_t& aSet);
+    static std::string CpuList(const cpu_set_t& aSet);
+private:
+    TUint                    iRtRequested;
+    TUint                    iRtPriority;
+    std::string              iRtReason;  // Why iRtPriority falls short.
+    Cpus                     iCpus[2];   // By Role.
+    std::vector<std::string> iDecodeThreads;
+};
+
+} // namespace Media
+} // namespace OpenHome
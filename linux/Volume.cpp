@@ -78,14 +78,20 @@ IVolumeProfile::StartupVolume VolumeProfile::StartupVolumeConfig() const
     return IVolumeProfile::StartupVolume::Both;
 }
 
-VolumeControl::VolumeControl()
+VolumeControl::VolumeControl(const TChar* aCard)
+    : iElem(NULL)
 {
-    const TChar *CARD          = "default";
     const TChar *SELEM_NAMES[] = {"Digital", "PCM", "Master"};
 
-    // Get the mixer element for the default sound card.
+    // Get the mixer element for the sound card.
     snd_mixer_open(&iHandle, 0);
-    snd_mixer_attach(iHandle, CARD);
+
+    if (snd_mixer_attach(iHandle, aCard) < 0)
+    {
+        Log::Print("VolumeControl: No mixer for '%s'\n", aCard);
+        return;
+    }
+
     snd_mixer_selem_register(iHandle, NULL, NULL);
     snd_mixer_load(iHandle);
 
@@ -185,3 +191,75 @@ void VolumeControl::SetFade(TInt /*aFade*/)
 {
     // Not Implemented
 }
+
+// DigitalVolume
+
+DigitalVolume::DigitalVolume(const IVolumeProfile& aProfile)
+    : iUnity(aProfile.VolumeUnity() * aProfile.VolumeMilliDbPerStep())
+    , iBalanceMax((TInt)aProfile.BalanceMax())
+    , iFadeMax((TInt)aProfile.FadeMax())
+    , iVolume(1.0f)
+    , iBalance(0.0f)
+    , iFade(0.0f)
+    , iGeneration(0)
+{
+}
+
+void DigitalVolume::SetVolume(TUint aVolume)
+{
+    const TUint kMilliDbPerDb = 1024;
+    TFloat      gain          = 1.0f;
+
+    if (aVolume == 0)
+    {
+        gain = 0.0f;
+    }
+    else if (aVolume < iUnity)
+    {
+        const double db = -(double)(iUnity - aVolume) / kMilliDbPerDb;
+
+        gain = (TFloat)pow(10.0, db / 20.0);
+    }
+
+    iVolume.store(gain, std::memory_order_relaxed);
+    Changed();
+}
+
+void DigitalVolume::SetBalance(TInt aBalance)
+{
+    if (iBalanceMax > 0)
+    {
+        iBalance.store((TFloat)aBalance / iBalanceMax,
+                       std::memory_order_relaxed);
+        Changed();
+    }
+}
+
+void DigitalVolume::SetFade(TInt aFade)
+{
+    if (iFadeMax > 0)
+    {
+        iFade.store((TFloat)aFade / iFadeMax, std::memory_order_relaxed);
+        Changed();
+    }
+}
+
+// Settings are published before the generation, so a reader that sees a
+// new generation reads settings at least that new.
+void DigitalVolume::Changed()
+{
+    iGeneration.fetch_add(1, std::memory_order_release);
+}
+
+TUint DigitalVolume::VolumeGeneration() const
+{
+    return iGeneration.load(std::memory_order_acquire);
+}
+
+void DigitalVolume::ReadVolume(TFloat& aVolume, TFloat& aBalance,
+                               TFloat& aFade) const
+{
+    aVolume  = iVolume.load(std::memory_order_relaxed);
+    aBalance = iBalance.load(std::memory_order_relaxed);
+    aFade    = iFade.load(std::memory_order_relaxed);
+}
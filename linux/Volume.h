@@ -7,6 +7,10 @@
 
 #include <alsa/asoundlib.h>
 
+#include <atomic>
+
+#include "DriverAlsa.h"
+
 namespace OpenHome {
 namespace Av {
 
@@ -47,7 +51,7 @@ private: // from IVolumeProfile
 class VolumeControl : public IVolume, public IBalance, public IFade
 {
 public:
-    VolumeControl();
+    VolumeControl(const TChar* aCard);  // e.g. "default" or "hw:0"
     ~VolumeControl();
     TBool IsVolumeSupported();
 private:
@@ -61,5 +65,38 @@ private: // from IFade
     void SetFade(TInt aFade) override;
 };
 
+// Volume, balance and fade applied to the samples by DriverAlsa, for
+// cards without a mixer element VolumeControl can use.
+//
+// Each volume step is VolumeMilliDbPerStep() binary milli-dB from unity.
+// Samples can't be raised above full scale without clipping, so volumes
+// above unity play at unity.
+class DigitalVolume : public IVolume, public IBalance, public IFade,
+                      public Media::IDriverAlsaVolume
+{
+public:
+    DigitalVolume(const IVolumeProfile& aProfile);
+private: // from IVolume
+    void SetVolume(TUint aVolume) override;
+private: // from IBalance
+    void SetBalance(TInt aBalance) override;
+private: // from IFade
+    void SetFade(TInt aFade) override;
+private: // from Media::IDriverAlsaVolume
+    TUint VolumeGeneration() const override;
+    void  ReadVolume(Media::TFloat& aVolume, Media::TFloat& aBalance,
+                     Media::TFloat& aFade) const override;
+private:
+    void Changed();
+private:
+    const TUint                iUnity;  // Binary milli-dB.
+    const TInt                 iBalanceMax;
+    const TInt                 iFadeMax;
+    std::atomic<Media::TFloat> iVolume;
+    std::atomic<Media::TFloat> iBalance;
+    std::atomic<Media::TFloat> iFade;
+    std::atomic<TUint>         iGeneration;
+};
+
 } // namespace Av
 } // namespace OpenHome
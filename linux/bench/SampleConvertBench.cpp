@@ -0,0 +1,172 @@
+// Sample conversion benchmark.
+//
+// Times SampleConverter taking 24 bit stereo to S16, as for a device stuck
+// on a 16 bit profile, with each DitherMode. Costs are reported per sample
+// in CPU cycles, where perf counters are available, and in nanoseconds,
+// with the share of one core needed to keep up with 192kHz stereo.
+//
+// Built by 'make -f Makefile.<platform> bench', which runs it.
+
+#include <OpenHome/Types.h>
+
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "SampleConvert.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+static const TUint kChannels   = 2;
+static const TUint kInBytes    = 3;
+static const TUint kFrames     = 4096;  // Per conversion, as in a fragment.
+static const TUint kPasses     = 500;
+static const TUint kSampleRate = 192000;
+
+// Cycles spent by this thread, read through perf. Open() fails where the
+// kernel has no counters or perf_event_paranoid forbids them.
+class CycleCounter
+{
+public:
+    CycleCounter();
+    ~CycleCounter();
+    TBool   Open();
+    TUint64 Read() const;
+private:
+    int iFd;
+};
+
+CycleCounter::CycleCounter()
+: iFd(-1)
+{
+}
+
+CycleCounter::~CycleCounter()
+{
+    if (iFd >= 0)
+    {
+        close(iFd);
+    }
+}
+
+TBool CycleCounter::Open()
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.size           = sizeof(attr);
+    attr.config         = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+
+    iFd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+
+    return iFd >= 0;
+}
+
+TUint64 CycleCounter::Read() const
+{
+    TUint64 cycles = 0;
+
+    if (read(iFd, &cycles, sizeof(cycles)) != sizeof(cycles))
+    {
+        return 0;
+    }
+
+    return cycles;
+}
+
+static TUint64 MonotonicNs()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((TUint64)now.tv_sec * 1000000000) + now.tv_nsec;
+}
+
+int main()
+{
+    static const DitherMode modes[] =
+    {
+        DitherMode::Off, DitherMode::Tpdf, DitherMode::FirstOrder,
+        DitherMode::SecondOrder, DitherMode::Weighted
+    };
+
+    std::vector<TByte> src(kFrames * kChannels * kInBytes);
+    std::vector<TByte> dst(kFrames * kChannels * 2);
+    TUint              seed = 1;
+
+    // Full scale noise, so no stage can take a shortcut.
+    for (auto& byte : src)
+    {
+        seed = (seed * 1103515245) + 12345;
+        byte = (TByte)(seed >> 16);
+    }
+
+    ChannelMatrix matrix;
+
+    matrix.SetIdentity(kChannels);
+
+    CycleCounter counter;
+    const TBool  counting = counter.Open();
+
+    printf("24 bit stereo to S16, %s kernels\n",
+           SampleConverter::IsaName(SampleConverter::SelectedIsa()));
+
+    if (! counting)
+    {
+        printf("No cycle counter, reporting time only\n");
+    }
+
+    for (auto mode : modes)
+    {
+        SampleConverter converter;
+        SampleGain      gain;
+        SampleDither    dither;
+
+        converter.Set(kInBytes, SampleLayout::S16Le, matrix);
+        dither.SetMode(mode);
+
+        // Warm the caches and branch predictors.
+        converter.Convert(src.data(), dst.data(), kFrames, gain, dither);
+
+        const TUint64 startCycles = counting ? counter.Read() : 0;
+        const TUint64 startNs     = MonotonicNs();
+
+        for (TUint i = 0; i < kPasses; i++)
+        {
+            converter.Convert(src.data(), dst.data(), kFrames, gain, dither);
+        }
+
+        const TUint64 ns      = MonotonicNs() - startNs;
+        const TUint64 cycles  = counting ? counter.Read() - startCycles : 0;
+        const double  samples = (double)kPasses * kFrames * kChannels;
+        const double  load    = (100.0 * ns * kSampleRate) /
+                                ((double)kPasses * kFrames * 1e9);
+
+        if (counting)
+        {
+            printf("%-9s %7.2f cycles/sample %7.2f ns/sample"
+                   " %6.2f%% of a core at %uHz\n",
+                   SampleDither::ModeName(mode), cycles / samples,
+                   ns / samples, load, kSampleRate);
+        }
+        else
+        {
+            printf("%-9s %7.2f ns/sample %6.2f%% of a core at %uHz\n",
+                   SampleDither::ModeName(mode), ns / samples, load,
+                   kSampleRate);
+        }
+    }
+
+    return 0;
+}